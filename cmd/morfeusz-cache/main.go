@@ -0,0 +1,164 @@
+// Command morfeusz-cache builds and compacts analysis caches,
+// and builds form tables.
+//
+// Usage:
+//
+//	morfeusz-cache [flags] -cache file [vocabulary...]
+//	morfeusz-cache [flags] -forms file -top n frequency-list...
+//
+// With -cache, every line of the vocabulary files is analysed as
+// a separate text with the dictionary and settings given by the flags,
+// and the lines missing from the cache are logged. The log is then
+// merged into the table of the cache, so without vocabulary files the
+// command only compacts the cache. Processes using the cache keep its
+// old table until they open it again, and what they log meanwhile
+// may be lost.
+//
+// With -forms, the command writes a form table with the analyses
+// of the -top most frequent forms in the frequency lists, made
+// on -threads threads. Every line of a list holds a form, optionally
+// followed by a tab and its frequency; a line with no frequency counts
+// as one occurrence of its form.
+package main
+
+import (
+	"bufio"
+	"flag"
+	"log"
+	"os"
+	"runtime"
+	"sort"
+	"strconv"
+	"strings"
+
+	"github.com/go-morfeusz/morfeusz"
+	"github.com/go-morfeusz/morfeusz/internal/cli"
+)
+
+var (
+	cacheFile = flag.String("cache", "", "analysis cache file")
+	batchSize = flag.Int("batch", 1024, "lines analysed in one call")
+	formsFile = flag.String("forms", "", "form table file")
+	top       = flag.Int("top", 100000, "number of forms in the form table")
+	threads   = flag.Int("threads", runtime.NumCPU(), "number of threads")
+	config    = cli.NewConfigFlags()
+)
+
+func main() {
+	log.SetFlags(0)
+	log.SetPrefix("morfeusz-cache: ")
+	flag.Parse()
+	if (*cacheFile == "") == (*formsFile == "") || *batchSize < 1 ||
+		*top < 1 || *threads < 1 {
+		flag.Usage()
+		os.Exit(2)
+	}
+	if *formsFile != "" {
+		buildForms()
+		return
+	}
+	if flag.NArg() > 0 {
+		m := newMorfeusz()
+		c, err := morfeusz.OpenAnalysisCache(*cacheFile)
+		if err != nil {
+			log.Fatal(err)
+		}
+		m.SetAnalysisCache(c)
+		for _, name := range flag.Args() {
+			analyseLines(m, name)
+		}
+		s := c.Stats()
+		log.Printf("%d lines found in the cache, %d analysed", s.Hits, s.Misses)
+	}
+	if err := morfeusz.CompactAnalysisCache(*cacheFile); err != nil {
+		log.Fatal(err)
+	}
+	c, err := morfeusz.OpenAnalysisCache(*cacheFile)
+	if err != nil {
+		log.Fatal(err)
+	}
+	log.Printf("%d entries in %s", c.Stats().Entries, *cacheFile)
+}
+
+func newMorfeusz() *morfeusz.Morfeusz {
+	m, err := config.New(morfeusz.AnalyseOnly)
+	if err != nil {
+		log.Fatal(err)
+	}
+	return m
+}
+
+// analyseLines analyses every line of the file called name
+// with m, in batches.
+func analyseLines(m *morfeusz.Morfeusz, name string) {
+	batch := make([]string, 0, *batchSize)
+	flush := func() {
+		if _, err := m.AnalyseStringsPacked(batch); err != nil {
+			log.Fatal(err)
+		}
+		batch = batch[:0]
+	}
+	readLines(name, func(line string) {
+		if batch = append(batch, line); len(batch) == *batchSize {
+			flush()
+		}
+	})
+	flush()
+}
+
+// buildForms writes the form table with the most frequent forms
+// in the frequency lists given as arguments.
+func buildForms() {
+	if flag.NArg() == 0 {
+		flag.Usage()
+		os.Exit(2)
+	}
+	counts := make(map[string]int64)
+	for _, name := range flag.Args() {
+		readLines(name, func(line string) {
+			form, n := line, int64(1)
+			if i := strings.LastIndexByte(line, '\t'); i >= 0 {
+				var err error
+				form = line[:i]
+				if n, err = strconv.ParseInt(line[i+1:], 10, 64); err != nil {
+					log.Fatalf("%s: %v", name, err)
+				}
+			}
+			counts[form] += n
+		})
+	}
+	forms := make([]string, 0, len(counts))
+	for f := range counts {
+		forms = append(forms, f)
+	}
+	sort.Slice(forms, func(i, j int) bool {
+		if counts[forms[i]] != counts[forms[j]] {
+			return counts[forms[i]] > counts[forms[j]]
+		}
+		return forms[i] < forms[j]
+	})
+	if len(forms) > *top {
+		forms = forms[:*top]
+	}
+	if err := newMorfeusz().BuildFormTable(*formsFile, forms, *threads); err != nil {
+		log.Fatal(err)
+	}
+	log.Printf("%d forms in %s", len(forms), *formsFile)
+}
+
+// readLines calls f with every line of the file called name.
+func readLines(name string, f func(string)) {
+	file, err := os.Open(name)
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer file.Close()
+	s := bufio.NewScanner(file)
+	s.Buffer(nil, 1<<20)
+	for s.Scan() {
+		f(s.Text())
+	}
+	if err := s.Err(); err != nil {
+		log.Fatalf("%s: %v", name, err)
+	}
+}
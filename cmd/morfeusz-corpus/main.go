@@ -0,0 +1,521 @@
+// Command morfeusz-corpus analyses a set of text files on several
+// threads and writes the results in input order.
+//
+// Usage:
+//
+//	morfeusz-corpus [flags] file...
+//
+// The files are mapped into memory and split into chunks that end
+// at line breaks. Each chunk is analysed separately by one of the
+// clones of an instance of Morfeusz, so node numbers start from 0
+// in every chunk. The chunks are distributed among the threads,
+// which steal work from one another when they run out of it.
+//
+// With -dedup, the distinct words of the chunks, delimited by ASCII
+// whitespace, are first collected, and each of them is analysed only
+// once. The chunks are then analysed by copying the analyses of their
+// words, which is much faster for large corpora, where most words
+// are frequent. It needs -whitespace skip, and the whole vocabulary
+// is held in memory.
+//
+// With -checkpoint, the progress is recorded periodically and on
+// interruption, and -resume continues an interrupted run with the same
+// dictionary and settings, appending to its output.
+//
+// The compact format is not supported, since it holds one document.
+package main
+
+import (
+	"bufio"
+	"bytes"
+	"encoding/binary"
+	"encoding/json"
+	"errors"
+	"flag"
+	"io"
+	"log"
+	"os"
+	"os/signal"
+	"reflect"
+	"runtime"
+	"sync"
+	"sync/atomic"
+	"syscall"
+	"time"
+	"unsafe"
+
+	"github.com/go-morfeusz/morfeusz"
+	"github.com/go-morfeusz/morfeusz/internal/cli"
+)
+
+var (
+	threads    = flag.Int("threads", runtime.NumCPU(), "number of threads")
+	output     = flag.String("o", "", "output file (default stdout)")
+	format     = cli.FormatFlag("format")
+	chunkSize  = flag.Int("chunk", 1<<20, "approximate chunk size in bytes")
+	dedup      = flag.Bool("dedup", false, "analyse every distinct word once")
+	checkpoint = flag.String("checkpoint", "", "checkpoint file")
+	resume     = flag.Bool("resume", false, "resume from the checkpoint")
+	interval   = flag.Duration(
+		"checkpoint-interval", 10*time.Second, "time between checkpoints")
+	config = cli.NewConfigFlags()
+)
+
+// A chunk is a piece of an input file, analysed as a whole.
+type chunk struct {
+	seq  int
+	data []byte
+}
+
+// A result is an analysed chunk.
+type result struct {
+	seq    int
+	data   []byte
+	tokens int
+	err    error
+}
+
+// State is the content of a checkpoint file.
+type State struct {
+	Inputs     []string
+	ChunkSize  int
+	Format     string
+	DictID     string
+	Config     map[string]string
+	NextSeq    int
+	OutputSize int64
+}
+
+// deque holds the chunks assigned to a worker, in order.
+type deque struct {
+	mu     sync.Mutex
+	chunks []chunk
+}
+
+func (d *deque) front() (seq int, ok bool) {
+	d.mu.Lock()
+	defer d.mu.Unlock()
+	if len(d.chunks) == 0 {
+		return 0, false
+	}
+	return d.chunks[0].seq, true
+}
+
+func (d *deque) popFront() (chunk, bool) {
+	d.mu.Lock()
+	defer d.mu.Unlock()
+	if len(d.chunks) == 0 {
+		return chunk{}, false
+	}
+	c := d.chunks[0]
+	d.chunks = d.chunks[1:]
+	return c, true
+}
+
+// scheduler hands out chunks to workers. A worker takes chunks
+// from its own deque and, when it is empty or the worker has got too
+// far ahead of the writer, steals the earliest chunk of all deques,
+// so that the output can be written without buffering much of it.
+type scheduler struct {
+	deques  []deque
+	written int64 // atomic: the number of chunks written so far
+	window  int
+}
+
+func newScheduler(chunks []chunk, workers int) *scheduler {
+	s := &scheduler{deques: make([]deque, workers), window: 4 * workers}
+	for i, c := range chunks {
+		d := &s.deques[i%workers]
+		d.chunks = append(d.chunks, c)
+	}
+	if len(chunks) > 0 {
+		s.written = int64(chunks[0].seq)
+	}
+	return s
+}
+
+func (s *scheduler) next(worker int) (chunk, bool) {
+	own := &s.deques[worker]
+	if seq, ok := own.front(); ok &&
+		seq-int(atomic.LoadInt64(&s.written)) < s.window {
+		if c, ok := own.popFront(); ok {
+			return c, true
+		}
+	}
+	for {
+		victim := -1
+		minSeq := 0
+		for i := range s.deques {
+			if seq, ok := s.deques[i].front(); ok &&
+				(victim < 0 || seq < minSeq) {
+				victim, minSeq = i, seq
+			}
+		}
+		if victim < 0 {
+			return chunk{}, false
+		}
+		if c, ok := s.deques[victim].popFront(); ok {
+			return c, true
+		}
+	}
+}
+
+func main() {
+	log.SetFlags(0)
+	log.SetPrefix("morfeusz-corpus: ")
+	flag.Parse()
+	inputs := flag.Args()
+	if len(inputs) == 0 || *threads < 1 || *chunkSize < 1 {
+		flag.Usage()
+		os.Exit(2)
+	}
+	f, err := cli.ParseFormat(*format)
+	if err != nil {
+		log.Fatal(err)
+	}
+	// Every chunk would be a separate compact document, and documents
+	// written one after another cannot be told apart.
+	if f == morfeusz.Compact {
+		log.Fatal("the compact format is not supported")
+	}
+	if *resume && (*checkpoint == "" || *output == "") {
+		log.Fatal("-resume needs -checkpoint and -o")
+	}
+	m, err := config.New(morfeusz.AnalyseOnly)
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	state := State{
+		Inputs:    inputs,
+		ChunkSize: *chunkSize,
+		Format:    *format,
+		DictID:    m.DictID(),
+		Config:    config.Values(),
+	}
+	if *resume {
+		state = readState(state)
+	}
+	var chunks []chunk
+	var inputBytes int64
+	for _, name := range inputs {
+		data := mmap(name)
+		for _, c := range split(data, *chunkSize) {
+			if seq := len(chunks); seq >= state.NextSeq {
+				inputBytes += int64(len(c))
+			}
+			chunks = append(chunks, chunk{len(chunks), c})
+		}
+	}
+	chunks = chunks[state.NextSeq:]
+
+	var v *morfeusz.Vocabulary
+	if *dedup {
+		start := time.Now()
+		words := collectWords(chunks, *threads)
+		if v, err = m.NewVocabulary(words, *threads); err != nil {
+			log.Fatal(err)
+		}
+		log.Printf("%d distinct words analysed in %.1fs",
+			len(words), time.Since(start).Seconds())
+	}
+
+	out := openOutput(state.OutputSize)
+	w := bufio.NewWriterSize(out, 1<<20)
+	s := newScheduler(chunks, *threads)
+	results := make(chan result, *threads)
+	var wg sync.WaitGroup
+	var stop int32
+	for i := 0; i < *threads; i++ {
+		wg.Add(1)
+		go func(worker int, m *morfeusz.Morfeusz) {
+			defer wg.Done()
+			for atomic.LoadInt32(&stop) == 0 {
+				c, ok := s.next(worker)
+				if !ok {
+					return
+				}
+				b, err := analyseChunk(m, v, c.data, f)
+				results <- result{c.seq, b, countTokens(b, f), err}
+			}
+		}(i, m.Clone())
+	}
+	go func() {
+		wg.Wait()
+		close(results)
+	}()
+	interrupts := make(chan os.Signal, 1)
+	signal.Notify(interrupts, os.Interrupt, syscall.SIGTERM)
+	go func() {
+		<-interrupts
+		log.Print("interrupted; finishing the chunks in progress")
+		atomic.StoreInt32(&stop, 1)
+	}()
+
+	start := time.Now()
+	lastCheckpoint := start
+	pending := map[int]result{}
+	var tokens, written int64
+	for r := range results {
+		if r.err != nil {
+			log.Fatalf("chunk %d: %v", r.seq, r.err)
+		}
+		pending[r.seq] = r
+		for {
+			r, ok := pending[state.NextSeq]
+			if !ok {
+				break
+			}
+			delete(pending, state.NextSeq)
+			if _, err := w.Write(r.data); err != nil {
+				log.Fatal(err)
+			}
+			state.NextSeq++
+			state.OutputSize += int64(len(r.data))
+			atomic.StoreInt64(&s.written, int64(state.NextSeq))
+			tokens += int64(r.tokens)
+			written += int64(len(chunks[r.seq-chunks[0].seq].data))
+		}
+		if *checkpoint != "" && time.Since(lastCheckpoint) >= *interval {
+			saveState(w, out, state)
+			lastCheckpoint = time.Now()
+		}
+	}
+	if err := w.Flush(); err != nil {
+		log.Fatal(err)
+	}
+	if *checkpoint != "" {
+		saveState(w, out, state)
+	}
+	elapsed := time.Since(start).Seconds()
+	log.Printf("%d of %d bytes, %d tokens in %.1fs: %.1f MB/s, %.0f tokens/s",
+		written, inputBytes, tokens, elapsed,
+		float64(written)/1e6/elapsed, float64(tokens)/elapsed)
+	if atomic.LoadInt32(&stop) != 0 {
+		os.Exit(1)
+	}
+}
+
+// mmap maps a file into memory. The mapping lasts until the process
+// exits.
+func mmap(name string) []byte {
+	f, err := os.Open(name)
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer f.Close()
+	fi, err := f.Stat()
+	if err != nil {
+		log.Fatal(err)
+	}
+	if fi.Size() == 0 {
+		return nil
+	}
+	data, err := syscall.Mmap(
+		int(f.Fd()), 0, int(fi.Size()), syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		log.Fatalf("%s: %v", name, err)
+	}
+	return data
+}
+
+// split divides data into chunks of about size bytes. Chunks end
+// after a newline if possible, or else after other whitespace,
+// so that no word is split.
+func split(data []byte, size int) [][]byte {
+	var ret [][]byte
+	for len(data) > size {
+		n := bytes.LastIndexByte(data[:size], '\n') + 1
+		if n == 0 {
+			n = bytes.LastIndexAny(data[:size], " \t\r\f\v") + 1
+		}
+		if n == 0 {
+			n = size
+		}
+		ret = append(ret, data[:n])
+		data = data[n:]
+	}
+	if len(data) > 0 {
+		ret = append(ret, data)
+	}
+	return ret
+}
+
+// analyseChunk analyses data with m, or with m and v if v is not nil.
+func analyseChunk(m *morfeusz.Morfeusz, v *morfeusz.Vocabulary,
+	data []byte, f morfeusz.Format) ([]byte, error) {
+	if v != nil {
+		return m.AnalyseStringAsWithVocabulary(v, unsafeString(data), f)
+	}
+	return m.AnalyseStringAs(unsafeString(data), f)
+}
+
+// collectWords returns the distinct words in chunks, delimited
+// by ASCII whitespace, collected on threads goroutines.
+func collectWords(chunks []chunk, threads int) []string {
+	sets := make([]map[string]struct{}, threads)
+	next := int64(-1)
+	var wg sync.WaitGroup
+	for i := range sets {
+		sets[i] = make(map[string]struct{})
+		wg.Add(1)
+		go func(set map[string]struct{}) {
+			defer wg.Done()
+			for {
+				j := int(atomic.AddInt64(&next, 1))
+				if j >= len(chunks) {
+					return
+				}
+				addWords(set, chunks[j].data)
+			}
+		}(sets[i])
+	}
+	wg.Wait()
+	for _, set := range sets[1:] {
+		for w := range set {
+			sets[0][w] = struct{}{}
+		}
+	}
+	words := make([]string, 0, len(sets[0]))
+	for w := range sets[0] {
+		words = append(words, w)
+	}
+	return words
+}
+
+// addWords adds to set the words in data.
+func addWords(set map[string]struct{}, data []byte) {
+	start := -1
+	for i := 0; i <= len(data); i++ {
+		if i < len(data) && !isSpace(data[i]) {
+			if start < 0 {
+				start = i
+			}
+			continue
+		}
+		if start >= 0 {
+			// The lookup does not copy the word.
+			if _, ok := set[string(data[start:i])]; !ok {
+				set[string(data[start:i])] = struct{}{}
+			}
+			start = -1
+		}
+	}
+}
+
+// isSpace tells whether c is ASCII whitespace, which delimits
+// the words analysed separately by a Vocabulary.
+func isSpace(c byte) bool {
+	switch c {
+	case ' ', '\t', '\n', '\r', '\f', '\v':
+		return true
+	}
+	return false
+}
+
+func unsafeString(b []byte) string {
+	if len(b) == 0 {
+		return ""
+	}
+	return unsafe.String(&b[0], len(b))
+}
+
+// countTokens returns the number of interpretations in b.
+func countTokens(b []byte, f morfeusz.Format) int {
+	switch f {
+	case morfeusz.Binary:
+		n := 0
+		for len(b) >= 8 {
+			b = b[8:]
+			for i := 0; i < 5; i++ {
+				b = b[4+binary.LittleEndian.Uint32(b):]
+			}
+			n++
+		}
+		return n
+	default:
+		return bytes.Count(b, []byte{'\n'})
+	}
+}
+
+func openOutput(size int64) *os.File {
+	if *output == "" {
+		return os.Stdout
+	}
+	if !*resume {
+		f, err := os.Create(*output)
+		if err != nil {
+			log.Fatal(err)
+		}
+		return f
+	}
+	f, err := os.OpenFile(*output, os.O_WRONLY, 0)
+	if err != nil {
+		log.Fatal(err)
+	}
+	// Drop whatever was written after the checkpoint.
+	if err := f.Truncate(size); err != nil {
+		log.Fatal(err)
+	}
+	if _, err := f.Seek(size, io.SeekStart); err != nil {
+		log.Fatal(err)
+	}
+	return f
+}
+
+func readState(want State) State {
+	b, err := os.ReadFile(*checkpoint)
+	if err != nil {
+		log.Fatal(err)
+	}
+	var s State
+	if err := json.Unmarshal(b, &s); err != nil {
+		log.Fatalf("%s: %v", *checkpoint, err)
+	}
+	if err := checkState(s, want); err != nil {
+		log.Fatalf("%s: %v", *checkpoint, err)
+	}
+	return s
+}
+
+func checkState(got, want State) error {
+	if got.ChunkSize != want.ChunkSize || got.Format != want.Format ||
+		len(got.Inputs) != len(want.Inputs) {
+		return errors.New("the checkpoint is for a different run")
+	}
+	if got.DictID != want.DictID ||
+		!reflect.DeepEqual(got.Config, want.Config) {
+		return errors.New("the checkpoint is for different settings")
+	}
+	for i := range got.Inputs {
+		if got.Inputs[i] != want.Inputs[i] {
+			return errors.New("the checkpoint is for different inputs")
+		}
+	}
+	return nil
+}
+
+// saveState flushes and syncs the output and then atomically replaces
+// the checkpoint file, so that the checkpoint never refers to output
+// that has not reached the disk.
+func saveState(w *bufio.Writer, out *os.File, s State) {
+	if err := w.Flush(); err != nil {
+		log.Fatal(err)
+	}
+	if out != os.Stdout {
+		if err := out.Sync(); err != nil {
+			log.Fatal(err)
+		}
+	}
+	b, err := json.Marshal(s)
+	if err != nil {
+		log.Fatal(err)
+	}
+	tmp := *checkpoint + ".tmp"
+	if err := os.WriteFile(tmp, b, 0666); err != nil {
+		log.Fatal(err)
+	}
+	if err := os.Rename(tmp, *checkpoint); err != nil {
+		log.Fatal(err)
+	}
+}
@@ -0,0 +1,320 @@
+// Command morfeusz-daemon serves morphological analysis on a Unix
+// domain socket, for programs that cannot link libmorfeusz2 themselves.
+//
+// Usage:
+//
+//	morfeusz-daemon [flags]
+//
+// The protocol is described in the documentation of package
+// github.com/go-morfeusz/morfeusz/internal/wire. The payload of
+// a successful response is the analysis of the text serialized
+// in the format chosen with -format.
+//
+// The requests of all clients go into one queue served by -workers
+// clones of an instance of Morfeusz. A worker takes all the requests
+// waiting in the queue, up to -batch bytes, and analyses them in one
+// pass. When the queue is full, or a client has -inflight requests
+// waiting for responses, the daemon stops reading requests from
+// the client until the requests in progress are answered.
+//
+// The daemon creates its sockets only after warming up the instance
+// as chosen with -warmup, so a socket that accepts connections means
+// that the daemon is ready.
+//
+// With -shm-socket, the daemon also serves clients through shared
+// memory, as described in morfeusz-shm.h. A client connects to that
+// socket and receives the file descriptor of a segment in an
+// SCM_RIGHTS message; the segment is served by a clone of its own
+// until the client closes the connection. Responses carry packed
+// TokenInfo structs regardless of -format.
+//
+// With -cache, every request is looked up in an analysis cache, built
+// and compacted by morfeusz-cache, and the requests missing from it
+// are logged there. With -forms, requests are looked up first in
+// a form table built by morfeusz-cache. With -sentence-cache, the
+// requests repeated most often, like boilerplate sentences, are kept
+// in memory within the given number of bytes. Each of these makes
+// the daemon analyse requests one by one instead of in batches.
+package main
+
+import (
+	"bufio"
+	"errors"
+	"flag"
+	"log"
+	"net"
+	"os"
+	"os/signal"
+	"runtime"
+	"sync/atomic"
+	"syscall"
+	"time"
+
+	"github.com/go-morfeusz/morfeusz"
+	"github.com/go-morfeusz/morfeusz/internal/cli"
+	"github.com/go-morfeusz/morfeusz/internal/wire"
+)
+
+var (
+	socket   = flag.String("socket", "/tmp/morfeusz.sock", "socket path")
+	workers  = flag.Int("workers", runtime.NumCPU(), "number of workers")
+	queueLen = flag.Int("queue", 1024, "length of the request queue")
+	inflight = flag.Int(
+		"inflight", 128, "maximum number of requests in progress per client")
+	batch     = flag.Int("batch", 64<<10, "maximum size of a batch in bytes")
+	format    = cli.FormatFlag("format")
+	stats     = flag.Duration("stats", 0, "time between statistics (0: never)")
+	shmSocket = flag.String(
+		"shm-socket", "", "socket path for shared memory clients")
+	shmRing = flag.Int("shm-ring", 1<<20, "size of shared memory rings")
+	warmup  = flag.String("warmup", "basic", "none, basic or full")
+	cache   = flag.String("cache", "", "analysis cache file")
+	forms   = flag.String("forms", "", "form table file")
+	memory  = flag.Int64("sentence-cache", 0, "sentence cache size in bytes")
+	config  = cli.NewConfigFlags()
+)
+
+var warmupLevels = map[string]morfeusz.WarmupLevel{
+	"basic": morfeusz.WarmupBasic,
+	"full":  morfeusz.WarmupFull,
+}
+
+// A job is a request waiting for analysis.
+type job struct {
+	id   uint32
+	text string
+	out  chan<- wire.Response
+}
+
+var requests, batches int64 // atomic
+
+func main() {
+	log.SetFlags(0)
+	log.SetPrefix("morfeusz-daemon: ")
+	flag.Parse()
+	if *workers < 1 || *queueLen < 1 || *inflight < 1 || *batch < 1 {
+		flag.Usage()
+		os.Exit(2)
+	}
+	f, err := cli.ParseFormat(*format)
+	if err != nil {
+		log.Fatal(err)
+	}
+	m, err := config.New(morfeusz.AnalyseOnly)
+	if err != nil {
+		log.Fatal(err)
+	}
+	if *warmup != "none" {
+		level, ok := warmupLevels[*warmup]
+		if !ok {
+			log.Fatalf("unknown warm-up level %q", *warmup)
+		}
+		w, err := m.Warmup(level)
+		if err != nil {
+			log.Fatal(err)
+		}
+		log.Printf("warmed up in %v", w.Duration)
+	}
+	if *cache != "" {
+		c, err := morfeusz.OpenAnalysisCache(*cache)
+		if err != nil {
+			log.Fatal(err)
+		}
+		m.SetAnalysisCache(c)
+	}
+	if *memory > 0 {
+		m.SetSentenceCache(morfeusz.NewSentenceCache(*memory))
+	}
+	if *forms != "" {
+		t, err := morfeusz.OpenFormTable(*forms)
+		if err != nil {
+			log.Fatal(err)
+		}
+		if err := m.SetFormTable(t); err != nil {
+			log.Fatal(err)
+		}
+	}
+	l := listen(*socket)
+	var shm net.Listener
+	if *shmSocket != "" {
+		shm = listen(*shmSocket)
+		go acceptShm(shm, m)
+	}
+	signals := make(chan os.Signal, 1)
+	signal.Notify(signals, os.Interrupt, syscall.SIGTERM)
+	go func() {
+		<-signals
+		// Closing the listeners removes the sockets.
+		if shm != nil {
+			shm.Close()
+		}
+		l.Close()
+	}()
+
+	queue := make(chan job, *queueLen)
+	for i := 0; i < *workers; i++ {
+		go work(m.Clone(), f, queue)
+	}
+	if *stats > 0 {
+		go logStats(*stats)
+	}
+	for {
+		c, err := l.Accept()
+		if errors.Is(err, net.ErrClosed) {
+			return
+		}
+		if err != nil {
+			log.Fatal(err)
+		}
+		go serve(c, queue)
+	}
+}
+
+func listen(path string) net.Listener {
+	removeStaleSocket(path)
+	l, err := net.Listen("unix", path)
+	if err != nil {
+		log.Fatal(err)
+	}
+	return l
+}
+
+// removeStaleSocket removes the socket left behind by a daemon that
+// did not exit cleanly, but not that of a running one.
+func removeStaleSocket(path string) {
+	if _, err := os.Stat(path); err != nil {
+		return
+	}
+	if c, err := net.Dial("unix", path); err == nil {
+		c.Close()
+		log.Fatalf("%s: another daemon is listening", path)
+	}
+	os.Remove(path)
+}
+
+// serve reads the requests of a client into the queue and writes
+// back the responses.
+func serve(c net.Conn, queue chan<- job) {
+	defer c.Close()
+	out := make(chan wire.Response, *inflight)
+	// A token is taken for every request read and returned
+	// when its response is written.
+	tokens := make(chan struct{}, *inflight)
+	done := make(chan struct{})
+	go func() {
+		defer close(done)
+		w := bufio.NewWriter(c)
+		var err error
+		for resp := range out {
+			if err == nil {
+				err = wire.WriteResponse(w, &resp)
+			}
+			if err == nil && len(out) == 0 {
+				err = w.Flush()
+			}
+			<-tokens
+		}
+	}()
+	r := bufio.NewReader(c)
+	var req wire.Request
+	for {
+		if err := wire.ReadRequest(r, &req); err != nil {
+			break
+		}
+		tokens <- struct{}{}
+		queue <- job{req.ID, string(req.Text), out}
+	}
+	// Wait for the responses to the requests in progress.
+	for i := 0; i < *inflight; i++ {
+		tokens <- struct{}{}
+	}
+	close(out)
+	<-done
+}
+
+func acceptShm(l net.Listener, m *morfeusz.Morfeusz) {
+	for {
+		c, err := l.Accept()
+		if errors.Is(err, net.ErrClosed) {
+			return
+		}
+		if err != nil {
+			log.Fatal(err)
+		}
+		go serveShm(c.(*net.UnixConn), m.Clone())
+	}
+}
+
+// serveShm passes a new segment to a client and serves it with m
+// until the client disconnects.
+func serveShm(c *net.UnixConn, m *morfeusz.Morfeusz) {
+	defer c.Close()
+	s, err := morfeusz.NewShmSegment(*shmRing)
+	if err != nil {
+		log.Print(err)
+		return
+	}
+	if _, _, err := c.WriteMsgUnix(
+		[]byte{0}, syscall.UnixRights(s.FD()), nil); err != nil {
+		log.Print(err)
+		return
+	}
+	done := make(chan struct{})
+	go func() {
+		m.ServeShm(s)
+		close(done)
+	}()
+	// The client sends nothing; a read returns when it disconnects.
+	c.Read(make([]byte, 1))
+	s.Close()
+	<-done
+}
+
+// work analyses the requests from the queue with m, a batch at a time.
+func work(m *morfeusz.Morfeusz, f morfeusz.Format, queue <-chan job) {
+	var jobs []job
+	var texts []string
+	for j := range queue {
+		jobs = append(jobs[:0], j)
+		texts = append(texts[:0], j.text)
+		size := len(j.text)
+	collect:
+		for size < *batch {
+			select {
+			case j := <-queue:
+				jobs = append(jobs, j)
+				texts = append(texts, j.text)
+				size += len(j.text)
+			default:
+				break collect
+			}
+		}
+		atomic.AddInt64(&requests, int64(len(jobs)))
+		atomic.AddInt64(&batches, 1)
+		results, err := m.AnalyseStringsAs(texts, f)
+		for i, j := range jobs {
+			resp := wire.Response{ID: j.id}
+			if err != nil {
+				resp.Status = wire.StatusError
+				resp.Payload = []byte(err.Error())
+			} else {
+				resp.Payload = results[i]
+			}
+			j.out <- resp
+		}
+	}
+}
+
+func logStats(interval time.Duration) {
+	var lastRequests, lastBatches int64
+	for range time.Tick(interval) {
+		r := atomic.LoadInt64(&requests)
+		b := atomic.LoadInt64(&batches)
+		if b > lastBatches {
+			log.Printf("%.0f requests/s, %.1f requests per batch",
+				float64(r-lastRequests)/interval.Seconds(),
+				float64(r-lastRequests)/float64(b-lastBatches))
+		}
+		lastRequests, lastBatches = r, b
+	}
+}
@@ -0,0 +1,232 @@
+// Command morfeusz-loadgen measures the throughput and latency
+// of morfeusz-daemon.
+//
+// Usage:
+//
+//	morfeusz-loadgen [flags] [file]
+//
+// Every line of the file (by default, a few built-in sentences)
+// becomes a request. The lines are sent in turn by -conns clients,
+// each keeping up to -pipeline requests in progress, for -duration.
+// With -shm, the clients connect to the -shm-socket of the daemon
+// and talk to it through shared memory.
+package main
+
+import (
+	"bufio"
+	"bytes"
+	"flag"
+	"fmt"
+	"log"
+	"net"
+	"os"
+	"sort"
+	"sync"
+	"syscall"
+	"time"
+	"unsafe"
+
+	"github.com/go-morfeusz/morfeusz"
+	"github.com/go-morfeusz/morfeusz/internal/wire"
+)
+
+var (
+	socket   = flag.String("socket", "/tmp/morfeusz.sock", "socket path")
+	conns    = flag.Int("conns", 8, "number of connections")
+	pipeline = flag.Int("pipeline", 16, "requests in progress per connection")
+	duration = flag.Duration("duration", 10*time.Second, "test duration")
+	shm      = flag.Bool("shm", false, "use shared memory")
+)
+
+var sample = []string{
+	"Ala ma kota.",
+	"W Szczebrzeszynie chrząszcz brzmi w trzcinie.",
+	"Litwo! Ojczyzno moja! ty jesteś jak zdrowie.",
+	"Dzień dobry.",
+}
+
+// client holds the statistics of a connection.
+type client struct {
+	latencies []time.Duration
+	errors    int
+	bytes     int64
+}
+
+func main() {
+	log.SetFlags(0)
+	log.SetPrefix("morfeusz-loadgen: ")
+	flag.Parse()
+	if *conns < 1 || *pipeline < 1 || flag.NArg() > 1 {
+		flag.Usage()
+		os.Exit(2)
+	}
+	lines := sample
+	if flag.NArg() == 1 {
+		lines = readLines(flag.Arg(0))
+	}
+	clients := make([]client, *conns)
+	deadline := time.Now().Add(*duration)
+	var wg sync.WaitGroup
+	for i := range clients {
+		c, err := net.Dial("unix", *socket)
+		if err != nil {
+			log.Fatal(err)
+		}
+		wg.Add(1)
+		go func(cl *client, offset int) {
+			defer wg.Done()
+			if *shm {
+				cl.runShm(c.(*net.UnixConn), lines, offset, deadline)
+			} else {
+				cl.run(c, lines, offset, deadline)
+			}
+		}(&clients[i], i)
+	}
+	wg.Wait()
+
+	var all []time.Duration
+	var errors int
+	var bytes int64
+	for _, cl := range clients {
+		all = append(all, cl.latencies...)
+		errors += cl.errors
+		bytes += cl.bytes
+	}
+	if len(all) == 0 {
+		log.Fatal("no responses")
+	}
+	sort.Slice(all, func(i, j int) bool { return all[i] < all[j] })
+	percentile := func(p float64) time.Duration {
+		return all[int(p*float64(len(all)-1))]
+	}
+	secs := duration.Seconds()
+	fmt.Printf("%d requests, %d errors: %.0f requests/s, %.1f MB/s\n",
+		len(all), errors, float64(len(all))/secs, float64(bytes)/1e6/secs)
+	fmt.Printf("latency p50 %v, p90 %v, p99 %v, p99.9 %v, max %v\n",
+		percentile(0.5), percentile(0.9), percentile(0.99),
+		percentile(0.999), all[len(all)-1])
+}
+
+// run sends requests on c until the deadline, with up to -pipeline
+// requests in progress, and records their latencies.
+func (cl *client) run(c net.Conn, lines []string, next int, deadline time.Time) {
+	defer c.Close()
+	var mu sync.Mutex
+	sent := map[uint32]time.Time{}
+	tokens := make(chan struct{}, *pipeline)
+	done := make(chan struct{})
+	go func() {
+		defer close(done)
+		r := bufio.NewReader(c)
+		var resp wire.Response
+		for {
+			if err := wire.ReadResponse(r, &resp); err != nil {
+				return
+			}
+			mu.Lock()
+			cl.latencies = append(cl.latencies, time.Since(sent[resp.ID]))
+			delete(sent, resp.ID)
+			mu.Unlock()
+			if resp.Status != wire.StatusOK {
+				cl.errors++
+			}
+			cl.bytes += int64(len(resp.Payload))
+			<-tokens
+		}
+	}()
+	w := bufio.NewWriter(c)
+	for id := uint32(0); time.Now().Before(deadline); id++ {
+		select {
+		case tokens <- struct{}{}:
+		default:
+			// Send the buffered requests before waiting for responses.
+			if err := w.Flush(); err != nil {
+				log.Fatal(err)
+			}
+			tokens <- struct{}{}
+		}
+		mu.Lock()
+		sent[id] = time.Now()
+		mu.Unlock()
+		req := wire.Request{ID: id, Text: []byte(lines[next%len(lines)])}
+		next++
+		if err := wire.WriteRequest(w, &req); err != nil {
+			log.Fatal(err)
+		}
+	}
+	if err := w.Flush(); err != nil {
+		log.Fatal(err)
+	}
+	// Wait for the remaining responses.
+	for i := 0; i < *pipeline; i++ {
+		tokens <- struct{}{}
+	}
+	c.(*net.UnixConn).CloseWrite()
+	<-done
+}
+
+// runShm is like run, but it talks to the daemon through the shared
+// memory segment whose file descriptor it receives on c.
+func (cl *client) runShm(
+	c *net.UnixConn, lines []string, next int, deadline time.Time) {
+	defer c.Close()
+	oob := make([]byte, syscall.CmsgSpace(4))
+	_, oobn, _, _, err := c.ReadMsgUnix(make([]byte, 1), oob)
+	if err != nil {
+		log.Fatal(err)
+	}
+	msgs, err := syscall.ParseSocketControlMessage(oob[:oobn])
+	if err != nil || len(msgs) != 1 {
+		log.Fatal("no segment received")
+	}
+	fds, err := syscall.ParseUnixRights(&msgs[0])
+	if err != nil {
+		log.Fatal(err)
+	}
+	s, err := morfeusz.AttachShmSegment(fds[0])
+	if err != nil {
+		log.Fatal(err)
+	}
+	// Responses come in the order of requests.
+	sent := make(chan time.Time, *pipeline)
+	done := make(chan struct{})
+	go func() {
+		defer close(done)
+		for start := range sent {
+			_, r, err := s.Receive()
+			cl.latencies = append(cl.latencies, time.Since(start))
+			if err != nil {
+				cl.errors++
+				continue
+			}
+			cl.bytes += int64(len(r.Strings) +
+				len(r.Tokens)*int(unsafe.Sizeof(r.Tokens[0])))
+		}
+	}()
+	for id := uint32(0); time.Now().Before(deadline); id++ {
+		sent <- time.Now()
+		if err := s.Send(id, lines[next%len(lines)]); err != nil {
+			log.Fatal(err)
+		}
+		next++
+	}
+	close(sent)
+	<-done
+}
+
+func readLines(name string) []string {
+	b, err := os.ReadFile(name)
+	if err != nil {
+		log.Fatal(err)
+	}
+	var ret []string
+	for _, line := range bytes.Split(b, []byte{'\n'}) {
+		if len(line) > 0 {
+			ret = append(ret, string(line))
+		}
+	}
+	if len(ret) == 0 {
+		log.Fatalf("%s: no lines", name)
+	}
+	return ret
+}
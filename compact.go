@@ -0,0 +1,165 @@
+package morfeusz
+
+import (
+	"encoding/binary"
+	"errors"
+)
+
+const compactFormatVersion = 1
+
+var (
+	errCompactVersion   = errors.New("Unsupported compact format version")
+	errMalformedCompact = errors.New("Malformed compact data")
+)
+
+// CompactReader iterates over the interpretations serialized
+// by AnalyseStringAs in the Compact format. The byte slices that
+// it returns point into the data, and once the table of orths and
+// lemmas has grown to fit the data, iterating allocates no memory.
+type CompactReader struct {
+	data     []byte
+	dictID   []byte
+	strings  [][]byte
+	start    int
+	end      int
+	tagID    int
+	nameID   int
+	labelsID int
+	orth     []byte
+	lemma    []byte
+	err      error
+}
+
+// NewCompactReader returns a reader of data.
+func NewCompactReader(data []byte) *CompactReader {
+	r := &CompactReader{}
+	r.Reset(data)
+	return r
+}
+
+// Reset makes the reader start over with data, reusing its memory.
+func (r *CompactReader) Reset(data []byte) {
+	*r = CompactReader{data: data, strings: r.strings[:0]}
+	version := r.varint()
+	if r.err == nil && version != compactFormatVersion {
+		r.err = errCompactVersion
+	}
+	r.dictID = r.bytes()
+}
+
+// Next advances to the next interpretation and returns true,
+// or returns false when there are no more of them or the data
+// is malformed.
+func (r *CompactReader) Next() bool {
+	if r.err != nil || len(r.data) == 0 {
+		return false
+	}
+	delta := r.varint()
+	r.start += int(int32(delta>>1) ^ -int32(delta&1))
+	r.end = r.start + int(r.varint())
+	r.tagID = int(r.varint())
+	r.nameID = int(r.varint())
+	r.labelsID = int(r.varint())
+	r.orth = r.stringReference()
+	r.lemma = r.stringReference()
+	return r.err == nil
+}
+
+// Err returns the error that stopped the iteration, if any.
+func (r *CompactReader) Err() error {
+	return r.err
+}
+
+// DictID returns the ID of the dictionary that produced the data.
+func (r *CompactReader) DictID() []byte {
+	return r.dictID
+}
+
+// StartNode returns the index of the node where a token starts.
+func (r *CompactReader) StartNode() int {
+	return r.start
+}
+
+// EndNode returns the index of the node where a token ends.
+func (r *CompactReader) EndNode() int {
+	return r.end
+}
+
+// TagID returns the ID of the tag of a token.
+func (r *CompactReader) TagID() int {
+	return r.tagID
+}
+
+// NameID returns the ID of the named entity of a token.
+func (r *CompactReader) NameID() int {
+	return r.nameID
+}
+
+// LabelsID returns the ID of the labels of a token.
+func (r *CompactReader) LabelsID() int {
+	return r.labelsID
+}
+
+// Orth returns the spelling of a token.
+func (r *CompactReader) Orth() []byte {
+	return r.orth
+}
+
+// Lemma returns the lemma of a token.
+func (r *CompactReader) Lemma() []byte {
+	return r.lemma
+}
+
+// IsIgn returns true only when a token is an unknown word.
+func (r *CompactReader) IsIgn() bool {
+	return r.tagID == 0
+}
+
+// IsWhitespace returns true when a token represents whitespace.
+func (r *CompactReader) IsWhitespace() bool {
+	return r.tagID == 1
+}
+
+func (r *CompactReader) varint() uint32 {
+	if r.err != nil {
+		return 0
+	}
+	u, n := binary.Uvarint(r.data)
+	if n <= 0 || u > 1<<32-1 {
+		r.err = errMalformedCompact
+		return 0
+	}
+	r.data = r.data[n:]
+	return uint32(u)
+}
+
+func (r *CompactReader) bytes() []byte {
+	n := r.varint()
+	if r.err != nil {
+		return nil
+	}
+	if uint64(n) > uint64(len(r.data)) {
+		r.err = errMalformedCompact
+		return nil
+	}
+	ret := r.data[:n:n]
+	r.data = r.data[n:]
+	return ret
+}
+
+func (r *CompactReader) stringReference() []byte {
+	k := r.varint()
+	if r.err != nil {
+		return nil
+	}
+	if k == 0 {
+		s := r.bytes()
+		r.strings = append(r.strings, s)
+		return s
+	}
+	if uint64(k) > uint64(len(r.strings)) {
+		r.err = errMalformedCompact
+		return nil
+	}
+	return r.strings[k-1]
+}
@@ -0,0 +1,112 @@
+// Package cli holds the code shared by the commands
+// of the morfeusz package.
+package cli
+
+import (
+	"flag"
+	"fmt"
+
+	"github.com/go-morfeusz/morfeusz"
+)
+
+var (
+	formats = map[string]morfeusz.Format{
+		"tsv":     morfeusz.TSV,
+		"jsonl":   morfeusz.JSONLines,
+		"binary":  morfeusz.Binary,
+		"compact": morfeusz.Compact,
+	}
+	charsets = map[string]morfeusz.Charset{
+		"utf8":      morfeusz.UTF8,
+		"iso8859-2": morfeusz.ISO8859_2,
+		"cp1250":    morfeusz.CP1250,
+		"cp852":     morfeusz.CP852,
+	}
+	caseHandlings = map[string]morfeusz.CaseHandling{
+		"conditional": morfeusz.ConditionallyCaseSensitive,
+		"strict":      morfeusz.StrictlyCaseSensitive,
+		"ignore":      morfeusz.IgnoreCase,
+	}
+	whitespaceHandlings = map[string]morfeusz.WhitespaceHandling{
+		"skip":   morfeusz.SkipWhitespaces,
+		"append": morfeusz.AppendWhitespaces,
+		"keep":   morfeusz.KeepWhitespaces,
+	}
+)
+
+// FormatFlag defines a flag selecting a serialization format.
+func FormatFlag(name string) *string {
+	return flag.String(name, "tsv", "tsv, jsonl, binary or compact")
+}
+
+// ParseFormat returns the format named s.
+func ParseFormat(s string) (morfeusz.Format, error) {
+	f, ok := formats[s]
+	if !ok {
+		return 0, fmt.Errorf("unknown format %q", s)
+	}
+	return f, nil
+}
+
+// ConfigFlags is the type of a struct holding the values of flags
+// that set the fields of morfeusz.Config.
+type ConfigFlags struct {
+	dictName   *string
+	aggl       *string
+	praet      *string
+	charset    *string
+	caseFlag   *string
+	whitespace *string
+}
+
+// NewConfigFlags defines the flags that set the fields
+// of morfeusz.Config.
+func NewConfigFlags() *ConfigFlags {
+	return &ConfigFlags{
+		dictName: flag.String("dict", "", "dictionary name"),
+		aggl:     flag.String("aggl", "", "agglutination rules"),
+		praet:    flag.String("praet", "", "past tense segmentation"),
+		charset: flag.String(
+			"charset", "utf8", "utf8, iso8859-2, cp1250 or cp852"),
+		caseFlag: flag.String(
+			"case", "conditional", "conditional, strict or ignore"),
+		whitespace: flag.String("whitespace", "skip", "skip, append or keep"),
+	}
+}
+
+// Values returns the values of the flags by name.
+func (c *ConfigFlags) Values() map[string]string {
+	return map[string]string{
+		"dict":       *c.dictName,
+		"aggl":       *c.aggl,
+		"praet":      *c.praet,
+		"charset":    *c.charset,
+		"case":       *c.caseFlag,
+		"whitespace": *c.whitespace,
+	}
+}
+
+// New returns an instance of Morfeusz configured by the flags.
+func (c *ConfigFlags) New(usage morfeusz.Usage) (*morfeusz.Morfeusz, error) {
+	cs, ok := charsets[*c.charset]
+	if !ok {
+		return nil, fmt.Errorf("unknown charset %q", *c.charset)
+	}
+	ch, ok := caseHandlings[*c.caseFlag]
+	if !ok {
+		return nil, fmt.Errorf("unknown case handling %q", *c.caseFlag)
+	}
+	wh, ok := whitespaceHandlings[*c.whitespace]
+	if !ok {
+		return nil, fmt.Errorf("unknown whitespace handling %q", *c.whitespace)
+	}
+	return morfeusz.New(&morfeusz.Config{
+		DictName:           *c.dictName,
+		Aggl:               *c.aggl,
+		Praet:              *c.praet,
+		Charset:            cs,
+		CaseHandling:       ch,
+		WhitespaceHandling: wh,
+		Usage:              usage,
+	})
+}
@@ -0,0 +1,103 @@
+// Package wire implements the framing of the protocol spoken
+// by morfeusz-daemon.
+//
+// A client sends requests, each made of a request ID, the length
+// of a text and the text. The daemon answers every request with
+// a response made of the request ID, a status, the length of
+// a payload and the payload: the serialized analysis of the text
+// or an error message. Integers are 32-bit little-endian. Requests
+// may be pipelined, and responses may come in any order.
+package wire
+
+import (
+	"bufio"
+	"encoding/binary"
+	"errors"
+	"io"
+)
+
+// Statuses of responses.
+const (
+	StatusOK    = 0
+	StatusError = 1
+)
+
+// MaxLength is the largest length of a text or a payload.
+const MaxLength = 64 << 20
+
+var errTooLong = errors.New("wire: frame too long")
+
+// Request is the type of a struct holding a request.
+type Request struct {
+	ID   uint32
+	Text []byte
+}
+
+// Response is the type of a struct holding a response.
+type Response struct {
+	ID      uint32
+	Status  uint32
+	Payload []byte
+}
+
+// ReadRequest reads a request from r into req, reusing req.Text.
+func ReadRequest(r *bufio.Reader, req *Request) error {
+	var header [8]byte
+	if _, err := io.ReadFull(r, header[:]); err != nil {
+		return err
+	}
+	req.ID = binary.LittleEndian.Uint32(header[:])
+	var err error
+	req.Text, err = readPayload(r, header[4:], req.Text)
+	return err
+}
+
+// WriteRequest writes a request to w.
+func WriteRequest(w *bufio.Writer, req *Request) error {
+	var header [8]byte
+	binary.LittleEndian.PutUint32(header[:], req.ID)
+	binary.LittleEndian.PutUint32(header[4:], uint32(len(req.Text)))
+	w.Write(header[:])
+	_, err := w.Write(req.Text)
+	return err
+}
+
+// ReadResponse reads a response from r into resp, reusing resp.Payload.
+func ReadResponse(r *bufio.Reader, resp *Response) error {
+	var header [12]byte
+	if _, err := io.ReadFull(r, header[:]); err != nil {
+		return err
+	}
+	resp.ID = binary.LittleEndian.Uint32(header[:])
+	resp.Status = binary.LittleEndian.Uint32(header[4:])
+	var err error
+	resp.Payload, err = readPayload(r, header[8:], resp.Payload)
+	return err
+}
+
+// WriteResponse writes a response to w.
+func WriteResponse(w *bufio.Writer, resp *Response) error {
+	var header [12]byte
+	binary.LittleEndian.PutUint32(header[:], resp.ID)
+	binary.LittleEndian.PutUint32(header[4:], resp.Status)
+	binary.LittleEndian.PutUint32(header[8:], uint32(len(resp.Payload)))
+	w.Write(header[:])
+	_, err := w.Write(resp.Payload)
+	return err
+}
+
+func readPayload(r *bufio.Reader, length []byte, buf []byte) ([]byte, error) {
+	n := binary.LittleEndian.Uint32(length)
+	if n > MaxLength {
+		return buf, errTooLong
+	}
+	if uint32(cap(buf)) < n {
+		buf = make([]byte, n)
+	}
+	buf = buf[:n]
+	_, err := io.ReadFull(r, buf)
+	if err == io.EOF {
+		err = io.ErrUnexpectedEOF
+	}
+	return buf, err
+}
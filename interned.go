@@ -0,0 +1,49 @@
+package morfeusz
+
+// InternedTokenInfo is the type of a struct holding the morphological
+// interpretation of a token, laid out like struct InternedTokenInfo
+// of the C API. Its orth and lemma are given by their IDs in the
+// process-wide table of interned strings, which stay the same for
+// as long as the process lives. Equal strings have equal IDs, so
+// lemmas can be grouped and counted without looking at them.
+type InternedTokenInfo struct {
+	OrthID    uint32
+	LemmaID   uint32
+	StartNode int32
+	EndNode   int32
+	TagID     int32
+	NameID    int32
+	LabelsID  int32
+}
+
+// IsIgn returns true only when a token is an unknown word.
+func (t *InternedTokenInfo) IsIgn() bool {
+	return t.TagID == 0
+}
+
+// IsWhitespace returns true when a token represents whitespace.
+func (t *InternedTokenInfo) IsWhitespace() bool {
+	return t.TagID == 1
+}
+
+// InterpretationTokenInfo is the type of a struct holding the orth
+// of a token, as the ID of an interned string, and the ID of its
+// interpretation, laid out like struct InterpretationTokenInfo of
+// the C API. Interpretations with the same lemma, tag, name and labels
+// share the ID. InterpretationID is -1 when the table of
+// interpretations is full.
+type InterpretationTokenInfo struct {
+	OrthID           uint32
+	InterpretationID int32
+	StartNode        int32
+	EndNode          int32
+}
+
+// Interpretation is the type of a struct holding the components
+// of an interpretation ID.
+type Interpretation struct {
+	LemmaID  uint32
+	TagID    int
+	NameID   int
+	LabelsID int
+}
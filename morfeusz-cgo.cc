@@ -1,11 +1,43 @@
 #include "morfeusz-cgo.h"
 #include "morfeusz2.h"
+#ifdef __linux__
+#include "morfeusz-shm.h"
+#endif  // __linux__
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <malloc.h>
+#endif  // __linux__
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <exception>
+#include <iterator>
 #include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 using morfeusz::Morfeusz;
@@ -35,125 +67,3942 @@ const morfeusz::WhitespaceHandling translateWhitespaceHandling[] = {
     morfeusz::WhitespaceHandling::APPEND_WHITESPACES,
     morfeusz::WhitespaceHandling::KEEP_WHITESPACES,
 };
+// The usage of the instance of Morfeusz behind an Instance. With
+// ANALYSE_AND_LAZY_GENERATE and ANALYSE_AND_GENERATE_IN_PARALLEL,
+// generation is handled by a separate instance loaded by
+// a GeneratorSource.
 const morfeusz::MorfeuszUsage translateUsage[] = {
     morfeusz::MorfeuszUsage::BOTH_ANALYSE_AND_GENERATE,
     morfeusz::MorfeuszUsage::ANALYSE_ONLY,
     morfeusz::MorfeuszUsage::GENERATE_ONLY,
+    morfeusz::MorfeuszUsage::ANALYSE_ONLY,
+    morfeusz::MorfeuszUsage::ANALYSE_ONLY,
+};
+
+const char* const configFieldErrors[] = {
+    "",
+    "Failed to load dictionary",
+    "Invalid aggl option",
+    "Invalid praet option",
+    "Invalid charset",
+    "Invalid token numbering",
+    "Invalid case handling",
+    "Invalid whitespace handling",
+    "Invalid usage option",
+};
+
+const int invalidId = -1;
+const struct String emptyString = {};
+const Error noError = emptyString;
+const struct StringArray emptyStringArray = {};
+const struct TokenInfo emptyTokenInfo = {};
+
+template<typename R, typename T, int N>
+R reverseTranslate(const T (&array)[N], T value) {
+  for (int i = 0; i < N; ++i) {
+    if (array[i] == value) {
+      return static_cast<R>(i);
+    }
+  }
+  return static_cast<R>(invalidId);
+}
+
+// Memory accounting for memoryStats. The heap growth of instances
+// and, when resultAccounting is set, of results is measured with
+// heapInUse() around the calls that create them.
+std::atomic<int64_t> liveInstances(0);
+std::atomic<int64_t> liveInstanceBytes(0);
+std::atomic<int64_t> liveTokenInfos(0);
+std::atomic<int64_t> liveTokenInfoBytes(0);
+std::atomic<int64_t> liveStringArrayBytes(0);
+std::atomic<bool> resultAccounting(false);
+std::atomic<int64_t> liveResults(0);
+std::atomic<int64_t> liveResultBytes(0);
+// The heap growth measured for every live result.
+std::mutex resultBytesMutex;
+std::unordered_map<Res, int64_t> resultBytes;
+
+// Returns the number of bytes allocated on the heap, including
+// mmapped chunks, or 0 when the C library does not tell.
+int64_t heapInUse() {
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  const struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+int64_t heapGrowth(int64_t before) {
+  return std::max<int64_t>(heapInUse() - before, 0);
+}
+
+// Returns heapInUse() before a result is created, or -1 when results
+// are not measured.
+int64_t startResultMeasurement() {
+  return resultAccounting.load(std::memory_order_relaxed) ? heapInUse() : -1;
+}
+
+// Records the heap growth since start, as returned by
+// startResultMeasurement, as the memory used by r.
+Res measureResult(Res r, int64_t start) {
+  if (r != NULL && start >= 0) {
+    const int64_t n = heapGrowth(start);
+    std::lock_guard<std::mutex> lock(resultBytesMutex);
+    resultBytes[r] = n;
+    ++liveResults;
+    liveResultBytes += n;
+  }
+  return r;
+}
+
+void forgetResult(Res r) {
+  if (liveResults.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(resultBytesMutex);
+  std::unordered_map<Res, int64_t>::iterator it = resultBytes.find(r);
+  if (it != resultBytes.end()) {
+    --liveResults;
+    liveResultBytes -= it->second;
+    resultBytes.erase(it);
+  }
+}
+
+void* defaultAllocate(size_t size, void*) {
+  return ::operator new(size);
+}
+
+void defaultDeallocate(void* p, void*) {
+  ::operator delete(p);
+}
+
+// The functions that allocate the memory handed over to the caller.
+struct Allocator allocator = { defaultAllocate, defaultDeallocate, NULL };
+
+// Returns an array of n Ts, which must be trivial types, allocated
+// with allocator and to be freed with deallocate.
+template<typename T>
+T* allocate(size_t n) {
+  void* p = allocator.allocate(n * sizeof(T), allocator.context);
+  if (p == NULL && n != 0) {
+    throw std::bad_alloc();
+  }
+  return static_cast<T*>(p);
+}
+
+void deallocate(const void* p) {
+  if (p != NULL) {
+    allocator.deallocate(const_cast<void*>(p), allocator.context);
+  }
+}
+
+const struct String makeString(const char* p, int n) {
+  char* cp = allocate<char>(n);
+  memcpy(cp, p, n);
+  return { cp, n };
+}
+
+const struct String makeString(const std::string& s) {
+  return makeString(s.data(), s.size());
+}
+
+const Error makeError(const std::exception& e) {
+  return makeString(e.what(), strlen(e.what()));
+}
+
+const std::string stdString(const struct String s) {
+  // s.p points to the character array underlying a Go string
+  // so it will be freed by the Go garbage collector.
+  return std::string(s.p, s.n);
+}
+
+// Stores s in t->inlined at *used if it fits there, or on the heap.
+const struct String makeTokenInfoString(
+    const std::string& s, struct TokenInfo* t, size_t* used) {
+  if (s.size() > sizeof t->inlined - *used) {
+    liveTokenInfoBytes += s.size();
+    return makeString(s);
+  }
+  memcpy(t->inlined + *used, s.data(), s.size());
+  *used += s.size();
+  const struct String ret = { NULL, static_cast<int>(s.size()) };
+  return ret;
+}
+
+const struct TokenInfo makeTokenInfo(const MorphInterpretation& m) {
+  struct TokenInfo ret;
+  size_t used = 0;
+  ret.orth = makeTokenInfoString(m.orth, &ret, &used);
+  ret.lemma = makeTokenInfoString(m.lemma, &ret, &used);
+  if (ret.orth.p != NULL || ret.lemma.p != NULL) {
+    ++liveTokenInfos;
+  }
+  ret.startNode = m.startNode;
+  ret.endNode = m.endNode;
+  ret.tagID = m.tagId;
+  ret.nameID = m.nameId;
+  ret.labelsID = m.labelsId;
+  return ret;
+}
+
+template<typename T>
+const struct StringArray makeStringArray(const T& lst) {
+  const int n = lst.size();
+  struct String* sp = allocate<struct String>(n);
+  const struct StringArray ret = { sp, n };
+  int64_t bytes = n * sizeof(struct String);
+  for (typename T::const_iterator it = lst.begin(); it != lst.end(); ++it) {
+    *sp++ = makeString(*it);
+    bytes += it->size();
+  }
+  liveStringArrayBytes += bytes;
+  return ret;
+}
+
+const struct TokenInfoArray makeTokenInfoArray(
+    const std::vector<MorphInterpretation>& vec) {
+  const int n = vec.size();
+  struct TokenInfo* tp = allocate<struct TokenInfo>(n);
+  const struct TokenInfoArray ret = { tp, n, noError };
+  liveTokenInfoBytes += n * sizeof(struct TokenInfo);
+  for (std::vector<MorphInterpretation>::const_iterator it = vec.begin();
+       it != vec.end(); ++it) {
+    *tp++ = makeTokenInfo(*it);
+  }
+  return ret;
+}
+
+const struct TokenInfoArray makeTokenInfoArray(const std::exception& e) {
+  return { NULL, 0, makeError(e) };
+}
+
+// Packs the distinct lemmas of every segment of vec into a struct
+// Lemmas. The segments keep the order of their first appearance.
+const struct Lemmas makeLemmas(const std::vector<MorphInterpretation>& vec) {
+  std::map<std::pair<int, int>, size_t> segmentIndex;
+  std::vector<std::vector<const std::string*> > segmentLemmas;
+  std::vector<struct SegmentLemmas> segments;
+  size_t lemmasLength = 0;
+  size_t heapLength = 0;
+  for (std::vector<MorphInterpretation>::const_iterator it = vec.begin();
+       it != vec.end(); ++it) {
+    const std::pair<int, int> key(it->startNode, it->endNode);
+    std::map<std::pair<int, int>, size_t>::const_iterator found =
+        segmentIndex.find(key);
+    size_t i;
+    if (found == segmentIndex.end()) {
+      i = segments.size();
+      segmentIndex[key] = i;
+      const struct SegmentLemmas segment = {
+          it->startNode, it->endNode, 0, 0 };
+      segments.push_back(segment);
+      segmentLemmas.push_back(std::vector<const std::string*>());
+    } else {
+      i = found->second;
+    }
+    // Segments have a handful of lemmas, so a linear search will do.
+    std::vector<const std::string*>& lemmas = segmentLemmas[i];
+    bool seen = false;
+    for (std::vector<const std::string*>::const_iterator l = lemmas.begin();
+         l != lemmas.end() && !seen; ++l) {
+      seen = **l == it->lemma;
+    }
+    if (!seen) {
+      lemmas.push_back(&it->lemma);
+      ++lemmasLength;
+      heapLength += it->lemma.size();
+    }
+  }
+
+  char* heap = allocate<char>(heapLength);
+  int* offsets = allocate<int>(lemmasLength + 1);
+  struct SegmentLemmas* sp = allocate<struct SegmentLemmas>(segments.size());
+  const struct Lemmas ret = {
+      heap, offsets, static_cast<int>(lemmasLength),
+      sp, static_cast<int>(segments.size()), noError };
+  int lemma = 0;
+  int offset = 0;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    const std::vector<const std::string*>& lemmas = segmentLemmas[i];
+    sp[i] = segments[i];
+    sp[i].firstLemma = lemma;
+    sp[i].lemmasLength = lemmas.size();
+    for (std::vector<const std::string*>::const_iterator l = lemmas.begin();
+         l != lemmas.end(); ++l) {
+      offsets[lemma++] = offset;
+      memcpy(heap + offset, (*l)->data(), (*l)->size());
+      offset += (*l)->size();
+    }
+  }
+  offsets[lemma] = offset;
+  return ret;
+}
+
+template<typename T, int N>
+bool inRange(const T (&)[N], int value) {
+  return 0 <= value && value < N;
+}
+
+const struct NewInstance makeNewInstance(Morf m) {
+  return { m, CONFIG_OK, noError };
+}
+
+const struct NewInstance makeNewInstance(
+    enum ConfigField field, const std::string& message) {
+  return { NULL, field, makeString(message) };
+}
+
+// Returns the first enum field of c that is out of range, or CONFIG_OK.
+// Morfeusz does not check the values passed to its setters, so they
+// must be validated before any of them are translated.
+enum ConfigField invalidEnumField(const struct Config& c) {
+  if (!inRange(translateUsage, c.usage)) {
+    return CONFIG_USAGE;
+  }
+  if (!inRange(translateCharset, c.charset)) {
+    return CONFIG_CHARSET;
+  }
+  if (!inRange(translateTokenNumbering, c.tokenNumbering)) {
+    return CONFIG_TOKEN_NUMBERING;
+  }
+  if (!inRange(translateCaseHandling, c.caseHandling)) {
+    return CONFIG_CASE_HANDLING;
+  }
+  if (!inRange(translateWhitespaceHandling, c.whitespaceHandling)) {
+    return CONFIG_WHITESPACE_HANDLING;
+  }
+  return CONFIG_OK;
+}
+
+// Applies the options from c to m. Returns the field rejected
+// by Morfeusz, with the reason stored in *message, or CONFIG_OK.
+enum ConfigField configure(
+    Morfeusz* m, const struct Config& c, std::string* message) {
+  enum ConfigField field = CONFIG_AGGL;
+  try {
+    if (c.aggl.n != 0) {
+      m->setAggl(stdString(c.aggl));
+    }
+    field = CONFIG_PRAET;
+    if (c.praet.n != 0) {
+      m->setPraet(stdString(c.praet));
+    }
+    field = CONFIG_CHARSET;
+    m->setCharset(translateCharset[c.charset]);
+    field = CONFIG_CASE_HANDLING;
+    m->setCaseHandling(translateCaseHandling[c.caseHandling]);
+    field = CONFIG_TOKEN_NUMBERING;
+    m->setTokenNumbering(translateTokenNumbering[c.tokenNumbering]);
+    field = CONFIG_WHITESPACE_HANDLING;
+    m->setWhitespaceHandling(
+        translateWhitespaceHandling[c.whitespaceHandling]);
+    return CONFIG_OK;
+  } catch (const std::exception& e) {
+    *message = e.what();
+    return field;
+  }
+}
+
+// Loads the dictionary named dictName, or the default one if empty.
+Morfeusz* createMorfeusz(
+    const std::string& dictName, morfeusz::MorfeuszUsage usage) {
+  return dictName.empty()
+      ? Morfeusz::createInstance(usage)
+      : Morfeusz::createInstance(dictName, usage);
+}
+
+// GeneratorSource loads a GENERATE_ONLY instance of Morfeusz
+// for a dictionary when it is first needed, and only once for
+// an instance and its clones. Independent instances get their own
+// sources, as the generators cloned from one share some settings.
+class GeneratorSource {
+ public:
+  explicit GeneratorSource(const std::string& dictName)
+      : dictName(dictName), prototype(NULL) {}
+
+  ~GeneratorSource() {
+    delete prototype;
+  }
+
+  // Returns a new clone of the loaded instance. Throws std::exception
+  // when the dictionary cannot be loaded.
+  Morfeusz* clone() {
+    std::lock_guard<std::mutex> lock(mutex);
+    loadLocked();
+    return prototype->clone();
+  }
+
+  // Loads the instance unless it has already been loaded.
+  void load() {
+    std::lock_guard<std::mutex> lock(mutex);
+    loadLocked();
+  }
+
+ private:
+  void loadLocked() {
+    if (prototype == NULL) {
+      prototype = createMorfeusz(
+          dictName, morfeusz::MorfeuszUsage::GENERATE_ONLY);
+    }
+  }
+
+  const std::string dictName;
+  std::mutex mutex;
+  Morfeusz* prototype;
+};
+
+// Returns the generator source of a new instance of the dictionary
+// named dictName with usage, or NULL if the instance needs none.
+std::shared_ptr<GeneratorSource> newGeneratorSource(
+    const std::string& dictName, enum Usage usage) {
+  if (usage != ANALYSE_AND_LAZY_GENERATE &&
+      usage != ANALYSE_AND_GENERATE_IN_PARALLEL) {
+    return std::shared_ptr<GeneratorSource>();
+  }
+  return std::make_shared<GeneratorSource>(dictName);
+}
+
+// A ResultsIterator over interpretations computed in advance.
+class VectorResultsIterator : public ResultsIterator {
+ public:
+  VectorResultsIterator() : pos(0) {}
+
+  bool hasNext() {
+    return pos < interpretations.size();
+  }
+
+  const MorphInterpretation& peek() {
+    if (!hasNext()) {
+      throw std::out_of_range("No more interpretations");
+    }
+    return interpretations[pos];
+  }
+
+  MorphInterpretation next() {
+    const MorphInterpretation& ret = peek();
+    ++pos;
+    return ret;
+  }
+
+  std::vector<MorphInterpretation> interpretations;
+
+ private:
+  size_t pos;
+};
+
+// Returns a string that identifies the variants created from o
+// with charset, aggl and praet.
+const std::string optionsKey(
+    const struct Options& o, morfeusz::Charset charset,
+    const std::string& aggl, const std::string& praet) {
+  std::string key;
+  const int enums[] = {
+      o.tokenNumbering, o.caseHandling, o.whitespaceHandling, charset,
+  };
+  key.append(reinterpret_cast<const char*>(enums), sizeof enums);
+  key.append(aggl).push_back('\0');
+  key.append(praet);
+  return key;
+}
+
+class AnalysisCache;
+class FormTable;
+class SentenceCache;
+uint64_t settingsFingerprint(const Morfeusz* m);
+
+// The tables that analyse() looks texts up in before analysing them:
+// a form table, then a sentence cache, then an analysis cache.
+struct LookupTables {
+  std::shared_ptr<FormTable> forms;
+  std::shared_ptr<SentenceCache> sentences;
+  std::shared_ptr<AnalysisCache> cache;
+
+  bool empty() const {
+    return !forms && !sentences && !cache;
+  }
+};
+
+// Instance is the object behind a Morf: an instance of Morfeusz
+// together with the state that the shim keeps for it.
+class Instance {
+ public:
+  Instance(Morfeusz* morfeusz, const std::string& dictName)
+      : morfeusz(morfeusz), lazy(false), heapBytes(0), dictName(dictName),
+        lazyGenerator(NULL) {
+    ++liveInstances;
+  }
+
+  // Makes an instance that generates with a clone of the instance
+  // loaded by source, made on the first call to generator(). lazy
+  // tells that source should be loaded only for actual generation.
+  Instance(Morfeusz* morfeusz, const std::string& dictName,
+           const std::shared_ptr<GeneratorSource>& source, bool lazy)
+      : morfeusz(morfeusz), lazy(lazy), heapBytes(0), dictName(dictName),
+        source(source), lazyGenerator(NULL) {
+    ++liveInstances;
+  }
+
+  ~Instance() {
+    clearVariants();
+    clearGenerator();
+    delete morfeusz;
+    --liveInstances;
+    liveInstanceBytes -= heapBytes;
+  }
+
+  Instance* clone() {
+    const int64_t before = heapInUse();
+    std::lock_guard<std::mutex> lock(generatorMutex);
+    Instance* ret = new Instance(
+        morfeusz->clone(), getDictName(), source, lazy);
+    ret->setHeapBytes(heapGrowth(before));
+    ret->tables = getLookupTables();
+    return ret;
+  }
+
+  // Records the heap growth measured while creating the instance.
+  void setHeapBytes(int64_t n) {
+    liveInstanceBytes += n - heapBytes;
+    heapBytes = n;
+  }
+
+  int64_t getHeapBytes() const {
+    return heapBytes;
+  }
+
+  // Returns the instance that generates forms: morfeusz itself, or
+  // the lazily made generator with the settings of morfeusz applied.
+  // Throws std::exception when the generator cannot be made.
+  const Morfeusz* generator() {
+    std::lock_guard<std::mutex> lock(generatorMutex);
+    if (!source) {
+      return morfeusz;
+    }
+    if (lazyGenerator == NULL) {
+      Morfeusz* g = source->clone();
+      try {
+        g->setCharset(morfeusz->getCharset());
+        g->setAggl(morfeusz->getAggl());
+        g->setPraet(morfeusz->getPraet());
+      } catch (const std::exception&) {
+        delete g;
+        throw;
+      }
+      lazyGenerator = g;
+    }
+    return lazyGenerator;
+  }
+
+  // Drops the generator, which no longer reflects the settings
+  // of morfeusz after it has been modified.
+  void clearGenerator() {
+    std::lock_guard<std::mutex> lock(generatorMutex);
+    delete lazyGenerator;
+    lazyGenerator = NULL;
+  }
+
+  // Records that morfeusz has switched to the dictionary named
+  // dictName, and makes a lazy generator use it. The generator itself
+  // and the variants have already been dropped by modify().
+  void setDictionary(const std::string& dictName) {
+    {
+      std::lock_guard<std::mutex> lock(variantsMutex);
+      this->dictName = dictName;
+    }
+    std::lock_guard<std::mutex> lock(generatorMutex);
+    if (source) {
+      source = std::make_shared<GeneratorSource>(dictName);
+    }
+  }
+
+  std::string getDictName() {
+    std::lock_guard<std::mutex> lock(variantsMutex);
+    return dictName;
+  }
+
+  // Returns an instance of Morfeusz with the dictionary, charset, aggl
+  // and praet of morfeusz and options o applied. It is loaded anew,
+  // since a clone would share some settings with morfeusz, and cached,
+  // so switching between a few sets of options is cheap after the first
+  // use of each. Throws std::exception when Morfeusz rejects
+  // the options.
+  const Morfeusz* variant(const struct Options& o) {
+    if (!inRange(translateTokenNumbering, o.tokenNumbering)) {
+      throw std::invalid_argument(
+          configFieldErrors[CONFIG_TOKEN_NUMBERING]);
+    }
+    if (!inRange(translateCaseHandling, o.caseHandling)) {
+      throw std::invalid_argument(configFieldErrors[CONFIG_CASE_HANDLING]);
+    }
+    if (!inRange(translateWhitespaceHandling, o.whitespaceHandling)) {
+      throw std::invalid_argument(
+          configFieldErrors[CONFIG_WHITESPACE_HANDLING]);
+    }
+    const morfeusz::Charset charset = morfeusz->getCharset();
+    const std::string aggl =
+        o.aggl.n != 0 ? stdString(o.aggl) : morfeusz->getAggl();
+    const std::string praet =
+        o.praet.n != 0 ? stdString(o.praet) : morfeusz->getPraet();
+    const std::string key = optionsKey(o, charset, aggl, praet);
+    std::lock_guard<std::mutex> lock(variantsMutex);
+    std::map<std::string, Morfeusz*>::const_iterator it = variants.find(key);
+    if (it != variants.end()) {
+      return it->second;
+    }
+    std::unique_ptr<Morfeusz> v(createMorfeusz(
+        dictName, morfeusz::MorfeuszUsage::ANALYSE_ONLY));
+    v->setCharset(charset);
+    v->setAggl(aggl);
+    v->setPraet(praet);
+    v->setCaseHandling(translateCaseHandling[o.caseHandling]);
+    v->setTokenNumbering(translateTokenNumbering[o.tokenNumbering]);
+    v->setWhitespaceHandling(
+        translateWhitespaceHandling[o.whitespaceHandling]);
+    variants[key] = v.get();
+    return v.release();
+  }
+
+  // Drops the variants, which no longer reflect the settings
+  // of morfeusz after it has been modified.
+  void clearVariants() {
+    std::lock_guard<std::mutex> lock(variantsMutex);
+    for (std::map<std::string, Morfeusz*>::const_iterator it =
+             variants.begin();
+         it != variants.end(); ++it) {
+      delete it->second;
+    }
+    variants.clear();
+    fingerprints.clear();
+  }
+
+  // Returns the lookup tables consulted by analyse(), all read
+  // under a single lock.
+  LookupTables getLookupTables() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return tables;
+  }
+
+  void setCache(const std::shared_ptr<AnalysisCache>& c) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    tables.cache = c;
+  }
+
+  void setForms(const std::shared_ptr<FormTable>& f) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    tables.forms = f;
+  }
+
+  void setSentences(const std::shared_ptr<SentenceCache>& s) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    tables.sentences = s;
+  }
+
+  // Returns settingsFingerprint(m) for morfeusz or one of the variants,
+  // computed again only when they are dropped or the settings that
+  // clones share have changed, possibly through a clone.
+  uint64_t fingerprint(const Morfeusz* m) {
+    const Fingerprint f = {
+      m->getCharset(), m->getCaseHandling(), m->getWhitespaceHandling(), 0,
+    };
+    std::lock_guard<std::mutex> lock(variantsMutex);
+    Fingerprint& cached = fingerprints[m];
+    if (cached.value == 0 || cached.charset != f.charset ||
+        cached.caseHandling != f.caseHandling ||
+        cached.whitespaceHandling != f.whitespaceHandling) {
+      cached = f;
+      cached.value = settingsFingerprint(m);
+    }
+    return cached.value;
+  }
+
+  Morfeusz* const morfeusz;
+  const bool lazy;
+
+ private:
+  int64_t heapBytes;
+  std::mutex variantsMutex;
+  // The name of the dictionary of morfeusz, empty for the default one.
+  std::string dictName;
+  std::map<std::string, Morfeusz*> variants;
+  // A fingerprint with the shared settings it was computed with.
+  struct Fingerprint {
+    morfeusz::Charset charset;
+    morfeusz::CaseHandling caseHandling;
+    morfeusz::WhitespaceHandling whitespaceHandling;
+    uint64_t value;
+  };
+  std::map<const Morfeusz*, Fingerprint> fingerprints;
+  std::mutex generatorMutex;
+  std::shared_ptr<GeneratorSource> source;
+  Morfeusz* lazyGenerator;
+  std::mutex cacheMutex;
+  LookupTables tables;
+};
+
+Instance* icast(Morf m) {
+  return static_cast<Instance*>(m);
+}
+
+const Morfeusz* cmcast(const Morf m) {
+  return static_cast<const Instance*>(m)->morfeusz;
+}
+
+Morfeusz* mcast(Morf m) {
+  return icast(m)->morfeusz;
+}
+
+// Returns the Morfeusz behind m for a call to one of its setters.
+Morfeusz* modify(Morf m) {
+  icast(m)->clearVariants();
+  icast(m)->clearGenerator();
+  return mcast(m);
+}
+
+// Loads the instance of Morfeusz behind an Instance with usage.
+// For ANALYSE_AND_GENERATE_IN_PARALLEL, source loads the generation
+// data on another thread at the same time.
+Morfeusz* loadMorfeusz(const std::string& dictName, enum Usage usage,
+                       const std::shared_ptr<GeneratorSource>& source) {
+  if (usage != ANALYSE_AND_GENERATE_IN_PARALLEL) {
+    return createMorfeusz(dictName, translateUsage[usage]);
+  }
+  std::string error;
+  std::thread loader([&source, &error]() {
+    try {
+      source->load();
+    } catch (const std::exception& e) {
+      error = e.what();
+    }
+  });
+  Morfeusz* m;
+  try {
+    m = createMorfeusz(dictName, translateUsage[usage]);
+  } catch (const std::exception&) {
+    loader.join();
+    throw;
+  }
+  loader.join();
+  if (!error.empty()) {
+    delete m;
+    throw std::runtime_error(error);
+  }
+  return m;
+}
+
+// Returns a new Instance for m, loaded from the dictionary named
+// dictName with usage, and source, as made by newGeneratorSource.
+Instance* newInstance(
+    Morfeusz* m, enum Usage usage, const std::string& dictName,
+    const std::shared_ptr<GeneratorSource>& source) {
+  if (!source) {
+    return new Instance(m, dictName);
+  }
+  return new Instance(m, dictName, source,
+                      usage == ANALYSE_AND_LAZY_GENERATE);
+}
+
+ResultsIterator* rcast(Res r) {
+  return static_cast<ResultsIterator*>(r);
+}
+
+const IdResolver& idResolver(const Morf m) {
+  return cmcast(m)->getIdResolver();
+}
+
+bool isAsciiSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' ||
+      c == '\r' || c == '\f' || c == '\v';
+}
+
+// Replaces the ids in m, which come from dictionary from,
+// with the ids of the same strings in dictionary to. Returns false
+// when dictionary to lacks any of them. Id 0 means the empty name
+// and the empty labels in every dictionary.
+bool translateIds(
+    const IdResolver& from, const IdResolver& to, MorphInterpretation* m) {
+  try {
+    m->tagId = to.getTagId(from.getTag(m->tagId));
+    if (m->nameId != 0) {
+      m->nameId = to.getNameId(from.getName(m->nameId));
+    }
+    if (m->labelsId != 0) {
+      m->labelsId = to.getLabelsId(from.getLabelsAsString(m->labelsId));
+    }
+    return true;
+  } catch (const std::exception&) {
+    return false;
+  }
+}
+
+// Analyses text with primary and then analyses the orths of the ign
+// segments with fallback, all of them in a single call separated
+// by spaces. The interpretations found by fallback replace the ign
+// segments, with their ids translated to those of primary and with
+// the later nodes renumbered to make room for any new inner nodes.
+// Throws std::exception unless both use the same charset, as the orths
+// are passed on as they are.
+void analyseWithFallback(
+    const Morfeusz* primary, Instance* fallback,
+    const std::string& text, std::vector<MorphInterpretation>* out) {
+  if (primary->getCharset() != fallback->morfeusz->getCharset()) {
+    throw std::invalid_argument("Fallback instance with another charset");
+  }
+  std::vector<MorphInterpretation> results;
+  primary->analyse(text, results);
+  std::vector<size_t> igns;
+  std::vector<std::string> suffixes;
+  std::string batch;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const MorphInterpretation& r = results[i];
+    if (!r.isIgn() || r.endNode != r.startNode + 1) {
+      continue;
+    }
+    // With APPEND_WHITESPACES the orth ends with whitespace,
+    // which is put back after the segment is re-analysed.
+    size_t n = r.orth.size();
+    while (n > 0 && isAsciiSpace(r.orth[n - 1])) {
+      --n;
+    }
+    if (n == 0) {
+      continue;
+    }
+    if (!batch.empty()) {
+      batch.push_back(' ');
+    }
+    batch.append(r.orth, 0, n);
+    igns.push_back(i);
+    suffixes.push_back(r.orth.substr(n));
+  }
+  if (igns.empty()) {
+    out->swap(results);
+    return;
+  }
+
+  const struct Options o = {
+      emptyString,
+      emptyString,
+      SEPARATE_NUMBERING,
+      reverseTranslate<CaseHandling>(
+          translateCaseHandling, fallback->morfeusz->getCaseHandling()),
+      KEEP_WHITESPACES,
+  };
+  std::vector<MorphInterpretation> fallbackResults;
+  fallback->variant(o)->analyse(batch, fallbackResults);
+
+  // Split the results into groups, one for each ign segment,
+  // with nodes relative to the start of the group.
+  std::vector<std::vector<MorphInterpretation> > groups(1);
+  int groupStart =
+      fallbackResults.empty() ? 0 : fallbackResults.front().startNode;
+  for (std::vector<MorphInterpretation>::const_iterator it =
+           fallbackResults.begin();
+       it != fallbackResults.end(); ++it) {
+    if (it->isWhitespace()) {
+      groups.push_back(std::vector<MorphInterpretation>());
+      groupStart = it->endNode;
+      continue;
+    }
+    MorphInterpretation r = *it;
+    r.startNode -= groupStart;
+    r.endNode -= groupStart;
+    groups.back().push_back(r);
+  }
+  if (groups.size() != igns.size()) {
+    // The fallback dictionary found whitespace inside an orth,
+    // so the groups cannot be matched with the segments.
+    out->swap(results);
+    return;
+  }
+
+  // spans[g] is the number of edges replacing segment g, or 0
+  // when the segment is kept. shiftEnds and shifts map every node
+  // following a replaced segment to the number of new nodes before it.
+  const IdResolver& from = fallback->morfeusz->getIdResolver();
+  const IdResolver& to = primary->getIdResolver();
+  std::vector<int> spans(groups.size());
+  std::vector<int> shiftEnds;
+  std::vector<int> shifts;
+  int shift = 0;
+  for (size_t g = 0; g < groups.size(); ++g) {
+    std::vector<MorphInterpretation>& group = groups[g];
+    bool known = false;
+    bool translated = true;
+    int span = 0;
+    for (std::vector<MorphInterpretation>::iterator it = group.begin();
+         it != group.end() && translated; ++it) {
+      known = known || !it->isIgn();
+      translated = translateIds(from, to, &*it);
+      span = std::max(span, it->endNode);
+    }
+    if (!known || !translated) {
+      continue;
+    }
+    spans[g] = span;
+    shift += span - 1;
+    shiftEnds.push_back(results[igns[g]].endNode);
+    shifts.push_back(shift);
+  }
+  struct Renumber {
+    const std::vector<int>& ends;
+    const std::vector<int>& shifts;
+    int operator()(int node) const {
+      const size_t i =
+          std::upper_bound(ends.begin(), ends.end(), node) - ends.begin();
+      return i == 0 ? node : node + shifts[i - 1];
+    }
+  } renumber = { shiftEnds, shifts };
+
+  out->clear();
+  out->reserve(results.size() + fallbackResults.size());
+  size_t g = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    MorphInterpretation r = results[i];
+    if (g < igns.size() && igns[g] == i) {
+      const int span = spans[g];
+      const std::vector<MorphInterpretation>& group = groups[g];
+      const std::string& suffix = suffixes[g];
+      ++g;
+      if (span != 0) {
+        const int base = renumber(r.startNode);
+        for (std::vector<MorphInterpretation>::const_iterator it =
+                 group.begin();
+             it != group.end(); ++it) {
+          out->push_back(*it);
+          MorphInterpretation& f = out->back();
+          if (f.endNode == span) {
+            f.orth += suffix;
+          }
+          f.startNode += base;
+          f.endNode += base;
+        }
+        continue;
+      }
+    }
+    r.startNode = renumber(r.startNode);
+    r.endNode = renumber(r.endNode);
+    out->push_back(r);
+  }
+}
+
+// ByteWriter builds a character array that can be handed over
+// to Go without copying it again.
+class ByteWriter {
+ public:
+  ByteWriter() : p(NULL), n(0), capacity(0) {}
+
+  ~ByteWriter() {
+    deallocate(p);
+  }
+
+  void append(const char* s, size_t length) {
+    reserve(length);
+    memcpy(p + n, s, length);
+    n += length;
+  }
+
+  void append(const std::string& s) {
+    append(s.data(), s.size());
+  }
+
+  void push_back(char c) {
+    reserve(1);
+    p[n++] = c;
+  }
+
+  void appendDecimal(int i) {
+    char digits[16];
+    append(digits, snprintf(digits, sizeof digits, "%d", i));
+  }
+
+  void appendVarint(uint32_t u) {
+    char bytes[5];
+    size_t length = 0;
+    for (; u >= 0x80; u >>= 7) {
+      bytes[length++] = static_cast<char>(u | 0x80);
+    }
+    bytes[length++] = static_cast<char>(u);
+    append(bytes, length);
+  }
+
+  void appendUint32(uint32_t u) {
+    const char bytes[] = {
+        static_cast<char>(u), static_cast<char>(u >> 8),
+        static_cast<char>(u >> 16), static_cast<char>(u >> 24),
+    };
+    append(bytes, sizeof bytes);
+  }
+
+  size_t size() const {
+    return n;
+  }
+
+  // Returns the bytes written so far, to be freed with deallocate,
+  // and leaves the writer empty.
+  const struct String release() {
+    const struct String ret = { p, static_cast<int>(n) };
+    p = NULL;
+    n = capacity = 0;
+    return ret;
+  }
+
+ private:
+  void reserve(size_t length) {
+    if (n + length <= capacity) {
+      return;
+    }
+    capacity = std::max(2 * capacity, n + length + 256);
+    char* q = allocate<char>(capacity);
+    if (n != 0) {
+      memcpy(q, p, n);
+    }
+    deallocate(p);
+    p = q;
+  }
+
+  char* p;
+  size_t n;
+  size_t capacity;
+};
+
+// ByteReader reads the varints and strings written by ByteWriter.
+// It throws std::runtime_error(malformed) on data that ends too early.
+class ByteReader {
+ public:
+  ByteReader(const char* p, size_t n, const char* malformed)
+      : p(p), end(p + n), malformed(malformed) {}
+
+  bool atEnd() const {
+    return p == end;
+  }
+
+  uint32_t readVarint() {
+    uint32_t u = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      if (p == end) {
+        break;
+      }
+      const unsigned char c = *p++;
+      u |= static_cast<uint32_t>(c & 0x7f) << shift;
+      if (c < 0x80) {
+        return u;
+      }
+    }
+    throw std::runtime_error(malformed);
+  }
+
+  std::string readString() {
+    const uint32_t length = readVarint();
+    if (length > static_cast<size_t>(end - p)) {
+      throw std::runtime_error(malformed);
+    }
+    const std::string ret(p, length);
+    p += length;
+    return ret;
+  }
+
+ private:
+  const char* p;
+  const char* const end;
+  const char* const malformed;
+};
+
+void appendTsvField(const std::string& s, ByteWriter* w) {
+  for (std::string::const_iterator it = s.begin(); it != s.end(); ++it) {
+    switch (*it) {
+      case '\t': w->append("\\t", 2); break;
+      case '\n': w->append("\\n", 2); break;
+      case '\r': w->append("\\r", 2); break;
+      case '\\': w->append("\\\\", 2); break;
+      default: w->push_back(*it);
+    }
+  }
+}
+
+void writeTsv(
+    const IdResolver& r, const MorphInterpretation& m, ByteWriter* w) {
+  w->appendDecimal(m.startNode);
+  w->push_back('\t');
+  w->appendDecimal(m.endNode);
+  w->push_back('\t');
+  appendTsvField(m.orth, w);
+  w->push_back('\t');
+  appendTsvField(m.lemma, w);
+  w->push_back('\t');
+  appendTsvField(r.getTag(m.tagId), w);
+  w->push_back('\t');
+  appendTsvField(r.getName(m.nameId), w);
+  w->push_back('\t');
+  appendTsvField(r.getLabelsAsString(m.labelsId), w);
+  w->push_back('\n');
+}
+
+void appendJsonString(const std::string& s, ByteWriter* w) {
+  w->push_back('"');
+  for (std::string::const_iterator it = s.begin(); it != s.end(); ++it) {
+    const unsigned char c = *it;
+    if (c == '"' || c == '\\') {
+      w->push_back('\\');
+      w->push_back(c);
+    } else if (c < 0x20) {
+      char escape[8];
+      w->append(escape, snprintf(escape, sizeof escape, "\\u%04x", c));
+    } else {
+      w->push_back(c);
+    }
+  }
+  w->push_back('"');
+}
+
+void writeJsonLine(
+    const IdResolver& r, const MorphInterpretation& m, ByteWriter* w) {
+  w->append("{\"start\":", 9);
+  w->appendDecimal(m.startNode);
+  w->append(",\"end\":", 7);
+  w->appendDecimal(m.endNode);
+  w->append(",\"orth\":", 8);
+  appendJsonString(m.orth, w);
+  w->append(",\"lemma\":", 9);
+  appendJsonString(m.lemma, w);
+  w->append(",\"tag\":", 7);
+  appendJsonString(r.getTag(m.tagId), w);
+  w->append(",\"name\":", 8);
+  appendJsonString(r.getName(m.nameId), w);
+  w->append(",\"labels\":", 10);
+  appendJsonString(r.getLabelsAsString(m.labelsId), w);
+  w->append("}\n", 2);
+}
+
+void appendBinaryString(const std::string& s, ByteWriter* w) {
+  w->appendUint32(s.size());
+  w->append(s);
+}
+
+void writeBinary(
+    const IdResolver& r, const MorphInterpretation& m, ByteWriter* w) {
+  w->appendUint32(m.startNode);
+  w->appendUint32(m.endNode);
+  appendBinaryString(m.orth, w);
+  appendBinaryString(m.lemma, w);
+  appendBinaryString(r.getTag(m.tagId), w);
+  appendBinaryString(r.getName(m.nameId), w);
+  appendBinaryString(r.getLabelsAsString(m.labelsId), w);
+}
+
+uint32_t zigzag(int i) {
+  return (static_cast<uint32_t>(i) << 1) ^ static_cast<uint32_t>(i >> 31);
+}
+
+int unzigzag(uint32_t u) {
+  return static_cast<int>(u >> 1) ^ -static_cast<int>(u & 1);
+}
+
+// CompactEncoder writes interpretations in COMPACT_FORMAT.
+class CompactEncoder {
+ public:
+  CompactEncoder(const std::string& dictId, ByteWriter* w)
+      : w(w), previousStart(0) {
+    w->appendVarint(COMPACT_FORMAT_VERSION);
+    w->appendVarint(dictId.size());
+    w->append(dictId);
+  }
+
+  void write(const MorphInterpretation& m) {
+    w->appendVarint(zigzag(m.startNode - previousStart));
+    previousStart = m.startNode;
+    w->appendVarint(m.endNode - m.startNode);
+    w->appendVarint(m.tagId);
+    w->appendVarint(m.nameId);
+    w->appendVarint(m.labelsId);
+    writeString(m.orth);
+    writeString(m.lemma);
+  }
+
+ private:
+  void writeString(const std::string& s) {
+    const std::pair<std::unordered_map<std::string, uint32_t>::iterator,
+                    bool> inserted =
+        strings.insert(std::make_pair(s, strings.size() + 1));
+    if (inserted.second) {
+      w->appendVarint(0);
+      w->appendVarint(s.size());
+      w->append(s);
+    } else {
+      w->appendVarint(inserted.first->second);
+    }
+  }
+
+  ByteWriter* const w;
+  int previousStart;
+  std::unordered_map<std::string, uint32_t> strings;
+};
+
+// CompactDecoder reads interpretations written by CompactEncoder.
+class CompactDecoder {
+ public:
+  CompactDecoder(const char* p, size_t n)
+      : r(p, n, "Malformed compact data"), previousStart(0) {
+    if (r.readVarint() != COMPACT_FORMAT_VERSION) {
+      throw std::runtime_error("Unsupported compact format version");
+    }
+    dictId = r.readString();
+  }
+
+  bool hasNext() const {
+    return !r.atEnd();
+  }
+
+  MorphInterpretation next() {
+    MorphInterpretation m;
+    m.startNode = previousStart + unzigzag(r.readVarint());
+    previousStart = m.startNode;
+    m.endNode = m.startNode + r.readVarint();
+    m.tagId = r.readVarint();
+    m.nameId = r.readVarint();
+    m.labelsId = r.readVarint();
+    m.orth = readStringReference();
+    m.lemma = readStringReference();
+    return m;
+  }
+
+  std::string dictId;
+
+ private:
+  const std::string& readStringReference() {
+    const uint32_t k = r.readVarint();
+    if (k == 0) {
+      strings.push_back(r.readString());
+      return strings.back();
+    }
+    if (k > strings.size()) {
+      throw std::runtime_error("Malformed compact data");
+    }
+    return strings[k - 1];
+  }
+
+  ByteReader r;
+  int previousStart;
+  std::vector<std::string> strings;
+};
+
+typedef void (*Serializer)(
+    const IdResolver&, const MorphInterpretation&, ByteWriter*);
+
+// Indexed by enum Format.
+const Serializer serializers[] = {
+    writeTsv,
+    writeJsonLine,
+    writeBinary,
+    NULL,  // COMPACT_FORMAT needs a CompactEncoder.
+};
+
+typedef std::vector<MorphInterpretation>::iterator InterpretationIterator;
+
+// Serializes the interpretations from begin to end in format, as one
+// result of serializeAnalysis, with offset subtracted from their nodes.
+void serializeRange(
+    const Morfeusz* m, const IdResolver& r, enum Format format,
+    InterpretationIterator begin, InterpretationIterator end, int offset,
+    ByteWriter* w) {
+  std::unique_ptr<CompactEncoder> e;
+  if (format == COMPACT_FORMAT) {
+    e.reset(new CompactEncoder(m->getDictID(), w));
+  }
+  for (InterpretationIterator it = begin; it != end; ++it) {
+    it->startNode -= offset;
+    it->endNode -= offset;
+    if (e) {
+      e->write(*it);
+    } else {
+      serializers[format](r, *it, w);
+    }
+  }
+}
+
+// Texts joined with coalescingSeparator are analysed in a single pass.
+// The separator yields a segment of its own with the orth "\x01",
+// which the texts cannot produce unless they contain '\x01'.
+const char coalescingSeparator[] = "\n\x01\n";
+const std::string separatorOrth("\x01");
+
+// Coalescing gives the same results as separate calls only if
+// whitespace does not show up in the results and every call numbers
+// its nodes from 0.
+bool canCoalesce(const Morfeusz* m, const struct String texts, int count) {
+  return count > 1 &&
+      m->getWhitespaceHandling() ==
+          morfeusz::WhitespaceHandling::SKIP_WHITESPACES &&
+      m->getTokenNumbering() ==
+          morfeusz::TokenNumbering::SEPARATE_NUMBERING &&
+      memchr(texts.p, '\x01', texts.n) == NULL;
+}
+
+// Analyses count texts joined with separators and serializes
+// the results of every text into w, storing their sizes in sizes.
+// Returns false, leaving w untouched, if the separators cannot be
+// told apart in the result.
+bool serializeCoalesced(
+    const Morfeusz* m, const IdResolver& r, enum Format format,
+    const struct String texts, const int* lengths, int count, int* sizes,
+    ByteWriter* w) {
+  std::string joined;
+  joined.reserve(texts.n + count * (sizeof coalescingSeparator - 1));
+  const char* p = texts.p;
+  for (int doc = 0; doc < count; ++doc) {
+    if (doc > 0) {
+      joined.append(coalescingSeparator);
+    }
+    joined.append(p, lengths[doc]);
+    p += lengths[doc];
+  }
+  std::vector<MorphInterpretation> vec;
+  m->analyse(joined, vec);
+  std::vector<InterpretationIterator> separators;
+  for (InterpretationIterator it = vec.begin(); it != vec.end(); ++it) {
+    if (it->orth == separatorOrth) {
+      separators.push_back(it);
+    }
+  }
+  if (static_cast<int>(separators.size()) != count - 1) {
+    return false;
+  }
+  separators.push_back(vec.end());
+  InterpretationIterator begin = vec.begin();
+  int offset = 0;
+  for (int doc = 0; doc < count; ++doc) {
+    const size_t before = w->size();
+    serializeRange(m, r, format, begin, separators[doc], offset, w);
+    sizes[doc] = w->size() - before;
+    if (separators[doc] != vec.end()) {
+      offset = separators[doc]->endNode;
+      begin = separators[doc] + 1;
+    }
+  }
+  return true;
+}
+
+// Utf8Column accumulates an Arrow utf8 array.
+struct Utf8Column {
+  Utf8Column() : offsets(1, 0) {}
+
+  void push_back(const std::string& s) {
+    data.append(s);
+    offsets.push_back(data.size());
+  }
+
+  std::vector<int32_t> offsets;
+  std::string data;
+};
+
+// RecordBatchColumns accumulates the columns of a struct RecordBatch.
+struct RecordBatchColumns {
+  void push_back(int doc, const MorphInterpretation& m) {
+    document.push_back(doc);
+    startNode.push_back(m.startNode);
+    endNode.push_back(m.endNode);
+    orth.push_back(m.orth);
+    lemma.push_back(m.lemma);
+    tagId.push_back(m.tagId);
+    nameId.push_back(m.nameId);
+    labelsId.push_back(m.labelsId);
+  }
+
+  std::vector<int32_t> document;
+  std::vector<int32_t> startNode;
+  std::vector<int32_t> endNode;
+  Utf8Column orth;
+  Utf8Column lemma;
+  std::vector<int32_t> tagId;
+  std::vector<int32_t> nameId;
+  std::vector<int32_t> labelsId;
+};
+
+// ArrowHolder owns everything behind an exported record batch
+// except the top-level structs: the buffers, in a single block,
+// and the structs of the children and dictionaries. Every struct
+// holds a reference to it in private_data, so that the children
+// can be moved out and released independently, as the Arrow C data
+// interface allows.
+struct ArrowHolder {
+  static const size_t alignment = 64;
+
+  ArrowHolder() : block(NULL) {}
+
+  ~ArrowHolder() {
+    deallocate(block);
+  }
+
+  char* block;
+  std::vector<struct ArrowArray> arrays;
+  std::vector<struct ArrowSchema> schemas;
+  std::vector<struct ArrowArray*> arrayChildren;
+  std::vector<struct ArrowSchema*> schemaChildren;
+  std::vector<std::vector<const void*> > buffers;
+};
+
+typedef std::shared_ptr<ArrowHolder> ArrowHolderRef;
+
+template<typename T>
+void releaseArrow(T* t) {
+  for (int64_t i = 0; i < t->n_children; ++i) {
+    if (t->children[i]->release != NULL) {
+      t->children[i]->release(t->children[i]);
+    }
+  }
+  if (t->dictionary != NULL && t->dictionary->release != NULL) {
+    t->dictionary->release(t->dictionary);
+  }
+  delete static_cast<ArrowHolderRef*>(t->private_data);
+  t->release = NULL;
+}
+
+// ArrowExporter copies columns into the aligned buffers of an
+// ArrowHolder and describes them with Arrow structs.
+class ArrowExporter {
+ public:
+  // The holder reserves room for maxStructs arrays and schemas
+  // besides the top-level ones, so that pointers to them remain valid.
+  ArrowExporter(size_t bufferBytes, size_t maxBuffers, size_t maxStructs)
+      : holder(std::make_shared<ArrowHolder>()), used(0) {
+    holder->block = allocate<char>(
+        bufferBytes + (maxBuffers + 1) * ArrowHolder::alignment);
+    const uintptr_t start = reinterpret_cast<uintptr_t>(holder->block);
+    base = holder->block +
+        (-start & (ArrowHolder::alignment - 1));
+    holder->arrays.reserve(maxStructs);
+    holder->schemas.reserve(maxStructs);
+    holder->buffers.reserve(maxStructs + 1);
+  }
+
+  template<typename T>
+  const void* copy(const T* p, size_t n) {
+    char* dst = base + used;
+    if (n != 0) {
+      memcpy(dst, p, n * sizeof(T));
+    }
+    used += (n * sizeof(T) + ArrowHolder::alignment - 1) &
+        ~(ArrowHolder::alignment - 1);
+    return dst;
+  }
+
+  // Fills a and s with an int32 column.
+  void int32Column(const char* name, const std::vector<int32_t>& v,
+                   struct ArrowArray* a, struct ArrowSchema* s) {
+    const void* buffers[] = { NULL, copy(v.data(), v.size()) };
+    fill(a, v.size(), buffers, 2);
+    fill(s, "i", name);
+  }
+
+  // Fills a and s with a utf8 column.
+  void utf8Column(const char* name, const Utf8Column& c,
+                  struct ArrowArray* a, struct ArrowSchema* s) {
+    const void* buffers[] = {
+        NULL,
+        copy(c.offsets.data(), c.offsets.size()),
+        copy(c.data.data(), c.data.size()),
+    };
+    fill(a, c.offsets.size() - 1, buffers, 3);
+    fill(s, "u", name);
+  }
+
+  // Fills a and s with an int32 column encoding the strings of dict.
+  void dictionaryColumn(const char* name, const std::vector<int32_t>& v,
+                        const Utf8Column& dict,
+                        struct ArrowArray* a, struct ArrowSchema* s) {
+    int32Column(name, v, a, s);
+    a->dictionary = newArray();
+    s->dictionary = newSchema();
+    utf8Column("", dict, a->dictionary, s->dictionary);
+  }
+
+  // Fills a and s with a struct of the columns filled so far.
+  void structColumn(struct ArrowArray* a, struct ArrowSchema* s,
+                    int64_t length) {
+    const void* buffers[] = { NULL };
+    fill(a, length, buffers, 1);
+    fill(s, "+s", "");
+    a->n_children = s->n_children = holder->arrayChildren.size();
+    a->children = holder->arrayChildren.data();
+    s->children = holder->schemaChildren.data();
+  }
+
+  // Returns a new child column.
+  struct ArrowArray* newChild(struct ArrowSchema** schema) {
+    holder->arrayChildren.push_back(newArray());
+    holder->schemaChildren.push_back(newSchema());
+    *schema = holder->schemaChildren.back();
+    return holder->arrayChildren.back();
+  }
+
+ private:
+  struct ArrowArray* newArray() {
+    holder->arrays.push_back(ArrowArray());
+    return &holder->arrays.back();
+  }
+
+  struct ArrowSchema* newSchema() {
+    holder->schemas.push_back(ArrowSchema());
+    return &holder->schemas.back();
+  }
+
+  void fill(struct ArrowArray* a, int64_t length,
+            const void* const* buffers, int n) {
+    holder->buffers.push_back(std::vector<const void*>(buffers, buffers + n));
+    memset(a, 0, sizeof *a);
+    a->length = length;
+    a->n_buffers = n;
+    a->buffers = holder->buffers.back().data();
+    a->release = releaseArrow<struct ArrowArray>;
+    a->private_data = new ArrowHolderRef(holder);
+  }
+
+  void fill(struct ArrowSchema* s, const char* format, const char* name) {
+    memset(s, 0, sizeof *s);
+    s->format = format;
+    s->name = name;
+    s->release = releaseArrow<struct ArrowSchema>;
+    s->private_data = new ArrowHolderRef(holder);
+  }
+
+  ArrowHolderRef holder;
+  char* base;
+  size_t used;
+};
+
+// Builds a struct RecordBatch out of columns for the dictionary of r.
+const struct RecordBatch makeRecordBatch(
+    const RecordBatchColumns& c, const IdResolver& r) {
+  Utf8Column tags;
+  for (size_t i = 0; i < r.getTagsCount(); ++i) {
+    tags.push_back(r.getTag(i));
+  }
+  Utf8Column names;
+  for (size_t i = 0; i < r.getNamesCount(); ++i) {
+    names.push_back(r.getName(i));
+  }
+  Utf8Column labels;
+  for (size_t i = 0; i < r.getLabelsCount(); ++i) {
+    labels.push_back(r.getLabelsAsString(i));
+  }
+  const Utf8Column* utf8s[] = {
+      &c.orth, &c.lemma, &tags, &names, &labels,
+  };
+  size_t bytes = 6 * c.document.size() * sizeof(int32_t);
+  for (size_t i = 0; i < sizeof utf8s / sizeof *utf8s; ++i) {
+    if (utf8s[i]->data.size() > INT32_MAX) {
+      throw std::length_error("Record batch too large");
+    }
+    bytes += utf8s[i]->offsets.size() * sizeof(int32_t);
+    bytes += utf8s[i]->data.size();
+  }
+
+  // 6 int32 columns and 5 utf8 columns, 3 of which are dictionaries.
+  ArrowExporter e(bytes, 6 + 2 * 5, 8 + 3);
+  struct ArrowSchema* s;
+  struct ArrowArray* a;
+  a = e.newChild(&s);
+  e.int32Column("document", c.document, a, s);
+  a = e.newChild(&s);
+  e.int32Column("start_node", c.startNode, a, s);
+  a = e.newChild(&s);
+  e.int32Column("end_node", c.endNode, a, s);
+  a = e.newChild(&s);
+  e.utf8Column("orth", c.orth, a, s);
+  a = e.newChild(&s);
+  e.utf8Column("lemma", c.lemma, a, s);
+  a = e.newChild(&s);
+  e.dictionaryColumn("tag", c.tagId, tags, a, s);
+  a = e.newChild(&s);
+  e.dictionaryColumn("name", c.nameId, names, a, s);
+  a = e.newChild(&s);
+  e.dictionaryColumn("labels", c.labelsId, labels, a, s);
+  struct RecordBatch ret = { new ArrowSchema, new ArrowArray, noError };
+  e.structColumn(ret.array, ret.schema, c.document.size());
+  return ret;
+}
+
+// DictionaryRouter is the object behind a Router: instances
+// of Morfeusz for several dictionaries, indexed by small integers.
+class DictionaryRouter {
+ public:
+  ~DictionaryRouter() {
+    for (std::vector<Instance*>::const_iterator it = instances.begin();
+         it != instances.end(); ++it) {
+      delete *it;
+    }
+  }
+
+  // Returns the instance with index dictId, or NULL.
+  Instance* instance(int dictId) const {
+    if (dictId < 0 || dictId >= static_cast<int>(instances.size())) {
+      return NULL;
+    }
+    return instances[dictId];
+  }
+
+  std::vector<Instance*> instances;
+};
+
+DictionaryRouter* rtcast(Router r) {
+  return static_cast<DictionaryRouter*>(r);
+}
+
+const std::string invalidDictIdError(int dictId) {
+  return "Invalid dictionary id " + std::to_string(dictId);
+}
+
+// The largest request that a prefork worker accepts.
+const uint32_t maxRequestSize = 64 << 20;
+
+const std::runtime_error systemError(const std::string& what) {
+  return std::runtime_error(what + ": " + strerror(errno));
+}
+
+bool readFull(int fd, char* p, size_t n) {
+  while (n > 0) {
+    const ssize_t r = read(fd, p, n);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    p += r;
+    n -= r;
+  }
+  return true;
+}
+
+bool writeFull(int fd, const char* p, size_t n) {
+  while (n > 0) {
+    const ssize_t r = send(fd, p, n, MSG_NOSIGNAL);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    p += r;
+    n -= r;
+  }
+  return true;
+}
+
+void putUint32(uint32_t v, char* p) {
+  for (int i = 0; i < 4; ++i) {
+    p[i] = static_cast<char>(v >> (8 * i));
+  }
+}
+
+uint32_t getUint32(const char* p) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; ++i) {
+    v |= static_cast<uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+  }
+  return v;
+}
+
+bool writeResponse(int fd, uint32_t status, const struct String& s) {
+  char header[8];
+  putUint32(status, header);
+  putUint32(s.n, header + 4);
+  return writeFull(fd, header, sizeof header) && writeFull(fd, s.p, s.n);
+}
+
+// Answers the requests coming through fd until the client
+// disconnects or breaks the protocol.
+void serveConnection(const Morf m, enum Format format, int fd) {
+  std::vector<char> text;
+  char header[4];
+  while (readFull(fd, header, sizeof header)) {
+    const uint32_t n = getUint32(header);
+    if (n > maxRequestSize) {
+      return;
+    }
+    text.resize(n);
+    if (!readFull(fd, text.data(), n)) {
+      return;
+    }
+    const struct String s = { text.data(), static_cast<int>(n) };
+    const struct Buffer b = serializeAnalysis(m, s, format);
+    const bool ok = b.error.p == NULL ?
+        writeResponse(fd, 0, b.data) : writeResponse(fd, 1, b.error);
+    freeBuffer(&b);
+    if (!ok) {
+      return;
+    }
+  }
+}
+
+// How often an idle prefork worker checks whether its parent is alive.
+const int parentCheckMillis = 1000;
+
+// Closes every file descriptor a prefork worker inherited except
+// listener, so that the workers do not keep open the connections and
+// files the parent closes later. The standard streams are reopened
+// on /dev/null, so that nothing written to them reaches a client.
+void closeInheritedFds(int listener) {
+  bool closed = false;
+#ifdef SYS_close_range
+  closed = (listener == 0 ||
+            syscall(SYS_close_range, 0, listener - 1, 0) == 0) &&
+      syscall(SYS_close_range, listener + 1, ~0u, 0) == 0;
+#endif  // SYS_close_range
+  if (!closed) {
+    const long max = sysconf(_SC_OPEN_MAX);
+    for (int fd = 0; fd < max; ++fd) {
+      if (fd != listener) {
+        close(fd);
+      }
+    }
+  }
+  int fd;
+  while ((fd = open("/dev/null", O_RDWR)) >= 0 && fd <= STDERR_FILENO) {
+  }
+  if (fd > STDERR_FILENO) {
+    close(fd);
+  }
+}
+
+// Runs a prefork worker. It is called in a child process right after
+// fork() and never returns to Go, whose runtime did not survive fork().
+// The worker exits when its parent does, which it notices by polling
+// getppid() between connections rather than through PR_SET_PDEATHSIG,
+// which fires when the forking thread exits, not the process.
+void servePrefork(const Morf m, enum Format format, int listener,
+                  pid_t parent) {
+  // The signal handlers were installed by the Go runtime.
+  for (int sig = 1; sig < NSIG; ++sig) {
+    signal(sig, SIG_DFL);
+  }
+  sigset_t none;
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, NULL);
+  closeInheritedFds(listener);
+  // The functions set with setAllocator may take locks held by other
+  // threads of the parent or call into Go. The worker frees only what
+  // it allocates itself, so it can switch to the defaults.
+  allocator = { defaultAllocate, defaultDeallocate, NULL };
+  struct pollfd p = { listener, POLLIN, 0 };
+  while (getppid() == parent) {
+    const int n = poll(&p, 1, parentCheckMillis);
+    if (n < 0 && errno != EINTR) {
+      _exit(1);
+    }
+    if (n <= 0) {
+      continue;
+    }
+    // The listener is non-blocking, as another worker may take
+    // the connection first.
+    const int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+          errno == ECONNABORTED) {
+        continue;
+      }
+      _exit(1);
+    }
+    // Some systems pass O_NONBLOCK on from the listener.
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    serveConnection(m, format, fd);
+    close(fd);
+  }
+  _exit(0);
+}
+
+int listenUnix(const std::string& path) {
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof addr.sun_path) {
+    throw std::invalid_argument("Socket path too long: " + path);
+  }
+  memcpy(addr.sun_path, path.data(), path.size());
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw systemError("socket");
+  }
+  if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    const std::runtime_error e = systemError(path);
+    close(fd);
+    throw e;
+  }
+  return fd;
+}
+
+void stopWorkers(const std::vector<int>& pids) {
+  for (std::vector<int>::const_iterator it = pids.begin();
+       it != pids.end(); ++it) {
+    kill(*it, SIGTERM);
+    waitpid(*it, NULL, 0);
+  }
+}
+
+// Sentences and lemmas used by warmup. The sentences cover common
+// inflected forms, numbers, punctuation and agglutinates; the lemmas
+// cover the major paradigms of nouns, verbs, adjectives, pronouns
+// and numerals.
+const char* const warmupSentences[] = {
+    "Ala ma kota, a kot ma Alę.",
+    "Wczoraj poszliśmy z dziećmi do kina na nowy film.",
+    "Czy mógłbyś mi powiedzieć, która jest godzina?",
+    "W 2023 r. firma zatrudniała 1500 osób w 12 miastach.",
+    "Nie widziałem jej od tygodnia, ale dzwoniła do mnie wieczorem.",
+    "Polskie drogi są coraz lepsze, choć wciąż brakuje autostrad.",
+    "Zrobiłbym to sam, gdybym miał więcej czasu.",
+    "Dom stał na wzgórzu nad rzeką, otoczony starymi drzewami.",
+    "Prezydent podpisał ustawę o ochronie środowiska.",
+    "Dlaczegoż byś tam szedł? Przecież już jesteśmy w domu!",
+};
+const char* const warmupLemmas[] = {
+    "kot", "pies", "człowiek", "dom", "kobieta", "ręka", "noc",
+    "dziecko", "okno", "imię", "miasto", "być", "mieć", "robić",
+    "iść", "pisać", "chcieć", "móc", "wziąć", "dobry", "nowy",
+    "polski", "ja", "on", "ten", "który", "swój", "dwa", "pięć",
+};
+
+// Runs the calls that warmup does on instance and counts them in w.
+// After a call of a kind fails, the remaining calls of that kind are
+// skipped. A lazy generator is not loaded. The built-in texts are
+// in UTF-8, so with another charset only the IDs are read. Throws
+// std::exception when instance can neither analyse nor generate.
+void warmUp(Instance* instance, enum WarmupLevel level, struct Warmup* w) {
+  const Morfeusz* m = instance->morfeusz;
+  const IdResolver& ids = m->getIdResolver();
+  for (size_t i = 0; i < ids.getTagsCount(); ++i) {
+    ids.getTag(i);
+  }
+  for (size_t i = 0; i < ids.getNamesCount(); ++i) {
+    ids.getName(i);
+  }
+  for (size_t i = 0; i < ids.getLabelsCount(); ++i) {
+    ids.getLabels(i);
+  }
+  if (m->getCharset() != morfeusz::Charset::UTF8) {
+    return;
+  }
+  std::vector<MorphInterpretation> vec;
+  std::string error;
+  bool canAnalyse = true;
+  for (size_t i = 0;
+       canAnalyse && i < sizeof warmupSentences / sizeof *warmupSentences;
+       ++i) {
+    try {
+      m->analyse(warmupSentences[i], vec);
+      ++w->analyses;
+    } catch (const std::exception& e) {
+      canAnalyse = false;
+      error = e.what();
+    }
+  }
+  bool canGenerate = !instance->lazy;
+  std::string forms;
+  for (size_t i = 0;
+       canGenerate && i < sizeof warmupLemmas / sizeof *warmupLemmas; ++i) {
+    vec.clear();
+    try {
+      instance->generator()->generate(warmupLemmas[i], vec);
+      ++w->generations;
+    } catch (const std::exception&) {
+      canGenerate = false;
+      break;
+    }
+    if (level != WARMUP_FULL || !canAnalyse) {
+      continue;
+    }
+    forms.clear();
+    for (std::vector<MorphInterpretation>::const_iterator it = vec.begin();
+         it != vec.end(); ++it) {
+      forms.append(it->orth).push_back(' ');
+    }
+    vec.clear();
+    m->analyse(forms, vec);
+    ++w->analyses;
+  }
+  if (!canAnalyse && !canGenerate) {
+    throw std::runtime_error(error);
+  }
+}
+
+// Stores s at the end of the string area of struct PackedTokenInfo,
+// unless strings is NULL, and returns its offset.
+uint32_t packString(const std::string& s, char* strings, uint32_t* length) {
+  if (s.size() > UINT16_MAX) {
+    throw std::length_error("Token too long: " + s.substr(0, 32) + "...");
+  }
+  if (s.size() > UINT32_MAX - *length) {
+    throw std::length_error("Packed strings too long");
+  }
+  if (strings != NULL) {
+    memcpy(strings + *length, s.data(), s.size());
+  }
+  const uint32_t ret = *length;
+  *length += s.size();
+  return ret;
+}
+
+uint16_t packId(int id) {
+  if (id < 0 || id > UINT16_MAX) {
+    throw std::out_of_range("Id too large: " + std::to_string(id));
+  }
+  return id;
+}
+
+// Packs vec into tokens and their orths and lemmas into strings after
+// the first length bytes, and returns the new length of the strings.
+// With NULL tokens and strings, only computes the length. An orth equal
+// to the previous orth and a lemma equal to its orth or to the previous
+// lemma are stored once. Throws std::exception when an interpretation
+// does not fit in struct PackedTokenInfo.
+uint32_t packTokenInfos(
+    const std::vector<MorphInterpretation>& vec, uint32_t document,
+    struct PackedTokenInfo* tokens, char* strings, uint32_t length) {
+  const MorphInterpretation* previous = NULL;
+  struct PackedTokenInfo t = {};
+  t.document = document;
+  for (std::vector<MorphInterpretation>::const_iterator it = vec.begin();
+       it != vec.end(); ++it) {
+    if (previous == NULL || it->orth != previous->orth) {
+      t.orthOffset = packString(it->orth, strings, &length);
+      t.orthLength = it->orth.size();
+    }
+    if (it->lemma == it->orth) {
+      t.lemmaOffset = t.orthOffset;
+      t.lemmaLength = t.orthLength;
+    } else if (previous == NULL || it->lemma != previous->lemma) {
+      t.lemmaOffset = packString(it->lemma, strings, &length);
+      t.lemmaLength = it->lemma.size();
+    }
+    t.startNode = it->startNode;
+    t.endNode = it->endNode;
+    t.tagID = packId(it->tagId);
+    t.nameID = packId(it->nameId);
+    t.labelsID = packId(it->labelsId);
+    if (tokens != NULL) {
+      *tokens++ = t;
+    }
+    previous = &*it;
+  }
+  return length;
+}
+
+// Throws std::exception unless all the IDs of r fit
+// in struct PackedTokenInfo.
+void checkPackedIds(const IdResolver& r) {
+  const size_t limit = UINT16_MAX + 1;
+  if (r.getTagsCount() > limit || r.getNamesCount() > limit ||
+      r.getLabelsCount() > limit) {
+    throw std::out_of_range("Too many IDs in the dictionary for packing");
+  }
+}
+
+// InternTable assigns IDs to keys in the order they come, up to
+// a limit. Keys are spread over shards by hash, each with its own
+// mutex, and published in a directory of fixed-size chunks, so that
+// resolving IDs takes no locks. Keys are never removed.
+template<typename K, typename Hash = std::hash<K> >
+class InternTable {
+ public:
+  explicit InternTable(uint64_t limit) : limit(limit), count(0) {}
+
+  // Stores the ID of k in *id, adding k first if needed. Returns
+  // false if k is new and the table is full.
+  bool intern(const K& k, uint32_t* id) {
+    Shard& shard = shards[Hash()(k) % shardsCount];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    typename std::unordered_map<K, uint32_t, Hash>::const_iterator found =
+        shard.ids.find(k);
+    if (found == shard.ids.end()) {
+      uint64_t next = count.load();
+      do {
+        if (next >= limit.load(std::memory_order_relaxed)) {
+          return false;
+        }
+      } while (!count.compare_exchange_weak(next, next + 1));
+      found = shard.ids.insert(std::make_pair(k, next)).first;
+      chunk(next)[next & (chunkSize - 1)].store(
+          &found->first, std::memory_order_release);
+    }
+    *id = found->second;
+    return true;
+  }
+
+  // Stores the ID of k in *id without adding k. Returns false if k
+  // has not been added.
+  bool find(const K& k, uint32_t* id) {
+    Shard& shard = shards[Hash()(k) % shardsCount];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    typename std::unordered_map<K, uint32_t, Hash>::const_iterator found =
+        shard.ids.find(k);
+    if (found == shard.ids.end()) {
+      return false;
+    }
+    *id = found->second;
+    return true;
+  }
+
+  // Tells whether no more keys can be added.
+  bool full() const {
+    return count.load() >= limit.load(std::memory_order_relaxed);
+  }
+
+  // Returns the key with id, or NULL if no key has it.
+  const K* resolve(uint32_t id) const {
+    const Slot* c = directory[id >> chunkBits].load(std::memory_order_acquire);
+    if (c == NULL) {
+      return NULL;
+    }
+    return c[id & (chunkSize - 1)].load(std::memory_order_acquire);
+  }
+
+  uint64_t size() const {
+    return count.load(std::memory_order_relaxed);
+  }
+
+  void setLimit(uint64_t l) {
+    limit = l;
+  }
+
+  // Takes and releases the locks of all shards, around fork().
+  void lockShards() {
+    for (size_t i = 0; i < shardsCount; ++i) {
+      shards[i].mutex.lock();
+    }
+  }
+
+  void unlockShards() {
+    for (size_t i = 0; i < shardsCount; ++i) {
+      shards[i].mutex.unlock();
+    }
+  }
+
+ private:
+  typedef std::atomic<const K*> Slot;
+  static const uint32_t chunkBits = 16;
+  static const uint32_t chunkSize = 1 << chunkBits;
+  static const size_t shardsCount = 64;
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<K, uint32_t, Hash> ids;
+  };
+
+  // Returns the chunk holding the key with id, allocating it if needed.
+  Slot* chunk(uint32_t id) {
+    std::atomic<Slot*>& entry = directory[id >> chunkBits];
+    Slot* c = entry.load(std::memory_order_acquire);
+    if (c == NULL) {
+      Slot* fresh = new Slot[chunkSize]();
+      if (entry.compare_exchange_strong(c, fresh)) {
+        c = fresh;
+      } else {
+        delete[] fresh;
+      }
+    }
+    return c;
+  }
+
+  std::atomic<uint64_t> limit;
+  std::atomic<uint64_t> count;
+  Shard shards[shardsCount];
+  // Chunk i holds the keys with IDs from i << chunkBits on. Being
+  // static, the table starts with all of them NULL.
+  std::atomic<Slot*> directory[(UINT64_C(1) << 32) >> chunkBits];
+};
+
+const uint64_t defaultInternedLimit = 1 << 24;
+
+// The process-wide table of interned orths and lemmas.
+InternTable<std::string> internedStrings(defaultInternedLimit);
+
+// Returns the ID of s, interning it first if needed.
+uint32_t intern(const std::string& s) {
+  uint32_t id;
+  if (!internedStrings.intern(s, &id)) {
+    throw std::length_error("Too many interned strings");
+  }
+  return id;
+}
+
+// The lemma, as the ID of an interned string, and the tag, name and
+// labels of an interpretation, keyed by interpretationsTable.
+struct InterpretationKey {
+  uint32_t lemmaID;
+  int tagID;
+  int nameID;
+  int labelsID;
+
+  bool operator==(const InterpretationKey& k) const {
+    return lemmaID == k.lemmaID && tagID == k.tagID &&
+        nameID == k.nameID && labelsID == k.labelsID;
+  }
+};
+
+struct InterpretationKeyHash {
+  size_t operator()(const InterpretationKey& k) const {
+    uint64_t h = k.lemmaID;
+    h = h * 0x9e3779b97f4a7c15 + static_cast<uint32_t>(k.tagID);
+    h = h * 0x9e3779b97f4a7c15 + static_cast<uint32_t>(k.nameID);
+    h = h * 0x9e3779b97f4a7c15 + static_cast<uint32_t>(k.labelsID);
+    return h ^ (h >> 32);
+  }
+};
+
+const uint64_t defaultInterpretationsLimit = 1 << 22;
+const uint32_t interpretationsFileVersion = 1;
+
+InternTable<InterpretationKey, InterpretationKeyHash> interpretationsTable(
+    defaultInterpretationsLimit);
+
+// Returns the interpretation ID of m, or -1 if the table is full.
+// The lemma is not interned for an interpretation that gets no ID.
+int interpretationId(const MorphInterpretation& m) {
+  InterpretationKey k = { 0, m.tagId, m.nameId, m.labelsId };
+  uint32_t id;
+  if (interpretationsTable.full()) {
+    return internedStrings.find(m.lemma, &k.lemmaID) &&
+        interpretationsTable.find(k, &id) ? static_cast<int>(id) : -1;
+  }
+  k.lemmaID = intern(m.lemma);
+  return interpretationsTable.intern(k, &id) ? static_cast<int>(id) : -1;
+}
+
+// The pthread_atfork handlers, which take the process-wide locks before
+// fork() and release them after it in both processes, so that the child,
+// left with only the forking thread, does not inherit a lock held
+// by another thread forever.
+void lockGlobals() {
+  internedStrings.lockShards();
+  interpretationsTable.lockShards();
+  resultBytesMutex.lock();
+}
+
+void unlockGlobals() {
+  resultBytesMutex.unlock();
+  interpretationsTable.unlockShards();
+  internedStrings.unlockShards();
+}
+
+void registerForkHandlers() {
+  const int err = pthread_atfork(lockGlobals, unlockGlobals, unlockGlobals);
+  if (err != 0) {
+    errno = err;
+    throw systemError("pthread_atfork");
+  }
+}
+
+std::once_flag forkHandlersOnce;
+
+// Reads the file at path into *data. Returns false if there is
+// no such file.
+bool readFile(const std::string& path, std::string* data) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (f == NULL) {
+    if (errno == ENOENT) {
+      return false;
+    }
+    throw systemError(path);
+  }
+  char buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof buffer, f)) != 0) {
+    data->append(buffer, n);
+  }
+  const bool failed = ferror(f);
+  fclose(f);
+  if (failed) {
+    throw systemError(path);
+  }
+  return true;
+}
+
+// Replaces the file at path with n bytes at p, which are written
+// to a temporary file first, so that readers never see a partial file.
+void writeFile(const std::string& path, const char* p, size_t n) {
+  const std::string tmp = path + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  bool ok = f != NULL && fwrite(p, 1, n, f) == n;
+  if (f != NULL) {
+    ok = fclose(f) == 0 && ok;
+  }
+  if (!ok) {
+    throw systemError(tmp);
+  }
+  if (rename(tmp.c_str(), path.c_str()) != 0) {
+    throw systemError(path);
+  }
+}
+
+// Writes the interpretations with IDs 0 to n - 1, where n is the size
+// of the table when it starts, to path.
+// Writes the tagset ID first, so that the IDs of tags, names and labels
+// are only read back with the same tagset.
+void writeInterpretations(
+    const std::string& tagsetId, const std::string& path) {
+  ByteWriter w;
+  w.appendVarint(interpretationsFileVersion);
+  w.appendVarint(tagsetId.size());
+  w.append(tagsetId);
+  const uint64_t n = interpretationsTable.size();
+  uint32_t id = 0;
+  for (; id < n; ++id) {
+    const InterpretationKey* k = interpretationsTable.resolve(id);
+    if (k == NULL) {
+      // Being interned right now.
+      break;
+    }
+    const std::string* lemma = internedStrings.resolve(k->lemmaID);
+    w.appendVarint(lemma->size());
+    w.append(*lemma);
+    w.appendVarint(k->tagID);
+    w.appendVarint(k->nameID);
+    w.appendVarint(k->labelsID);
+  }
+  const struct String data = w.release();
+  try {
+    writeFile(path, data.p, data.n);
+  } catch (const std::exception&) {
+    deallocate(data.p);
+    throw;
+  }
+  deallocate(data.p);
+}
+
+// Fills the empty table of interpretations from a file written
+// by writeInterpretations with the same tagset ID.
+void readInterpretations(
+    const std::string& tagsetId, const std::string& path) {
+  if (interpretationsTable.size() != 0) {
+    throw std::logic_error("Table of interpretations not empty");
+  }
+  std::string data;
+  if (!readFile(path, &data)) {
+    throw systemError(path);
+  }
+  ByteReader r(data.data(), data.size(), "Malformed interpretations file");
+  if (r.readVarint() != interpretationsFileVersion) {
+    throw std::runtime_error("Unsupported interpretations file version");
+  }
+  if (r.readString() != tagsetId) {
+    throw std::runtime_error("Interpretations saved with another tagset");
+  }
+  for (uint32_t expected = 0; !r.atEnd(); ++expected) {
+    const std::string lemma = r.readString();
+    const InterpretationKey k = {
+      intern(lemma), static_cast<int>(r.readVarint()),
+      static_cast<int>(r.readVarint()), static_cast<int>(r.readVarint()),
+    };
+    uint32_t id;
+    if (!interpretationsTable.intern(k, &id)) {
+      throw std::length_error("Too many interpretations in file");
+    }
+    if (id != expected) {
+      throw std::logic_error(
+          "Table of interpretations modified while loading");
+    }
+  }
+}
+
+// The file of an analysis cache starts with a struct
+// AnalysisCacheHeader, followed by bucketsLength offsets of entries
+// from the start of the file, 0 for an empty bucket, and the entries.
+// An entry is a struct AnalysisCacheEntry followed by the analysed
+// text, tokensLength structs PackedTokenInfo and stringsLength bytes
+// of the strings they refer to; the text and the strings are padded
+// to a multiple of 8 bytes. The log of an analysis cache is a sequence
+// of entries. Both are in the byte order of the machine that wrote them.
+const char analysisCacheMagic[8] = {
+    'M', 'O', 'R', 'F', 'C', 'A', 'C', 'H',
+};
+const uint32_t analysisCacheVersion = 1;
+
+struct AnalysisCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t bucketsLength;
+  uint64_t entriesLength;
+};
+
+struct AnalysisCacheEntry {
+  uint64_t fingerprint;
+  uint32_t textLength;
+  uint32_t tokensLength;
+  uint32_t stringsLength;
+  uint32_t reserved;
+};
+
+size_t padTo8(size_t n) {
+  return (n + 7) & ~static_cast<size_t>(7);
+}
+
+size_t entrySize(const struct AnalysisCacheEntry& e) {
+  return sizeof e + padTo8(e.textLength) +
+      e.tokensLength * sizeof(struct PackedTokenInfo) +
+      padTo8(e.stringsLength);
+}
+
+const uint64_t fnv1aBasis = UINT64_C(0xcbf29ce484222325);
+
+// Returns the FNV-1a hash of n bytes at p, continuing from h.
+uint64_t fnv1a(const void* p, size_t n, uint64_t h) {
+  const unsigned char* c = static_cast<const unsigned char*>(p);
+  for (size_t i = 0; i < n; ++i) {
+    h = (h ^ c[i]) * UINT64_C(0x100000001b3);
+  }
+  return h;
+}
+
+uint64_t analysisCacheKey(uint64_t fingerprint, const char* text, size_t n) {
+  return fnv1a(text, n, fnv1a(&fingerprint, sizeof fingerprint, fnv1aBasis));
+}
+
+// Returns a hash of everything besides the text that the results
+// of m->analyse() depend on, given separate token numbering.
+uint64_t settingsFingerprint(const Morfeusz* m) {
+  std::string s = Morfeusz::getVersion();
+  s.push_back('\0');
+  s.append(m->getDictID()).push_back('\0');
+  s.append(m->getIdResolver().getTagsetId()).push_back('\0');
+  s.append(m->getAggl()).push_back('\0');
+  s.append(m->getPraet()).push_back('\0');
+  s.push_back(static_cast<char>(m->getCharset()));
+  s.push_back(static_cast<char>(m->getCaseHandling()));
+  s.push_back(static_cast<char>(m->getWhitespaceHandling()));
+  return fnv1a(s.data(), s.size(), fnv1aBasis);
+}
+
+// Appends to out the entry for text analysed into vec. Throws
+// std::exception when vec does not fit in structs PackedTokenInfo.
+void appendAnalysisCacheEntry(
+    uint64_t fingerprint, const std::string& text,
+    const std::vector<MorphInterpretation>& vec, std::string* out) {
+  if (text.size() > UINT32_MAX || vec.size() > UINT32_MAX) {
+    throw std::length_error("Text too long for the analysis cache");
+  }
+  struct AnalysisCacheEntry e = {};
+  e.fingerprint = fingerprint;
+  e.textLength = text.size();
+  e.tokensLength = vec.size();
+  e.stringsLength = packTokenInfos(vec, 0, NULL, NULL, 0);
+  const size_t start = out->size();
+  out->resize(start + entrySize(e));
+  char* p = &(*out)[start];
+  memcpy(p, &e, sizeof e);
+  p += sizeof e;
+  memcpy(p, text.data(), text.size());
+  p += padTo8(text.size());
+  struct PackedTokenInfo* tokens =
+      reinterpret_cast<struct PackedTokenInfo*>(p);
+  packTokenInfos(vec, 0, tokens, p + vec.size() * sizeof *tokens, 0);
+}
+
+// Returns the entry at offset in the n bytes at p, or NULL
+// if it does not fit there.
+const struct AnalysisCacheEntry* analysisCacheEntry(
+    const char* p, size_t n, uint64_t offset) {
+  if (offset % 8 != 0 || offset > n ||
+      n - offset < sizeof(struct AnalysisCacheEntry)) {
+    return NULL;
+  }
+  const struct AnalysisCacheEntry* e =
+      reinterpret_cast<const struct AnalysisCacheEntry*>(p + offset);
+  return n - offset < entrySize(*e) ? NULL : e;
+}
+
+// Returns the fingerprint and the text of e, which identify it.
+std::string analysisCacheEntryId(const struct AnalysisCacheEntry* e) {
+  std::string ret(reinterpret_cast<const char*>(&e->fingerprint),
+                  sizeof e->fingerprint);
+  ret.append(reinterpret_cast<const char*>(e + 1), e->textLength);
+  return ret;
+}
+
+// Returns the header of the n bytes of an analysis cache at p,
+// or throws std::exception if they are not one.
+const struct AnalysisCacheHeader* analysisCacheHeader(
+    const char* p, size_t n, const std::string& path) {
+  const struct AnalysisCacheHeader* h =
+      reinterpret_cast<const struct AnalysisCacheHeader*>(p);
+  if (n < sizeof *h ||
+      memcmp(h->magic, analysisCacheMagic, sizeof h->magic) != 0 ||
+      h->version != analysisCacheVersion ||
+      (h->bucketsLength & (h->bucketsLength - 1)) != 0 ||
+      (n - sizeof *h) / sizeof(uint64_t) < h->bucketsLength) {
+    throw std::runtime_error("Not an analysis cache: " + path);
+  }
+  return h;
+}
+
+// Unpacks into vec the interpretations of entry e, whose tokens
+// start at p.
+void unpackAnalysisCacheEntry(
+    const struct AnalysisCacheEntry& e, const char* p,
+    std::vector<MorphInterpretation>* vec) {
+  const struct PackedTokenInfo* tokens =
+      reinterpret_cast<const struct PackedTokenInfo*>(p);
+  const char* strings = p + e.tokensLength * sizeof *tokens;
+  vec->resize(e.tokensLength);
+  for (uint32_t i = 0; i < e.tokensLength; ++i) {
+    const struct PackedTokenInfo& t = tokens[i];
+    if (static_cast<uint64_t>(t.orthOffset) + t.orthLength >
+            e.stringsLength ||
+        static_cast<uint64_t>(t.lemmaOffset) + t.lemmaLength >
+            e.stringsLength) {
+      vec->clear();
+      throw std::runtime_error("Corrupt analysis cache");
+    }
+    MorphInterpretation& m = (*vec)[i];
+    m.startNode = t.startNode;
+    m.endNode = t.endNode;
+    m.orth.assign(strings + t.orthOffset, t.orthLength);
+    m.lemma.assign(strings + t.lemmaOffset, t.lemmaLength);
+    m.tagId = t.tagID;
+    m.nameId = t.nameID;
+    m.labelsId = t.labelsID;
+  }
+}
+
+// Stores in the empty vec the interpretations of the entry at offset
+// in file if it holds text analysed with settings fingerprint.
+bool unpackMatchingEntry(
+    const char* file, size_t size, uint64_t offset, uint64_t fingerprint,
+    const std::string& text, std::vector<MorphInterpretation>* vec) {
+  const struct AnalysisCacheEntry* e =
+      analysisCacheEntry(file, size, offset);
+  if (e == NULL) {
+    throw std::runtime_error("Corrupt analysis cache");
+  }
+  const char* p = reinterpret_cast<const char*>(e + 1);
+  if (e->fingerprint != fingerprint || e->textLength != text.size() ||
+      memcmp(p, text.data(), text.size()) != 0) {
+    return false;
+  }
+  unpackAnalysisCacheEntry(*e, p + padTo8(e->textLength), vec);
+  return true;
+}
+
+// MappedFile maps a whole file into memory, read-only.
+class MappedFile {
+ public:
+  // Maps the file at path, or nothing if there is no such file
+  // and mustExist is false.
+  MappedFile(const std::string& path, bool mustExist) : p(NULL), n(0) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      if (errno == ENOENT && !mustExist) {
+        return;
+      }
+      throw systemError(path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      const std::runtime_error e = systemError(path);
+      close(fd);
+      throw e;
+    }
+    n = st.st_size;
+    if (n != 0) {
+      void* q = mmap(NULL, n, PROT_READ, MAP_SHARED, fd, 0);
+      if (q == MAP_FAILED) {
+        const std::runtime_error e = systemError("mmap");
+        close(fd);
+        throw e;
+      }
+      p = static_cast<const char*>(q);
+    }
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (p != NULL) {
+      munmap(const_cast<char*>(p), n);
+    }
+  }
+
+  const char* data() const {
+    return p;
+  }
+
+  size_t size() const {
+    return n;
+  }
+
+ private:
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  const char* p;
+  size_t n;
+};
+
+// AnalysisCache serves the results of analysis from the hash table
+// in a cache file mapped into memory, shared by all the processes
+// that use it, and appends the results missing from it to the log
+// at path + ".log". compactAnalysisCache merges the log into the table.
+class AnalysisCache {
+ public:
+  explicit AnalysisCache(const std::string& path)
+      : file(path, false), header(NULL), buckets(NULL), bucketsLength(0),
+        log(-1), hits(0), misses(0) {
+    if (file.data() != NULL) {
+      header = analysisCacheHeader(file.data(), file.size(), path);
+      buckets = reinterpret_cast<const uint64_t*>(header + 1);
+      bucketsLength = header->bucketsLength;
+    }
+    const std::string logPath = path + ".log";
+    log = open(logPath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+               0666);
+    if (log < 0) {
+      throw systemError(logPath);
+    }
+  }
+
+  ~AnalysisCache() {
+    close(log);
+  }
+
+  // Stores in the empty vec the interpretations of text analysed
+  // with settings fingerprint. Returns false when the table lacks them.
+  bool find(uint64_t fingerprint, const std::string& text,
+            std::vector<MorphInterpretation>* vec) {
+    const uint64_t key =
+        analysisCacheKey(fingerprint, text.data(), text.size());
+    for (uint64_t i = 0; i < bucketsLength; ++i) {
+      const uint64_t offset = buckets[(key + i) & (bucketsLength - 1)];
+      if (offset == 0) {
+        break;
+      }
+      if (unpackMatchingEntry(file.data(), file.size(), offset,
+                              fingerprint, text, vec)) {
+        ++hits;
+        return true;
+      }
+    }
+    ++misses;
+    return false;
+  }
+
+  // Appends the entry for text analysed with settings fingerprint
+  // into vec to the log, usually once per process: the keys of
+  // the logged entries are remembered up to a limit, then forgotten,
+  // and compaction drops the duplicates. Results that do not fit
+  // in structs PackedTokenInfo are not cached.
+  void record(uint64_t fingerprint, const std::string& text,
+              const std::vector<MorphInterpretation>& vec) {
+    const uint64_t key =
+        analysisCacheKey(fingerprint, text.data(), text.size());
+    {
+      std::lock_guard<std::mutex> lock(loggedMutex);
+      if (logged.size() >= loggedLimit) {
+        logged.clear();
+      }
+      // A text whose key collides with a logged one is not logged,
+      // and only stays a miss.
+      if (!logged.insert(key).second) {
+        return;
+      }
+    }
+    std::string entry;
+    try {
+      appendAnalysisCacheEntry(fingerprint, text, vec, &entry);
+    } catch (const std::exception&) {
+      return;
+    }
+    // With O_APPEND, a single write keeps the entries written
+    // by several processes apart. A failed write only loses the entry.
+    if (write(log, entry.data(), entry.size()) < 0) {
+      return;
+    }
+  }
+
+  // Takes and releases the lock of record, around fork().
+  void lock() {
+    loggedMutex.lock();
+  }
+
+  void unlock() {
+    loggedMutex.unlock();
+  }
+
+  const struct AnalysisCacheStats stats() const {
+    const struct AnalysisCacheStats ret = {
+      header == NULL ? 0 : static_cast<int64_t>(header->entriesLength),
+      hits.load(), misses.load(),
+    };
+    return ret;
+  }
+
+ private:
+  const MappedFile file;
+  const struct AnalysisCacheHeader* header;
+  const uint64_t* buckets;
+  uint64_t bucketsLength;
+  int log;
+  std::atomic<int64_t> hits;
+  std::atomic<int64_t> misses;
+  static const size_t loggedLimit = 1 << 18;
+  std::mutex loggedMutex;
+  // The keys of the entries logged by this process.
+  std::unordered_set<uint64_t> logged;
+};
+
+// A form table holds the precomputed analyses of a fixed set of texts,
+// usually the most frequent word forms, under a perfect hash function.
+// Its file starts with a struct FormTableHeader followed by the ID
+// of the dictionary it was built with, padded to a multiple of 8 bytes,
+// seedsLength seeds, also padded, slotsLength offsets of entries from
+// the start of the file, 0 for an empty slot, and the entries, laid out
+// like in an analysis cache. A text with formHash(text, 0) = h is
+// in slot formHash(text, seeds[h % seedsLength]) % slotsLength,
+// if anywhere.
+const char formTableMagic[8] = {
+    'M', 'O', 'R', 'F', 'F', 'O', 'R', 'M',
+};
+const uint32_t formTableVersion = 1;
+
+struct FormTableHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t dictIdLength;
+  uint64_t fingerprint;
+  uint32_t formsLength;
+  uint32_t seedsLength;
+  uint32_t slotsLength;
+  uint32_t reserved;
+};
+
+uint64_t formHash(const char* text, size_t n, uint32_t seed) {
+  return fnv1a(text, n, fnv1a(&seed, sizeof seed, fnv1aBasis));
+}
+
+// FormTable serves the analyses in a form table mapped into memory.
+class FormTable {
+ public:
+  explicit FormTable(const std::string& path)
+      : file(path, true), hits(0), misses(0) {
+    const char* p = file.data();
+    const size_t n = file.size();
+    header = reinterpret_cast<const struct FormTableHeader*>(p);
+    if (n < sizeof *header ||
+        memcmp(header->magic, formTableMagic, sizeof header->magic) != 0 ||
+        header->version != formTableVersion ||
+        header->seedsLength == 0 || header->slotsLength == 0 ||
+        (n - sizeof *header) / 8 <
+            padTo8(header->dictIdLength) / 8 +
+            padTo8(header->seedsLength * sizeof(uint32_t)) / 8 +
+            header->slotsLength) {
+      throw std::runtime_error("Not a form table: " + path);
+    }
+    p += sizeof *header;
+    dictId.assign(p, header->dictIdLength);
+    p += padTo8(header->dictIdLength);
+    seeds = reinterpret_cast<const uint32_t*>(p);
+    p += padTo8(header->seedsLength * sizeof(uint32_t));
+    slots = reinterpret_cast<const uint64_t*>(p);
+  }
+
+  // Throws std::exception unless the table was built by an instance
+  // of Morfeusz with the dictionary and settings of m.
+  void check(const Morfeusz* m) const {
+    if (dictId != m->getDictID()) {
+      throw std::invalid_argument(
+          "Form table built for dictionary " + dictId);
+    }
+    if (header->fingerprint != settingsFingerprint(m)) {
+      throw std::invalid_argument("Form table built with other settings");
+    }
+  }
+
+  // Stores in the empty vec the interpretations of text analysed
+  // with settings fingerprint. Returns false when the table lacks them.
+  // When the settings skip whitespace, Morfeusz analyses the words
+  // of text delimited by ASCII whitespace independently, so they are
+  // looked up one by one, like in a Vocabulary, with their nodes
+  // shifted to follow the previous word. Then the table lacks text
+  // if it lacks any of its words.
+  bool find(uint64_t fingerprint, bool skipWhitespace,
+            const std::string& text, std::vector<MorphInterpretation>* vec) {
+    const bool found = fingerprint == header->fingerprint &&
+        (skipWhitespace ? findWords(text, vec) : findForm(text, vec));
+    ++(found ? hits : misses);
+    return found;
+  }
+
+  int size() const {
+    return header->formsLength;
+  }
+
+  const struct FormTableStats stats() const {
+    const struct FormTableStats ret = { hits.load(), misses.load() };
+    return ret;
+  }
+
+ private:
+  bool findForm(const std::string& form,
+                std::vector<MorphInterpretation>* vec) const {
+    const uint32_t seed =
+        seeds[formHash(form.data(), form.size(), 0) % header->seedsLength];
+    const uint64_t offset = slots[
+        formHash(form.data(), form.size(), seed) % header->slotsLength];
+    return offset != 0 && unpackMatchingEntry(
+        file.data(), file.size(), offset, header->fingerprint, form, vec);
+  }
+
+  bool findWords(const std::string& text,
+                 std::vector<MorphInterpretation>* vec) const {
+    std::vector<MorphInterpretation> word;
+    std::string w;
+    int offset = 0;
+    for (std::string::const_iterator it = text.begin(); it != text.end();) {
+      if (isAsciiSpace(*it)) {
+        ++it;
+        continue;
+      }
+      const std::string::const_iterator start = it;
+      while (it != text.end() && !isAsciiSpace(*it)) {
+        ++it;
+      }
+      w.assign(start, it);
+      word.clear();
+      if (!findForm(w, &word)) {
+        vec->clear();
+        return false;
+      }
+      int end = offset;
+      for (size_t j = 0; j < word.size(); ++j) {
+        word[j].startNode += offset;
+        word[j].endNode += offset;
+        end = std::max(end, word[j].endNode);
+      }
+      offset = end;
+      vec->insert(vec->end(), std::make_move_iterator(word.begin()),
+                  std::make_move_iterator(word.end()));
+    }
+    return true;
+  }
+
+  const MappedFile file;
+  const struct FormTableHeader* header;
+  std::string dictId;
+  const uint32_t* seeds;
+  const uint64_t* slots;
+  std::atomic<int64_t> hits;
+  std::atomic<int64_t> misses;
+};
+
+// Analyses the distinct texts among forms with clones of m
+// on threads threads and stores their entries in order in entries.
+// Throws std::exception unless m numbers nodes separately: clones
+// share token numbering, so it cannot be set on them alone.
+void analyseForms(const Morfeusz* m, const std::vector<std::string>& forms,
+                  int threads, std::vector<std::string>* entries) {
+  if (m->getTokenNumbering() != morfeusz::TokenNumbering::SEPARATE_NUMBERING) {
+    throw std::invalid_argument(
+        "Form tables and vocabularies need separate numbering");
+  }
+  entries->assign(forms.size(), std::string());
+  std::vector<Morfeusz*> clones;
+  std::atomic<size_t> next(0);
+  std::mutex errorMutex;
+  std::string error;
+  const uint64_t fingerprint = settingsFingerprint(m);
+  std::vector<std::thread> workers;
+  clones.reserve(threads);
+  try {
+    for (int i = 0; i < threads; ++i) {
+      clones.push_back(m->clone());
+    }
+    for (int i = 0; i < threads; ++i) {
+      const Morfeusz* c = clones[i];
+      workers.push_back(std::thread([&, c]() {
+        std::vector<MorphInterpretation> vec;
+        for (size_t j; (j = next++) < forms.size();) {
+          try {
+            vec.clear();
+            c->analyse(forms[j], vec);
+            appendAnalysisCacheEntry(
+                fingerprint, forms[j], vec, &(*entries)[j]);
+          } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            error = forms[j] + ": " + e.what();
+            next = forms.size();
+          }
+        }
+      }));
+    }
+  } catch (const std::exception& e) {
+    error = e.what();
+    next = forms.size();
+  }
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i].join();
+  }
+  for (size_t i = 0; i < clones.size(); ++i) {
+    delete clones[i];
+  }
+  if (!error.empty()) {
+    throw std::runtime_error(error);
+  }
+}
+
+// Chooses the seeds of a perfect hash function for forms, placing
+// the forms with the same seed index in order of decreasing count,
+// and stores the slot of every form in formSlots.
+void chooseSeeds(const std::vector<std::string>& forms, uint32_t slotsLength,
+                 std::vector<uint32_t>* seeds,
+                 std::vector<uint32_t>* formSlots) {
+  std::vector<std::vector<size_t> > buckets(seeds->size());
+  for (size_t i = 0; i < forms.size(); ++i) {
+    buckets[formHash(forms[i].data(), forms[i].size(), 0) %
+            seeds->size()].push_back(i);
+  }
+  std::vector<size_t> order(buckets.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&buckets](size_t a, size_t b) {
+                     return buckets[a].size() > buckets[b].size();
+                   });
+  std::vector<bool> taken(slotsLength);
+  std::vector<uint32_t> slots;
+  formSlots->assign(forms.size(), 0);
+  for (size_t i = 0; i < order.size(); ++i) {
+    const size_t b = order[i];
+    const std::vector<size_t>& bucket = buckets[b];
+    if (bucket.empty()) {
+      break;
+    }
+    for (uint32_t seed = 1;; ++seed) {
+      if (seed == 0) {
+        throw std::runtime_error("No perfect hash function for the forms");
+      }
+      slots.clear();
+      bool fits = true;
+      for (size_t k = 0; k < bucket.size() && fits; ++k) {
+        const std::string& f = forms[bucket[k]];
+        const uint32_t slot =
+            formHash(f.data(), f.size(), seed) % slotsLength;
+        fits = !taken[slot] &&
+            std::find(slots.begin(), slots.end(), slot) == slots.end();
+        slots.push_back(slot);
+      }
+      if (fits) {
+        (*seeds)[b] = seed;
+        for (size_t k = 0; k < bucket.size(); ++k) {
+          taken[slots[k]] = true;
+          (*formSlots)[bucket[k]] = slots[k];
+        }
+        break;
+      }
+    }
+  }
+}
+
+// Writes to path the form table with the analyses of the distinct
+// texts among forms made by m, on threads threads.
+void writeFormTable(const Morfeusz* m, std::vector<std::string> forms,
+                    int threads, const std::string& path) {
+  std::sort(forms.begin(), forms.end());
+  forms.erase(std::unique(forms.begin(), forms.end()), forms.end());
+  if (forms.size() > UINT32_MAX / 2) {
+    throw std::length_error("Too many forms");
+  }
+  std::vector<std::string> entries;
+  analyseForms(m, forms, std::max(threads, 1), &entries);
+
+  // Four forms per seed on average and a load factor of 0.8 make
+  // the seeds quick to find.
+  struct FormTableHeader h = {};
+  memcpy(h.magic, formTableMagic, sizeof h.magic);
+  h.version = formTableVersion;
+  const std::string dictId = m->getDictID();
+  h.dictIdLength = dictId.size();
+  h.fingerprint = settingsFingerprint(m);
+  h.formsLength = forms.size();
+  h.seedsLength = forms.size() / 4 + 1;
+  h.slotsLength = forms.size() + forms.size() / 4 + 1;
+  std::vector<uint32_t> seeds(h.seedsLength);
+  std::vector<uint32_t> formSlots;
+  chooseSeeds(forms, h.slotsLength, &seeds, &formSlots);
+
+  std::string out(reinterpret_cast<const char*>(&h), sizeof h);
+  out.append(dictId).resize(padTo8(out.size()));
+  out.append(reinterpret_cast<const char*>(seeds.data()),
+             seeds.size() * sizeof(uint32_t)).resize(padTo8(out.size()));
+  const size_t slotsStart = out.size();
+  std::vector<uint64_t> slots(h.slotsLength);
+  out.resize(slotsStart + slots.size() * sizeof(uint64_t));
+  for (size_t i = 0; i < forms.size(); ++i) {
+    slots[formSlots[i]] = out.size();
+    out.append(entries[i]);
+  }
+  memcpy(&out[slotsStart], slots.data(), slots.size() * sizeof(uint64_t));
+  writeFile(path, out.data(), out.size());
+}
+
+// Vocabulary holds the analyses of the distinct whitespace-delimited
+// words of a corpus, made once each. Since Morfeusz analyses such
+// words independently when it skips whitespace, a text is analysed
+// by copying the analyses of its words one after another, with their
+// nodes shifted to follow the previous word.
+class Vocabulary {
+ public:
+  Vocabulary(const Morfeusz* m, std::vector<std::string> words, int threads)
+      : dictId(m->getDictID()), fingerprint(settingsFingerprint(m)) {
+    check(m);
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+    analyseForms(m, words, std::max(threads, 1), &entries);
+    index.reserve(words.size());
+    for (size_t i = 0; i < words.size(); ++i) {
+      index[words[i]] = i;
+    }
+  }
+
+  // Throws std::exception unless m has the dictionary and settings
+  // the vocabulary was made with, and they let it be used.
+  void check(const Morfeusz* m) const {
+    if (m->getWhitespaceHandling() !=
+            morfeusz::WhitespaceHandling::SKIP_WHITESPACES ||
+        m->getTokenNumbering() !=
+            morfeusz::TokenNumbering::SEPARATE_NUMBERING) {
+      throw std::invalid_argument(
+          "A vocabulary needs skipped whitespace and separate numbering");
+    }
+    if (dictId != m->getDictID()) {
+      throw std::invalid_argument("Vocabulary made for dictionary " + dictId);
+    }
+    if (fingerprint != settingsFingerprint(m)) {
+      throw std::invalid_argument("Vocabulary made with other settings");
+    }
+  }
+
+  // Stores in the empty vec the interpretations of text, copied
+  // from the vocabulary word by word. The words missing from it
+  // are analysed by m.
+  void analyse(const Morfeusz* m, const std::string& text,
+               std::vector<MorphInterpretation>* vec) const {
+    std::vector<MorphInterpretation> word;
+    std::string w;
+    int offset = 0;
+    for (std::string::const_iterator it = text.begin(); it != text.end();) {
+      if (isAsciiSpace(*it)) {
+        ++it;
+        continue;
+      }
+      const std::string::const_iterator start = it;
+      while (it != text.end() && !isAsciiSpace(*it)) {
+        ++it;
+      }
+      w.assign(start, it);
+      const std::unordered_map<std::string, size_t>::const_iterator i =
+          index.find(w);
+      word.clear();
+      if (i == index.end()) {
+        m->analyse(w, word);
+      } else {
+        const std::string& entry = entries[i->second];
+        const struct AnalysisCacheEntry* e =
+            reinterpret_cast<const struct AnalysisCacheEntry*>(entry.data());
+        unpackAnalysisCacheEntry(
+            *e, entry.data() + sizeof *e + padTo8(e->textLength), &word);
+      }
+      int end = offset;
+      for (size_t j = 0; j < word.size(); ++j) {
+        word[j].startNode += offset;
+        word[j].endNode += offset;
+        end = std::max(end, word[j].endNode);
+      }
+      offset = end;
+      vec->insert(vec->end(), std::make_move_iterator(word.begin()),
+                  std::make_move_iterator(word.end()));
+    }
+  }
+
+  int size() const {
+    return entries.size();
+  }
+
+ private:
+  const std::string dictId;
+  const uint64_t fingerprint;
+  // Analysis cache entries, in the order of the words.
+  std::vector<std::string> entries;
+  std::unordered_map<std::string, size_t> index;
+};
+
+Vocabulary* vcast(const Vocab v) {
+  return static_cast<Vocabulary*>(v);
+}
+
+// FrequencySketch estimates how many times keys have been seen
+// recently with a count-min sketch of 4-bit counters, packed two
+// per byte. The counters are halved after every sampleSize additions,
+// so that the estimates follow changes in frequency.
+class FrequencySketch {
+ public:
+  // width has to be a power of 2 greater than 1.
+  FrequencySketch(size_t width, size_t sampleSize)
+      : counters(depth * width / 2), mask(width - 1), additions(0),
+        sampleSize(sampleSize) {
+  }
+
+  void add(uint64_t key) {
+    for (int i = 0; i < depth; ++i) {
+      const size_t j = index(key, i);
+      if (counter(j) < 15) {
+        counters[j / 2] += 1 << (j % 2 * 4);
+      }
+    }
+    if (++additions == sampleSize) {
+      for (size_t i = 0; i < counters.size(); ++i) {
+        counters[i] = counters[i] >> 1 & 0x77;
+      }
+      additions /= 2;
+    }
+  }
+
+  int estimate(uint64_t key) const {
+    int ret = 15;
+    for (int i = 0; i < depth; ++i) {
+      ret = std::min(ret, counter(index(key, i)));
+    }
+    return ret;
+  }
+
+  size_t size() const {
+    return counters.size();
+  }
+
+ private:
+  static const int depth = 4;
+
+  size_t index(uint64_t key, int row) const {
+    static const uint64_t seeds[depth] = {
+        UINT64_C(0x9e3779b97f4a7c15), UINT64_C(0xc2b2ae3d27d4eb4f),
+        UINT64_C(0x165667b19e3779f9), UINT64_C(0xd6e8feb86659fd93),
+    };
+    return row * (mask + 1) + ((key * seeds[row]) >> 32 & mask);
+  }
+
+  int counter(size_t i) const {
+    return counters[i / 2] >> (i % 2 * 4) & 15;
+  }
+
+  std::vector<uint8_t> counters;
+  const size_t mask;
+  size_t additions;
+  const size_t sampleSize;
+};
+
+// SentenceCache keeps in memory the analyses of the texts looked up
+// most often, in entries laid out like in an analysis cache, within
+// a memory budget. A text missing from a full cache is admitted only
+// if it has been looked up more often than the least recently used
+// texts it would evict, as estimated by a FrequencySketch (TinyLFU),
+// so texts seen once do not push frequent ones out.
+class SentenceCache {
+ public:
+  explicit SentenceCache(int64_t budget)
+      : hits(0), misses(0), rejected(0) {
+    for (int i = 0; i < shardsLength; ++i) {
+      shards[i].reset(new Shard(std::max<int64_t>(budget, 0) / shardsLength));
+    }
+  }
+
+  // Stores in the empty vec the interpretations of text analysed
+  // with settings fingerprint. Returns false when the cache lacks them.
+  bool find(uint64_t fingerprint, const std::string& text,
+            std::vector<MorphInterpretation>* vec) {
+    const uint64_t key =
+        analysisCacheKey(fingerprint, text.data(), text.size());
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.sketch.add(key);
+    const std::unordered_map<uint64_t, Entries::iterator>::const_iterator it =
+        s.index.find(key);
+    if (it == s.index.end() ||
+        !unpackMatchingEntry(it->second->second.data(),
+                             it->second->second.size(), 0, fingerprint,
+                             text, vec)) {
+      ++misses;
+      return false;
+    }
+    s.entries.splice(s.entries.begin(), s.entries, it->second);
+    ++hits;
+    return true;
+  }
+
+  // Stores the entry for text analysed with settings fingerprint
+  // into vec if it is admitted. Results that do not fit in structs
+  // PackedTokenInfo are not cached. Most texts are rejected before
+  // their entries are built: when the shard has no room even for
+  // the text alone, the least recently used entry, which would be
+  // evicted first, has to lose to it.
+  void record(uint64_t fingerprint, const std::string& text,
+              const std::vector<MorphInterpretation>& vec) {
+    const uint64_t key =
+        analysisCacheKey(fingerprint, text.data(), text.size());
+    Shard& s = shard(key);
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (s.index.count(key) != 0) {
+        return;
+      }
+      const int64_t minSize =
+          sizeof(struct AnalysisCacheEntry) + text.size() + entryOverhead;
+      if (s.bytes + minSize > s.budget && !s.entries.empty() &&
+          s.sketch.estimate(s.entries.back().first) >=
+              s.sketch.estimate(key)) {
+        ++rejected;
+        return;
+      }
+    }
+    std::string entry;
+    try {
+      appendAnalysisCacheEntry(fingerprint, text, vec, &entry);
+    } catch (const std::exception&) {
+      return;
+    }
+    const int64_t size = entry.size() + entryOverhead;
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (size > s.budget || s.index.count(key) != 0) {
+      return;
+    }
+    // Evict nothing unless the text wins against every victim.
+    const int frequency = s.sketch.estimate(key);
+    int64_t freed = 0;
+    for (Entries::reverse_iterator it = s.entries.rbegin();
+         s.bytes - freed + size > s.budget; ++it) {
+      if (s.sketch.estimate(it->first) >= frequency) {
+        ++rejected;
+        return;
+      }
+      freed += it->second.size() + entryOverhead;
+    }
+    while (freed > 0) {
+      freed -= s.entries.back().second.size() + entryOverhead;
+      s.bytes -= s.entries.back().second.size() + entryOverhead;
+      s.index.erase(s.entries.back().first);
+      s.entries.pop_back();
+    }
+    s.entries.push_front(std::make_pair(key, std::string()));
+    s.entries.front().second.swap(entry);
+    s.index[key] = s.entries.begin();
+    s.bytes += size;
+  }
+
+  const struct SentenceCacheStats stats() {
+    struct SentenceCacheStats ret = {
+      0, 0, hits.load(), misses.load(), rejected.load(),
+    };
+    for (int i = 0; i < shardsLength; ++i) {
+      std::lock_guard<std::mutex> lock(shards[i]->mutex);
+      ret.entries += shards[i]->index.size();
+      ret.bytes += shards[i]->bytes;
+    }
+    return ret;
+  }
+
+  // Takes and releases the locks of all shards, around fork().
+  void lockShards() {
+    for (int i = 0; i < shardsLength; ++i) {
+      shards[i]->mutex.lock();
+    }
+  }
+
+  void unlockShards() {
+    for (int i = 0; i < shardsLength; ++i) {
+      shards[i]->mutex.unlock();
+    }
+  }
+
+ private:
+  static const int shardsLength = 16;
+  // The estimated memory taken by an entry besides its bytes.
+  static const int64_t entryOverhead = 96;
+
+  // The keys and entries of a shard, the most recently used first.
+  typedef std::list<std::pair<uint64_t, std::string> > Entries;
+
+  // Like in Caffeine, the sketch has four counters in a row for every
+  // entry that fits in the budget, assuming 256 bytes per entry,
+  // and is halved after ten additions per entry. Its memory counts
+  // against the budget.
+  struct Shard {
+    explicit Shard(int64_t budget)
+        : sketch(sketchWidth(budget), 10 * expectedEntries(budget)),
+          budget(budget - sketch.size()), bytes(0) {
+    }
+
+    static size_t expectedEntries(int64_t budget) {
+      return std::max<int64_t>(budget / 256, 16);
+    }
+
+    static size_t sketchWidth(int64_t budget) {
+      size_t ret = 2;
+      while (ret < 4 * expectedEntries(budget)) {
+        ret *= 2;
+      }
+      return ret;
+    }
+
+    std::mutex mutex;
+    FrequencySketch sketch;
+    const int64_t budget;
+    int64_t bytes;
+    Entries entries;
+    std::unordered_map<uint64_t, Entries::iterator> index;
+  };
+
+  // The high bits of FNV-1a barely change between texts that differ
+  // only at the end, so the key is mixed first.
+  Shard& shard(uint64_t key) {
+    return *shards[(key * UINT64_C(0x9e3779b97f4a7c15)) >> 60];
+  }
+
+  std::unique_ptr<Shard> shards[shardsLength];
+  std::atomic<int64_t> hits;
+  std::atomic<int64_t> misses;
+  std::atomic<int64_t> rejected;
 };
 
-const int invalidId = -1;
-const struct String emptyString = {};
-const Error noError = emptyString;
-const struct StringArray emptyStringArray = {};
-const struct TokenInfo emptyTokenInfo = {};
+std::shared_ptr<AnalysisCache>* ccast(const Cache c) {
+  return static_cast<std::shared_ptr<AnalysisCache>*>(c);
+}
+
+std::shared_ptr<FormTable>* fcast(const Forms f) {
+  return static_cast<std::shared_ptr<FormTable>*>(f);
+}
+
+std::shared_ptr<SentenceCache>* scast(const Sentences s) {
+  return static_cast<std::shared_ptr<SentenceCache>*>(s);
+}
+
+// Analyses text with m, which is the instance of Morfeusz behind
+// instance or one of its variants, into the empty vec. Looks text up
+// first in the form table t.forms of instance, then in its sentence
+// cache and then in its analysis cache, if it has them. With
+// continuous token numbering the results depend on the earlier calls,
+// so they bypass all three.
+void analyse(const LookupTables& t, Instance* instance, const Morfeusz* m,
+             const std::string& text, std::vector<MorphInterpretation>* vec) {
+  if (t.empty() ||
+      m->getTokenNumbering() ==
+          morfeusz::TokenNumbering::CONTINUOUS_NUMBERING) {
+    m->analyse(text, *vec);
+    return;
+  }
+  const uint64_t fingerprint = instance->fingerprint(m);
+  if (t.forms &&
+      t.forms->find(fingerprint,
+                    m->getWhitespaceHandling() ==
+                        morfeusz::WhitespaceHandling::SKIP_WHITESPACES,
+                    text, vec)) {
+    return;
+  }
+  if (t.sentences && t.sentences->find(fingerprint, text, vec)) {
+    return;
+  }
+  if (!t.cache) {
+    m->analyse(text, *vec);
+  } else if (!t.cache->find(fingerprint, text, vec)) {
+    m->analyse(text, *vec);
+    t.cache->record(fingerprint, text, *vec);
+  }
+  if (t.sentences) {
+    t.sentences->record(fingerprint, text, *vec);
+  }
+}
+
+void analyse(Instance* instance, const Morfeusz* m, const std::string& text,
+             std::vector<MorphInterpretation>* vec) {
+  analyse(instance->getLookupTables(), instance, m, text, vec);
+}
+
+void analyse(const Morf m, const std::string& text,
+             std::vector<MorphInterpretation>* vec) {
+  analyse(icast(m), cmcast(m), text, vec);
+}
+
+// Returns true if m has a form table, a sentence cache or an analysis
+// cache.
+bool hasLookupTables(const Morf m) {
+  return !icast(m)->getLookupTables().empty();
+}
+
+// Returns the results of analysis of text by m, which may come
+// from its form table, sentence cache or analysis cache.
+ResultsIterator* analyseResults(const Morf m, const std::string& text) {
+  const LookupTables t = icast(m)->getLookupTables();
+  if (t.empty()) {
+    return cmcast(m)->analyse(text);
+  }
+  std::unique_ptr<VectorResultsIterator> r(new VectorResultsIterator);
+  analyse(t, icast(m), cmcast(m), text, &r->interpretations);
+  return r.release();
+}
+
+// Adds the entries in data from offset on to entries, keyed by
+// analysisCacheEntryId, unless they are there already. Stops at
+// an entry cut short, which only a crashed writer leaves in a log.
+void collectAnalysisCacheEntries(
+    const std::string& data, size_t offset,
+    std::unordered_map<std::string, std::string>* entries) {
+  while (offset < data.size()) {
+    const struct AnalysisCacheEntry* e =
+        analysisCacheEntry(data.data(), data.size(), offset);
+    if (e == NULL) {
+      break;
+    }
+    const size_t n = entrySize(*e);
+    entries->insert(std::make_pair(
+        analysisCacheEntryId(e), data.substr(offset, n)));
+    offset += n;
+  }
+}
+
+// Merges the log of the analysis cache at path into a new table,
+// which replaces the old one, and empties the log. Processes that
+// have the cache open keep using the old table. The entries that they
+// log in the meantime may be lost.
+void compactAnalysisCacheFile(const std::string& path) {
+  std::unordered_map<std::string, std::string> entries;
+  std::string data;
+  if (readFile(path, &data)) {
+    const struct AnalysisCacheHeader* h =
+        analysisCacheHeader(data.data(), data.size(), path);
+    collectAnalysisCacheEntries(
+        data, sizeof *h + h->bucketsLength * sizeof(uint64_t), &entries);
+  }
+  const std::string logPath = path + ".log";
+  data.clear();
+  if (readFile(logPath, &data)) {
+    collectAnalysisCacheEntries(data, 0, &entries);
+  }
+  data.clear();
+
+  // At most half of the buckets are used, so that probing stays short.
+  uint64_t bucketsLength = 1;
+  while (bucketsLength < 2 * entries.size()) {
+    bucketsLength *= 2;
+  }
+  if (bucketsLength > UINT32_MAX) {
+    throw std::length_error("Too many entries in the analysis cache");
+  }
+  struct AnalysisCacheHeader h = {};
+  memcpy(h.magic, analysisCacheMagic, sizeof h.magic);
+  h.version = analysisCacheVersion;
+  h.bucketsLength = bucketsLength;
+  h.entriesLength = entries.size();
+  std::vector<uint64_t> buckets(bucketsLength);
+  std::string out(sizeof h + bucketsLength * sizeof(uint64_t), '\0');
+  for (std::unordered_map<std::string, std::string>::const_iterator it =
+           entries.begin();
+       it != entries.end(); ++it) {
+    const struct AnalysisCacheEntry* e =
+        reinterpret_cast<const struct AnalysisCacheEntry*>(it->second.data());
+    uint64_t i = analysisCacheKey(
+        e->fingerprint, reinterpret_cast<const char*>(e + 1), e->textLength);
+    while (buckets[i & (bucketsLength - 1)] != 0) {
+      ++i;
+    }
+    buckets[i & (bucketsLength - 1)] = out.size();
+    out.append(it->second);
+  }
+  memcpy(&out[0], &h, sizeof h);
+  memcpy(&out[sizeof h], buckets.data(), bucketsLength * sizeof(uint64_t));
+  writeFile(path, out.data(), out.size());
+  if (truncate(logPath.c_str(), 0) != 0 && errno != ENOENT) {
+    throw systemError(logPath);
+  }
+}
+
+#ifdef __linux__
+
+const struct ShmSegment makeShmSegment(int fd, size_t size) {
+  void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    throw systemError("mmap");
+  }
+  struct ShmHeader* h = static_cast<struct ShmHeader*>(p);
+  char* data = static_cast<char*>(p) + sizeof *h;
+  const size_t ringSize = (size - sizeof *h) / 2;
+  return {
+    h, data, data + ringSize, static_cast<uint32_t>(ringSize), fd, noError,
+  };
+}
+
+const struct ShmSegment makeShmSegment(const std::exception& e) {
+  return { NULL, NULL, NULL, 0, -1, makeError(e) };
+}
+
+// Reserves room for a response with n bytes of payload, or returns
+// NULL if the segment has been closed in the meantime or the client
+// has corrupted the ring, in which case it closes the segment.
+char* reserveShmResponse(const struct ShmSegment* s, uint32_t n) {
+  struct ShmRing* r = &s->header->responses;
+  const uint32_t size = s->ringSize;
+  char* p;
+  while ((p = shmReserve(r, s->responses, size, n)) == NULL) {
+    if (shmClosed(s)) {
+      return NULL;
+    }
+    shmWaitForRoom(r, size, n, &shmPollInterval);
+  }
+  if (p == SHM_CORRUPT) {
+    closeShmSegment(s);
+    return NULL;
+  }
+  return p;
+}
+
+#endif  // __linux__
+
+}  // namespace
+
+extern "C" {
+
+Morf createInstance(const struct String dictName, enum Usage usage) {
+  try {
+    const int64_t before = heapInUse();
+    const std::string name =
+        dictName.p == NULL ? std::string() : stdString(dictName);
+    const std::shared_ptr<GeneratorSource> source =
+        newGeneratorSource(name, usage);
+    Instance* ret =
+        newInstance(loadMorfeusz(name, usage, source), usage, name, source);
+    ret->setHeapBytes(heapGrowth(before));
+    return ret;
+  } catch (const std::exception& e) {
+    return NULL;
+  }
+}
+
+const struct NewInstance createInstanceWithConfig(
+    const struct Config* config) {
+  const struct Config& c = *config;
+  const enum ConfigField invalid = invalidEnumField(c);
+  if (invalid != CONFIG_OK) {
+    return makeNewInstance(invalid, configFieldErrors[invalid]);
+  }
+  // Every instance loads its own dictionary: clones would share
+  // their settings with the original.
+  const int64_t before = heapInUse();
+  const std::shared_ptr<GeneratorSource> source =
+      newGeneratorSource(stdString(c.dictName), c.usage);
+  Morfeusz* m = NULL;
+  try {
+    m = loadMorfeusz(stdString(c.dictName), c.usage, source);
+  } catch (const std::exception&) {
+    return makeNewInstance(
+        CONFIG_DICT_NAME,
+        std::string(configFieldErrors[CONFIG_DICT_NAME]) +
+            " \"" + stdString(c.dictName) + "\"");
+  }
+  std::string message;
+  const enum ConfigField field = configure(m, c, &message);
+  if (field != CONFIG_OK) {
+    delete m;
+    return makeNewInstance(field, message);
+  }
+  Instance* ret = newInstance(m, c.usage, stdString(c.dictName), source);
+  ret->setHeapBytes(heapGrowth(before));
+  return makeNewInstance(ret);
+}
+
+Res analyseString(const Morf m, const struct String text) {
+  try {
+    const int64_t start = startResultMeasurement();
+    return measureResult(analyseResults(m, stdString(text)), start);
+  } catch (const std::exception&) {
+    return NULL;
+  }
+}
+
+const struct Analysis analyseStringWithOptions(
+    const Morf m, const struct String text, const struct Options* options) {
+  try {
+    const int64_t start = startResultMeasurement();
+    const Morfeusz* v = icast(m)->variant(*options);
+    // The results are computed in advance, as the variant may be
+    // dropped by a setter before the iterator is exhausted.
+    VectorResultsIterator* r = new VectorResultsIterator;
+    try {
+      analyse(icast(m), v, stdString(text), &r->interpretations);
+    } catch (const std::exception&) {
+      delete r;
+      throw;
+    }
+    return { measureResult(r, start), noError };
+  } catch (const std::exception& e) {
+    return { NULL, makeError(e) };
+  }
+}
+
+const struct Analysis analyseStringWithFallback(
+    const Morf m, Morf fallback, const struct String text) {
+  const int64_t start = startResultMeasurement();
+  VectorResultsIterator* r = new VectorResultsIterator;
+  try {
+    analyseWithFallback(
+        cmcast(m), icast(fallback), stdString(text), &r->interpretations);
+    return { measureResult(r, start), noError };
+  } catch (const std::exception& e) {
+    delete r;
+    return { NULL, makeError(e) };
+  }
+}
+
+const struct Lemmas analyseLemmas(const Morf m, const struct String text) {
+  try {
+    std::vector<MorphInterpretation> vec;
+    analyse(m, stdString(text), &vec);
+    return makeLemmas(vec);
+  } catch (const std::exception& e) {
+    const struct Lemmas ret = { NULL, NULL, 0, NULL, 0, makeError(e) };
+    return ret;
+  }
+}
+
+const struct Buffer serializeAnalysis(
+    const Morf m, const struct String text, enum Format format) {
+  try {
+    if (!inRange(serializers, format)) {
+      throw std::invalid_argument("Invalid format");
+    }
+    const Serializer serialize = serializers[format];
+    const IdResolver& r = idResolver(m);
+    ByteWriter w;
+    std::unique_ptr<ResultsIterator> it(analyseResults(m, stdString(text)));
+    if (format == COMPACT_FORMAT) {
+      CompactEncoder e(cmcast(m)->getDictID(), &w);
+      while (it->hasNext()) {
+        e.write(it->next());
+      }
+    } else {
+      while (it->hasNext()) {
+        serialize(r, it->next(), &w);
+      }
+    }
+    return { w.release(), noError };
+  } catch (const std::exception& e) {
+    return { emptyString, makeError(e) };
+  }
+}
+
+const struct Buffer serializeAnalysisBatch(
+    const Morf m, const struct String texts, const int* lengths, int count,
+    enum Format format, int* sizes) {
+  try {
+    if (!inRange(serializers, format)) {
+      throw std::invalid_argument("Invalid format");
+    }
+    const IdResolver& r = idResolver(m);
+    ByteWriter w;
+    // Coalesced texts would bypass the form table and the caches.
+    if (!hasLookupTables(m) && canCoalesce(cmcast(m), texts, count) &&
+        serializeCoalesced(
+            cmcast(m), r, format, texts, lengths, count, sizes, &w)) {
+      return { w.release(), noError };
+    }
+    std::vector<MorphInterpretation> vec;
+    const char* p = texts.p;
+    for (int doc = 0; doc < count; ++doc) {
+      vec.clear();
+      analyse(m, std::string(p, lengths[doc]), &vec);
+      p += lengths[doc];
+      const size_t before = w.size();
+      serializeRange(cmcast(m), r, format, vec.begin(), vec.end(), 0, &w);
+      sizes[doc] = w.size() - before;
+    }
+    return { w.release(), noError };
+  } catch (const std::exception& e) {
+    return { emptyString, makeError(e) };
+  }
+}
+
+const struct TokenInfoArray decodeCompact(
+    const Morf m, const struct String data) {
+  try {
+    CompactDecoder d(data.p, data.n);
+    if (d.dictId != cmcast(m)->getDictID()) {
+      throw std::invalid_argument(
+          "Compact data from dictionary " + d.dictId);
+    }
+    std::vector<MorphInterpretation> vec;
+    while (d.hasNext()) {
+      vec.push_back(d.next());
+    }
+    return makeTokenInfoArray(vec);
+  } catch (const std::exception& e) {
+    return makeTokenInfoArray(e);
+  }
+}
+
+const struct RecordBatch analyseRecordBatch(
+    const Morf m, const struct String texts, const int* lengths, int count) {
+  try {
+    RecordBatchColumns columns;
+    std::vector<MorphInterpretation> vec;
+    const char* p = texts.p;
+    for (int doc = 0; doc < count; ++doc) {
+      vec.clear();
+      analyse(m, std::string(p, lengths[doc]), &vec);
+      p += lengths[doc];
+      for (std::vector<MorphInterpretation>::const_iterator it =
+               vec.begin();
+           it != vec.end(); ++it) {
+        columns.push_back(doc, *it);
+      }
+    }
+    return makeRecordBatch(columns, idResolver(m));
+  } catch (const std::exception& e) {
+    const struct RecordBatch ret = { NULL, NULL, makeError(e) };
+    return ret;
+  }
+}
+
+const struct Warmup warmup(const Morf m, enum WarmupLevel level) {
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  struct Warmup ret = {};
+  try {
+    if (level != WARMUP_BASIC && level != WARMUP_FULL) {
+      throw std::invalid_argument("Invalid warm-up level");
+    }
+    warmUp(icast(m), level, &ret);
+  } catch (const std::exception& e) {
+    ret.error = makeError(e);
+  }
+  ret.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  return ret;
+}
 
-template<typename R, typename T, int N>
-R reverseTranslate(const T (&array)[N], T value) {
-  for (int i = 0; i < N; ++i) {
-    if (array[i] == value) {
-      return static_cast<R>(i);
+const struct PackedAnalysis analysePacked(
+    const Morf m, const struct String texts, const int* lengths, int count) {
+  try {
+    checkPackedIds(idResolver(m));
+    std::vector<struct PackedTokenInfo> tokens;
+    std::string strings;
+    std::vector<MorphInterpretation> vec;
+    const char* p = texts.p;
+    for (int doc = 0; doc < count; ++doc) {
+      vec.clear();
+      analyse(m, std::string(p, lengths[doc]), &vec);
+      p += lengths[doc];
+      const size_t n = tokens.size();
+      const uint32_t length = strings.size();
+      tokens.resize(n + vec.size());
+      strings.resize(packTokenInfos(vec, doc, NULL, NULL, length));
+      packTokenInfos(vec, doc, tokens.data() + n, &strings[0], length);
+    }
+    if (tokens.size() > INT_MAX || strings.size() > INT_MAX) {
+      throw std::length_error("Packed analysis too large");
     }
+    struct PackedTokenInfo* tp = allocate<struct PackedTokenInfo>(
+        tokens.size());
+    std::copy(tokens.begin(), tokens.end(), tp);
+    const struct String s = makeString(strings);
+    const struct PackedAnalysis ret = {
+      tp, static_cast<int>(tokens.size()), s.p, s.n, noError,
+    };
+    return ret;
+  } catch (const std::exception& e) {
+    const struct PackedAnalysis ret = { NULL, 0, NULL, 0, makeError(e) };
+    return ret;
   }
-  return static_cast<R>(invalidId);
 }
 
-const struct String makeString(const char* p, int n) {
-  char* cp = new char[n];
-  memcpy(cp, p, n);
-  return { cp, n };
+const struct InternedAnalysis analyseInterned(
+    const Morf m, const struct String text) {
+  try {
+    std::vector<MorphInterpretation> vec;
+    analyse(m, stdString(text), &vec);
+    struct InternedTokenInfo* tp = allocate<struct InternedTokenInfo>(
+        vec.size());
+    const struct InternedAnalysis ret = {
+      tp, static_cast<int>(vec.size()), noError,
+    };
+    const MorphInterpretation* previous = NULL;
+    try {
+      for (std::vector<MorphInterpretation>::const_iterator it = vec.begin();
+           it != vec.end(); ++it, ++tp) {
+        // The interpretations of a segment follow each other and share
+        // the orth, and often the lemma.
+        tp->orthID = previous != NULL && previous->orth == it->orth ?
+            tp[-1].orthID : intern(it->orth);
+        tp->lemmaID = previous != NULL && previous->lemma == it->lemma ?
+            tp[-1].lemmaID : intern(it->lemma);
+        tp->startNode = it->startNode;
+        tp->endNode = it->endNode;
+        tp->tagID = it->tagId;
+        tp->nameID = it->nameId;
+        tp->labelsID = it->labelsId;
+        previous = &*it;
+      }
+    } catch (const std::exception&) {
+      // The table of interned strings is full.
+      deallocate(ret.tokens);
+      throw;
+    }
+    return ret;
+  } catch (const std::exception& e) {
+    const struct InternedAnalysis ret = { NULL, 0, makeError(e) };
+    return ret;
+  }
 }
 
-const struct String makeString(const std::string& s) {
-  return makeString(s.data(), s.size());
+const struct Buffer resolveInterned(
+    const uint32_t* ids, int count, int* lengths) {
+  try {
+    size_t size = 0;
+    for (int i = 0; i < count; ++i) {
+      const std::string* s = internedStrings.resolve(ids[i]);
+      if (s == NULL) {
+        throw std::out_of_range("Unknown interned string ID");
+      }
+      size += s->size();
+    }
+    if (size > INT_MAX) {
+      throw std::length_error("Interned strings too large");
+    }
+    char* p = allocate<char>(size);
+    const struct Buffer ret = {
+      { p, static_cast<int>(size) }, noError,
+    };
+    for (int i = 0; i < count; ++i) {
+      const std::string* s = internedStrings.resolve(ids[i]);
+      memcpy(p, s->data(), s->size());
+      p += s->size();
+      lengths[i] = s->size();
+    }
+    return ret;
+  } catch (const std::exception& e) {
+    return { emptyString, makeError(e) };
+  }
 }
 
-const Error makeError(const std::exception& e) {
-  return makeString(e.what(), strlen(e.what()));
+const struct InterpretationAnalysis analyseInterpretations(
+    const Morf m, const struct String text) {
+  try {
+    std::vector<MorphInterpretation> vec;
+    analyse(m, stdString(text), &vec);
+    struct InterpretationTokenInfo* tp =
+        allocate<struct InterpretationTokenInfo>(vec.size());
+    const struct InterpretationAnalysis ret = {
+      tp, static_cast<int>(vec.size()), noError,
+    };
+    const MorphInterpretation* previous = NULL;
+    try {
+      for (std::vector<MorphInterpretation>::const_iterator it = vec.begin();
+           it != vec.end(); ++it, ++tp) {
+        tp->orthID = previous != NULL && previous->orth == it->orth ?
+            tp[-1].orthID : intern(it->orth);
+        tp->interpretationID = interpretationId(*it);
+        tp->startNode = it->startNode;
+        tp->endNode = it->endNode;
+        previous = &*it;
+      }
+    } catch (const std::exception&) {
+      // The table of interned strings is full.
+      deallocate(ret.tokens);
+      throw;
+    }
+    return ret;
+  } catch (const std::exception& e) {
+    const struct InterpretationAnalysis ret = { NULL, 0, makeError(e) };
+    return ret;
+  }
 }
 
-const std::string stdString(const struct String s) {
-  // s.p points to the character array underlying a Go string
-  // so it will be freed by the Go garbage collector.
-  return std::string(s.p, s.n);
+const Error resolveInterpretations(
+    const int* ids, int count, uint32_t* lemmaIDs,
+    int* tagIDs, int* nameIDs, int* labelsIDs) {
+  try {
+    for (int i = 0; i < count; ++i) {
+      const InterpretationKey* k = ids[i] < 0 ?
+          NULL : interpretationsTable.resolve(ids[i]);
+      if (k == NULL) {
+        throw std::out_of_range("Unknown interpretation ID");
+      }
+      lemmaIDs[i] = k->lemmaID;
+      tagIDs[i] = k->tagID;
+      nameIDs[i] = k->nameID;
+      labelsIDs[i] = k->labelsID;
+    }
+    return noError;
+  } catch (const std::exception& e) {
+    return makeError(e);
+  }
 }
 
-const struct TokenInfo makeTokenInfo(const MorphInterpretation& m) {
-  return {
-      makeString(m.orth),
-      makeString(m.lemma),
-      m.startNode,
-      m.endNode,
-      m.tagId,
-      m.nameId,
-      m.labelsId,
-  };
+int64_t interpretationsCount() {
+  return interpretationsTable.size();
 }
 
-template<typename T>
-const struct StringArray makeStringArray(const T& lst) {
-  const int n = lst.size();
-  struct String* sp = new struct String[n];
-  const struct StringArray ret = { sp, n };
-  for (typename T::const_iterator it = lst.begin(); it != lst.end(); ++it) {
-    *sp++ = makeString(*it);
+void setInterpretationsLimit(int64_t limit) {
+  interpretationsTable.setLimit(
+      std::min<int64_t>(std::max<int64_t>(limit, 0), INT_MAX));
+}
+
+const Error saveInterpretations(const Morf m, const struct String path) {
+  try {
+    writeInterpretations(idResolver(m).getTagsetId(), stdString(path));
+    return noError;
+  } catch (const std::exception& e) {
+    return makeError(e);
   }
-  return ret;
 }
 
-const struct TokenInfoArray makeTokenInfoArray(
-    const std::vector<MorphInterpretation>& vec) {
-  const int n = vec.size();
-  struct TokenInfo* tp = new struct TokenInfo[n];
-  const struct TokenInfoArray ret = { tp, n, noError };
-  for (std::vector<MorphInterpretation>::const_iterator it = vec.begin();
-       it != vec.end(); ++it) {
-    *tp++ = makeTokenInfo(*it);
+const Error loadInterpretations(const Morf m, const struct String path) {
+  try {
+    readInterpretations(idResolver(m).getTagsetId(), stdString(path));
+    return noError;
+  } catch (const std::exception& e) {
+    return makeError(e);
   }
-  return ret;
 }
 
-const struct TokenInfoArray makeTokenInfoArray(const std::exception& e) {
-  return { NULL, 0, makeError(e) };
+int64_t internedCount() {
+  return internedStrings.size();
 }
 
-const Morfeusz* cmcast(const Morf m) {
-  return static_cast<const Morfeusz*>(m);
+void setInternedLimit(int64_t limit) {
+  internedStrings.setLimit(
+      std::min<int64_t>(std::max<int64_t>(limit, 0), INT64_C(1) << 32));
 }
 
-Morfeusz* mcast(Morf m) {
-  return static_cast<Morfeusz*>(m);
+const struct NewCache openAnalysisCache(const struct String path) {
+  try {
+    const Cache c = new std::shared_ptr<AnalysisCache>(
+        new AnalysisCache(stdString(path)));
+    return { c, noError };
+  } catch (const std::exception& e) {
+    return { NULL, makeError(e) };
+  }
 }
 
-ResultsIterator* rcast(Res r) {
-  return static_cast<ResultsIterator*>(r);
+void setAnalysisCache(Morf m, const Cache c) {
+  icast(m)->setCache(
+      c == NULL ? std::shared_ptr<AnalysisCache>() : *ccast(c));
 }
 
-const IdResolver& idResolver(const Morf m) {
-  return cmcast(m)->getIdResolver();
+const struct AnalysisCacheStats analysisCacheStats(const Cache c) {
+  return (*ccast(c))->stats();
 }
 
-}  // namespace
+Sentences newSentenceCache(int64_t budget) {
+  return new std::shared_ptr<SentenceCache>(new SentenceCache(budget));
+}
 
-extern "C" {
+void setSentenceCache(Morf m, const Sentences s) {
+  icast(m)->setSentences(
+      s == NULL ? std::shared_ptr<SentenceCache>() : *scast(s));
+}
 
-Morf createInstance(const struct String dictName, enum Usage usage) {
+const struct SentenceCacheStats sentenceCacheStats(const Sentences s) {
+  return (*scast(s))->stats();
+}
+
+const Error buildFormTable(
+    const Morf m, const struct String forms, const int* lengths, int count,
+    int threads, const struct String path) {
   try {
-    const morfeusz::MorfeuszUsage morfeuszUsage = translateUsage[usage];
-    if (dictName.p == NULL) {
-      return Morfeusz::createInstance(morfeuszUsage);
-    } else {
-      return Morfeusz::createInstance(stdString(dictName), morfeuszUsage);
+    std::vector<std::string> v;
+    v.reserve(count);
+    const char* p = forms.p;
+    for (int i = 0; i < count; ++i) {
+      v.push_back(std::string(p, lengths[i]));
+      p += lengths[i];
     }
+    writeFormTable(cmcast(m), v, threads, stdString(path));
+    return noError;
   } catch (const std::exception& e) {
-    return NULL;
+    return makeError(e);
   }
 }
 
-Res analyseString(const Morf m, const struct String text) {
+const struct NewVocabulary buildVocabulary(
+    const Morf m, const struct String words, const int* lengths, int count,
+    int threads) {
   try {
-    return cmcast(m)->analyse(stdString(text));
-  } catch (const std::exception&) {
-    return NULL;
+    std::vector<std::string> v;
+    v.reserve(count);
+    const char* p = words.p;
+    for (int i = 0; i < count; ++i) {
+      v.push_back(std::string(p, lengths[i]));
+      p += lengths[i];
+    }
+    return { new Vocabulary(cmcast(m), v, threads), noError };
+  } catch (const std::exception& e) {
+    return { NULL, makeError(e) };
+  }
+}
+
+const struct Buffer serializeAnalysisWithVocabulary(
+    const Morf m, const Vocab v, const struct String text,
+    enum Format format) {
+  try {
+    if (!inRange(serializers, format)) {
+      throw std::invalid_argument("Invalid format");
+    }
+    vcast(v)->check(cmcast(m));
+    std::vector<MorphInterpretation> vec;
+    vcast(v)->analyse(cmcast(m), stdString(text), &vec);
+    ByteWriter w;
+    serializeRange(cmcast(m), idResolver(m), format,
+                   vec.begin(), vec.end(), 0, &w);
+    return { w.release(), noError };
+  } catch (const std::exception& e) {
+    return { emptyString, makeError(e) };
+  }
+}
+
+int vocabularySize(const Vocab v) {
+  return vcast(v)->size();
+}
+
+const struct NewForms openFormTable(const struct String path) {
+  try {
+    const Forms f = new std::shared_ptr<FormTable>(
+        new FormTable(stdString(path)));
+    return { f, noError };
+  } catch (const std::exception& e) {
+    return { NULL, makeError(e) };
+  }
+}
+
+const Error setFormTable(Morf m, const Forms f) {
+  try {
+    if (f != NULL) {
+      (*fcast(f))->check(cmcast(m));
+    }
+    icast(m)->setForms(
+        f == NULL ? std::shared_ptr<FormTable>() : *fcast(f));
+    return noError;
+  } catch (const std::exception& e) {
+    return makeError(e);
+  }
+}
+
+int formTableSize(const Forms f) {
+  return (*fcast(f))->size();
+}
+
+const struct FormTableStats formTableStats(const Forms f) {
+  return (*fcast(f))->stats();
+}
+
+const Error compactAnalysisCache(const struct String path) {
+  try {
+    compactAnalysisCacheFile(stdString(path));
+    return noError;
+  } catch (const std::exception& e) {
+    return makeError(e);
   }
 }
 
@@ -244,7 +4093,7 @@ int labelsCount(const Morf m) {
 const struct TokenInfoArray generate(const Morf m, const struct String lemma) {
   try {
     std::vector<MorphInterpretation> vec;
-    cmcast(m)->generate(stdString(lemma), vec);
+    icast(m)->generator()->generate(stdString(lemma), vec);
     return makeTokenInfoArray(vec);
   } catch (const std::exception& e) {
     return makeTokenInfoArray(e);
@@ -255,7 +4104,7 @@ const struct TokenInfoArray generateWithTagID(
     const Morf m, int tagId, const struct String lemma) {
   try {
     std::vector<MorphInterpretation> vec;
-    cmcast(m)->generate(stdString(lemma), tagId, vec);
+    icast(m)->generator()->generate(stdString(lemma), tagId, vec);
     return makeTokenInfoArray(vec);
   } catch (const std::exception& e) {
     return makeTokenInfoArray(e);
@@ -272,7 +4121,7 @@ const struct String dictCopyright(const Morf m) {
 
 const Error setAggl(Morf m, const struct String aggl) {
   try {
-    mcast(m)->setAggl(stdString(aggl));
+    modify(m)->setAggl(stdString(aggl));
     return noError;
   } catch (const std::exception& e) {
     return makeError(e);
@@ -281,7 +4130,7 @@ const Error setAggl(Morf m, const struct String aggl) {
 
 const Error setPraet(Morf m, const struct String praet) {
   try {
-    mcast(m)->setPraet(stdString(praet));
+    modify(m)->setPraet(stdString(praet));
     return noError;
   } catch (const std::exception& e) {
     return makeError(e);
@@ -290,7 +4139,7 @@ const Error setPraet(Morf m, const struct String praet) {
 
 const Error setCharset(Morf m, enum Charset encoding) {
   try {
-    mcast(m)->setCharset(translateCharset[encoding]);
+    modify(m)->setCharset(translateCharset[encoding]);
     return noError;
   } catch (const std::exception& e) {
     return makeError(e);
@@ -299,7 +4148,7 @@ const Error setCharset(Morf m, enum Charset encoding) {
 
 const Error setCaseHandling(Morf m, enum CaseHandling caseHandling) {
   try {
-    mcast(m)->setCaseHandling(translateCaseHandling[caseHandling]);
+    modify(m)->setCaseHandling(translateCaseHandling[caseHandling]);
     return noError;
   } catch (const std::exception& e) {
     return makeError(e);
@@ -308,7 +4157,7 @@ const Error setCaseHandling(Morf m, enum CaseHandling caseHandling) {
 
 const Error setTokenNumbering(Morf m, enum TokenNumbering numbering) {
   try {
-    mcast(m)->setTokenNumbering(translateTokenNumbering[numbering]);
+    modify(m)->setTokenNumbering(translateTokenNumbering[numbering]);
     return noError;
   } catch (const std::exception& e) {
     return makeError(e);
@@ -317,7 +4166,7 @@ const Error setTokenNumbering(Morf m, enum TokenNumbering numbering) {
 
 const Error setWhitespaceHandling(Morf m, enum WhitespaceHandling handling) {
   try {
-    mcast(m)->setWhitespaceHandling(translateWhitespaceHandling[handling]);
+    modify(m)->setWhitespaceHandling(translateWhitespaceHandling[handling]);
     return noError;
   } catch (const std::exception& e) {
     return makeError(e);
@@ -326,7 +4175,8 @@ const Error setWhitespaceHandling(Morf m, enum WhitespaceHandling handling) {
 
 const Error setDictionary(Morf m, const struct String dictName) {
   try {
-    mcast(m)->setDictionary(stdString(dictName));
+    modify(m)->setDictionary(stdString(dictName));
+    icast(m)->setDictionary(stdString(dictName));
     return noError;
   } catch (const std::exception& e) {
     return makeError(e);
@@ -397,37 +4247,420 @@ void clearDictionarySearchPaths(Morf m) {
 }
 
 Morf cloneMorf(const Morf m) {
-  return cmcast(m)->clone();
+  return icast(m)->clone();
 }
 
 void freeMorf(const Morf m) {
-  delete cmcast(m);
+  delete icast(m);
 }
 
 void freeRes(const Res r) {
+  forgetResult(r);
   delete rcast(r);
 }
 
+void freeAnalysisCache(const Cache c) {
+  delete ccast(c);
+}
+
+void freeSentenceCache(const Sentences s) {
+  delete scast(s);
+}
+
+void freeFormTable(const Forms f) {
+  delete fcast(f);
+}
+
+void freeVocabulary(const Vocab v) {
+  delete vcast(v);
+}
+
+void freeRouter(const Router r) {
+  delete rtcast(r);
+}
+
 void freeTokenInfo(const struct TokenInfo* t) {
-  delete[] t->orth.p;
-  delete[] t->lemma.p;
+  if (t->orth.p != NULL || t->lemma.p != NULL) {
+    --liveTokenInfos;
+  }
+  if (t->orth.p != NULL) {
+    liveTokenInfoBytes -= t->orth.n;
+  }
+  if (t->lemma.p != NULL) {
+    liveTokenInfoBytes -= t->lemma.n;
+  }
+  deallocate(t->orth.p);
+  deallocate(t->lemma.p);
 }
 
 void freeStringArray(const struct StringArray* arr) {
   // The calls to freeCharArray(arr->strings[i].p) happen earlier,
   // when the elements are converted to Go strings via goStringFree().
-  delete[] arr->strings;
+  int64_t bytes = arr->length * sizeof(struct String);
+  for (int i = 0; i < arr->length; ++i) {
+    bytes += arr->strings[i].n;
+  }
+  liveStringArrayBytes -= bytes;
+  deallocate(arr->strings);
 }
 
 void freeTokenInfoArray(const struct TokenInfoArray* arr) {
   // The calls to freeTokenInfo(arr->tokens[i]) happen later,
   // once the elements become inaccessible.
-  delete[] arr->tokens;
-  delete[] arr->error.p;
+  liveTokenInfoBytes -= arr->length * sizeof(struct TokenInfo);
+  deallocate(arr->tokens);
+  deallocate(arr->error.p);
+}
+
+void freeLemmas(const struct Lemmas* l) {
+  deallocate(l->heap);
+  deallocate(l->offsets);
+  deallocate(l->segments);
+  deallocate(l->error.p);
+}
+
+void freeBuffer(const struct Buffer* b) {
+  deallocate(b->data.p);
+  deallocate(b->error.p);
+}
+
+void freePrefork(const struct Prefork* p) {
+  deallocate(p->pids);
+  deallocate(p->error.p);
+}
+
+void freePackedAnalysis(const struct PackedAnalysis* a) {
+  deallocate(a->tokens);
+  deallocate(a->strings);
+  deallocate(a->error.p);
+}
+
+void freeInternedAnalysis(const struct InternedAnalysis* a) {
+  deallocate(a->tokens);
+  deallocate(a->error.p);
+}
+
+void freeInterpretationAnalysis(const struct InterpretationAnalysis* a) {
+  deallocate(a->tokens);
+  deallocate(a->error.p);
+}
+
+void freeRecordBatch(const struct RecordBatch* b) {
+  // The consumer of the batch may have moved the structs out,
+  // in which case their release callbacks are NULL.
+  if (b->schema != NULL && b->schema->release != NULL) {
+    b->schema->release(b->schema);
+  }
+  if (b->array != NULL && b->array->release != NULL) {
+    b->array->release(b->array);
+  }
+  delete b->schema;
+  delete b->array;
+  deallocate(b->error.p);
 }
 
 void freeCharArray(const char* p) {
-  delete[] p;
+  deallocate(p);
+}
+
+Router createRouter() {
+  return new DictionaryRouter;
+}
+
+const struct NewDictionary routerAddDictionary(
+    Router r, const struct Config* config) {
+  const struct NewInstance ni = createInstanceWithConfig(config);
+  if (ni.morf == NULL) {
+    return { invalidId, ni.field, ni.error };
+  }
+  std::vector<Instance*>& instances = rtcast(r)->instances;
+  instances.push_back(icast(ni.morf));
+  return { static_cast<int>(instances.size()) - 1, CONFIG_OK, noError };
+}
+
+int routerSize(const Router r) {
+  return rtcast(r)->instances.size();
+}
+
+Morf routerInstance(const Router r, int dictId) {
+  return rtcast(r)->instance(dictId);
+}
+
+const struct Analysis routerAnalyseString(
+    const Router r, int dictId, const struct String text) {
+  Instance* m = rtcast(r)->instance(dictId);
+  if (m == NULL) {
+    return { NULL, makeString(invalidDictIdError(dictId)) };
+  }
+  try {
+    const int64_t start = startResultMeasurement();
+    return { measureResult(analyseResults(m, stdString(text)), start),
+             noError };
+  } catch (const std::exception& e) {
+    return { NULL, makeError(e) };
+  }
+}
+
+const struct TokenInfoArray routerGenerate(
+    const Router r, int dictId, const struct String lemma) {
+  Instance* m = rtcast(r)->instance(dictId);
+  if (m == NULL) {
+    return makeTokenInfoArray(std::out_of_range(invalidDictIdError(dictId)));
+  }
+  return generate(m, lemma);
+}
+
+const struct TokenInfoArray routerGenerateWithTagID(
+    const Router r, int dictId, int tagId, const struct String lemma) {
+  Instance* m = rtcast(r)->instance(dictId);
+  if (m == NULL) {
+    return makeTokenInfoArray(std::out_of_range(invalidDictIdError(dictId)));
+  }
+  return generateWithTagID(m, tagId, lemma);
+}
+
+const struct Prefork preforkServe(
+    const Morf m, const struct String path, enum Format format, int workers) {
+  const std::string p = stdString(path);
+  std::vector<int> pids;
+  int listener = -1;
+  try {
+    if (!inRange(serializers, format)) {
+      throw std::invalid_argument("Invalid format");
+    }
+    if (workers < 1) {
+      throw std::invalid_argument("Invalid number of workers");
+    }
+    // Initialize whatever Morfeusz builds lazily, so that the workers
+    // share it instead of building it one by one.
+    struct Warmup w = {};
+    warmUp(icast(m), WARMUP_BASIC, &w);
+    std::call_once(forkHandlersOnce, registerForkHandlers);
+    listener = listenUnix(p);
+    if (fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK) < 0) {
+      throw systemError("fcntl");
+    }
+    const pid_t parent = getpid();
+    // The caches may be shared with instances used by other threads.
+    // Their locks, unlike the process-wide ones, are taken here.
+    const LookupTables tables = icast(m)->getLookupTables();
+    const std::shared_ptr<SentenceCache>& sentences = tables.sentences;
+    const std::shared_ptr<AnalysisCache>& cache = tables.cache;
+    for (int i = 0; i < workers; ++i) {
+      if (sentences) {
+        sentences->lockShards();
+      }
+      if (cache) {
+        cache->lock();
+      }
+      const pid_t pid = fork();
+      if (cache) {
+        cache->unlock();
+      }
+      if (sentences) {
+        sentences->unlockShards();
+      }
+      if (pid < 0) {
+        throw systemError("fork");
+      }
+      if (pid == 0) {
+        servePrefork(m, format, listener, parent);
+      }
+      pids.push_back(pid);
+    }
+    int* pp = allocate<int>(pids.size());
+    std::copy(pids.begin(), pids.end(), pp);
+    return { pp, workers, listener, noError };
+  } catch (const std::exception& e) {
+    stopWorkers(pids);
+    if (listener >= 0) {
+      close(listener);
+      unlink(p.c_str());
+    }
+    return { NULL, 0, -1, makeError(e) };
+  }
+}
+
+#ifdef __linux__
+
+const struct ShmSegment createShmSegment(int ringSize) {
+  try {
+    if (ringSize < SHM_MIN_RING_SIZE || (ringSize & (ringSize - 1)) != 0) {
+      throw std::invalid_argument("Invalid ring size");
+    }
+    const int fd = memfd_create("morfeusz-shm", MFD_CLOEXEC);
+    if (fd < 0) {
+      throw systemError("memfd_create");
+    }
+    const size_t size = sizeof(struct ShmHeader) + 2 * ringSize;
+    if (ftruncate(fd, size) < 0) {
+      const std::runtime_error e = systemError("ftruncate");
+      close(fd);
+      throw e;
+    }
+    struct ShmSegment ret;
+    try {
+      ret = makeShmSegment(fd, size);
+    } catch (const std::exception&) {
+      close(fd);
+      throw;
+    }
+    ret.header->magic = SHM_MAGIC;
+    ret.header->version = SHM_VERSION;
+    ret.header->ringSize = ringSize;
+    return ret;
+  } catch (const std::exception& e) {
+    return makeShmSegment(e);
+  }
+}
+
+const struct ShmSegment attachShmSegment(int fd) {
+  try {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      throw systemError("fstat");
+    }
+    if (st.st_size < static_cast<off_t>(sizeof(struct ShmHeader))) {
+      throw std::invalid_argument("Not a segment");
+    }
+    struct ShmSegment ret = makeShmSegment(fd, st.st_size);
+    const struct ShmHeader* h = ret.header;
+    if (h->magic != SHM_MAGIC || h->version != SHM_VERSION ||
+        h->ringSize != ret.ringSize || ret.ringSize < SHM_MIN_RING_SIZE ||
+        (ret.ringSize & (ret.ringSize - 1)) != 0 ||
+        st.st_size !=
+            static_cast<off_t>(sizeof *h + 2 * size_t(ret.ringSize))) {
+      munmap(ret.header, st.st_size);
+      throw std::invalid_argument("Not a segment");
+    }
+    return ret;
+  } catch (const std::exception& e) {
+    return makeShmSegment(e);
+  }
+}
+
+void serveShm(const Morf m, const struct ShmSegment* s) {
+  struct ShmRing* in = &s->header->requests;
+  const uint32_t size = s->ringSize;
+  std::vector<MorphInterpretation> vec;
+  std::string text;
+  while (!shmClosed(s)) {
+    uint32_t n;
+    const char* p = shmPeek(in, s->requests, size, &n);
+    if (p == NULL) {
+      shmWaitForData(in, &shmPollInterval);
+      continue;
+    }
+    if (p == SHM_CORRUPT) {
+      closeShmSegment(s);
+      return;
+    }
+    struct ShmRequest req = { 0, 0 };
+    if (n >= sizeof req) {
+      memcpy(&req, p, sizeof req);
+    }
+    std::string error;
+    if (n < sizeof req || req.length > n - sizeof req) {
+      error = "Malformed request";
+    } else {
+      text.assign(p + sizeof req, req.length);
+    }
+    shmRelease(in, size, n);
+    vec.clear();
+    uint32_t stringsLength = 0;
+    if (error.empty()) {
+      try {
+        analyse(m, text, &vec);
+        stringsLength = packTokenInfos(vec, 0, NULL, NULL, 0);
+      } catch (const std::exception& e) {
+        error = e.what();
+      }
+    }
+    const uint64_t resultSize = sizeof(struct ShmResponse) +
+        vec.size() * sizeof(struct PackedTokenInfo) + stringsLength;
+    if (error.empty() && resultSize > shmMaxPayload(size)) {
+      error = "Result too large for the ring";
+    }
+    if (!error.empty()) {
+      vec.clear();
+      stringsLength = std::min<size_t>(
+          error.size(), shmMaxPayload(size) - sizeof(struct ShmResponse));
+    }
+    const uint32_t payload = sizeof(struct ShmResponse) +
+        vec.size() * sizeof(struct PackedTokenInfo) + stringsLength;
+    char* q = reserveShmResponse(s, payload);
+    if (q == NULL) {
+      return;
+    }
+    const struct ShmResponse resp = {
+      req.id, error.empty() ? 0u : 1u, static_cast<uint32_t>(vec.size()),
+      stringsLength,
+    };
+    memcpy(q, &resp, sizeof resp);
+    struct PackedTokenInfo* tokens =
+        reinterpret_cast<struct PackedTokenInfo*>(q + sizeof resp);
+    char* strings = reinterpret_cast<char*>(tokens + vec.size());
+    if (error.empty()) {
+      packTokenInfos(vec, 0, tokens, strings, 0);
+    } else {
+      memcpy(strings, error.data(), stringsLength);
+    }
+    shmCommit(&s->header->responses, size, payload);
+  }
+}
+
+void closeShmSegment(const struct ShmSegment* s) {
+  struct ShmHeader* h = s->header;
+  __atomic_store_n(&h->closed, 1, __ATOMIC_SEQ_CST);
+  shmFutex(&h->requests.head, FUTEX_WAKE, INT_MAX, NULL);
+  shmFutex(&h->requests.tail, FUTEX_WAKE, INT_MAX, NULL);
+  shmFutex(&h->responses.head, FUTEX_WAKE, INT_MAX, NULL);
+  shmFutex(&h->responses.tail, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+void freeShmSegment(const struct ShmSegment* s) {
+  if (s->header != NULL) {
+    munmap(s->header, sizeof *s->header + 2 * size_t(s->ringSize));
+    close(s->fd);
+  }
+  deallocate(s->error.p);
+}
+
+#endif  // __linux__
+
+const struct MemoryStats memoryStats() {
+  struct MemoryStats ret;
+  ret.instances = liveInstances;
+  ret.instanceBytes = liveInstanceBytes;
+  ret.results = liveResults;
+  ret.resultBytes = liveResultBytes;
+  ret.tokenInfos = liveTokenInfos;
+  ret.tokenInfoBytes = liveTokenInfoBytes;
+  ret.stringArrayBytes = liveStringArrayBytes;
+  ret.heapBytes = heapInUse();
+  return ret;
+}
+
+void setResultAccounting(int enabled) {
+  resultAccounting = enabled != 0;
+}
+
+int64_t instanceMemory(const Morf m) {
+  return icast(m)->getHeapBytes();
+}
+
+int64_t resultMemory(const Res r) {
+  std::lock_guard<std::mutex> lock(resultBytesMutex);
+  std::unordered_map<Res, int64_t>::const_iterator it = resultBytes.find(r);
+  return it == resultBytes.end() ? 0 : it->second;
+}
+
+void setAllocator(const struct Allocator* a) {
+  if (a == NULL) {
+    allocator = { defaultAllocate, defaultDeallocate, NULL };
+  } else {
+    allocator = *a;
+  }
 }
 
 const struct String version() {
@@ -1,12 +1,20 @@
 #ifndef MORFEUSZ_CGO_H
 #define MORFEUSZ_CGO_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif  // __cplusplus
 
 typedef void* Morf;
 typedef void* Res;
+typedef void* Router;
+typedef void* Cache;
+typedef void* Forms;
+typedef void* Sentences;
+typedef void* Vocab;
 // C++ code has to communicate with Go code via C.
 // Struct String is an intermediary type between
 // std::string and Go string and vice versa.
@@ -19,6 +27,11 @@ struct StringArray {
     const struct String* strings;
     int length;
 };
+// Struct TokenInfo stores short orths and lemmas inline instead of
+// allocating them. A string with a NULL p and length n is inline:
+// the orth starts at inlined[0] and the lemma right after the inline
+// orth, if any. Only the strings with a non-NULL p are freed.
+enum { TOKEN_INFO_INLINE_SIZE = 32 };
 struct TokenInfo {
     struct String orth;
     struct String lemma;
@@ -27,12 +40,176 @@ struct TokenInfo {
     int tagID;
     int nameID;
     int labelsID;
+    char inlined[TOKEN_INFO_INLINE_SIZE];
 };
 struct TokenInfoArray {
     const struct TokenInfo* tokens;
     int length;
     Error error;
 };
+// Struct PackedTokenInfo is a TokenInfo packed into 32 bytes. Its orth
+// and lemma are given by offsets and lengths in a separate string area;
+// interpretations may share them. document tells which of several
+// texts an interpretation comes from.
+struct PackedTokenInfo {
+    uint32_t orthOffset;
+    uint32_t lemmaOffset;
+    int32_t startNode;
+    int32_t endNode;
+    uint16_t orthLength;
+    uint16_t lemmaLength;
+    uint16_t tagID;
+    uint16_t nameID;
+    uint16_t labelsID;
+    uint16_t reserved;
+    uint32_t document;
+};
+// Struct PackedAnalysis holds the interpretations of several texts
+// packed into structs PackedTokenInfo, whose document is the index
+// of the text, and the string area they refer to.
+struct PackedAnalysis {
+    const struct PackedTokenInfo* tokens;
+    int tokensLength;
+    const char* strings;
+    int stringsLength;
+    Error error;
+};
+// Struct InternedTokenInfo is a TokenInfo whose orth and lemma are
+// replaced with their IDs in the process-wide table of interned
+// strings. The IDs stay the same for as long as the process lives.
+struct InternedTokenInfo {
+    uint32_t orthID;
+    uint32_t lemmaID;
+    int startNode;
+    int endNode;
+    int tagID;
+    int nameID;
+    int labelsID;
+};
+struct InternedAnalysis {
+    const struct InternedTokenInfo* tokens;
+    int length;
+    Error error;
+};
+// Struct InterpretationTokenInfo is an InternedTokenInfo whose lemma,
+// tag, name and labels are replaced with an interpretation ID, shared
+// by all the interpretations with the same lemma, tagID, nameID and
+// labelsID. The IDs are given in order by a process-wide table, up to
+// its limit; interpretationID is -1 when a new interpretation comes
+// after that.
+struct InterpretationTokenInfo {
+    uint32_t orthID;
+    int interpretationID;
+    int startNode;
+    int endNode;
+};
+struct InterpretationAnalysis {
+    const struct InterpretationTokenInfo* tokens;
+    int length;
+    Error error;
+};
+// Struct Lemmas holds the distinct lemmas of every segment
+// of a text, packed into a single character array. Lemma i spans
+// heap[offsets[i]] to heap[offsets[i + 1]]; the lemmas of a segment
+// are lemmasLength consecutive lemmas starting with firstLemma.
+struct SegmentLemmas {
+    int startNode;
+    int endNode;
+    int firstLemma;
+    int lemmasLength;
+};
+struct Lemmas {
+    const char* heap;
+    const int* offsets;
+    int lemmasLength;
+    const struct SegmentLemmas* segments;
+    int segmentsLength;
+    Error error;
+};
+struct Buffer {
+    struct String data;
+    Error error;
+};
+// Enum Format selects the serialization of serializeAnalysis.
+// Every interpretation becomes one record:
+//  * TSV_FORMAT: startNode, endNode, orth, lemma, tag, name and labels
+//    separated by tabs and terminated by a newline; tabs, newlines,
+//    carriage returns and backslashes in the strings are escaped
+//    as \t, \n, \r and \\,
+//  * JSON_LINES_FORMAT: a JSON object with the keys "start", "end",
+//    "orth", "lemma", "tag", "name" and "labels", terminated by a newline,
+//  * BINARY_FORMAT: startNode and endNode as 32-bit little-endian
+//    integers followed by orth, lemma, tag, name and labels, each as
+//    a 32-bit little-endian length and that many bytes,
+//  * COMPACT_FORMAT: see below.
+enum Format {
+    TSV_FORMAT,
+    JSON_LINES_FORMAT,
+    BINARY_FORMAT,
+    COMPACT_FORMAT
+};
+// COMPACT_FORMAT is built of unsigned LEB128 varints. It starts with
+// the format version and the length and bytes of the dictionary ID.
+// Then, for every interpretation, it holds:
+//  * startNode minus the previous startNode (0 for the first one),
+//    zigzag-encoded,
+//  * endNode minus startNode,
+//  * tagId, nameId and labelsId,
+//  * orth and lemma, each as a string reference: either 0 followed
+//    by the length and bytes of a new string, or k > 0 standing for
+//    the k-th new string seen so far.
+// Since tag, name and labels are stored as IDs, the data can only
+// be decoded with the dictionary whose ID it carries.
+enum { COMPACT_FORMAT_VERSION = 1 };
+// The Arrow C data interface, as specified at
+// https://arrow.apache.org/docs/format/CDataInterface.html
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+    void (*release)(struct ArrowSchema*);
+    void* private_data;
+};
+
+struct ArrowArray {
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+    void (*release)(struct ArrowArray*);
+    void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+// Struct RecordBatch holds the result of morphological analysis of
+// several documents as an Arrow struct array with one row for every
+// interpretation and the columns:
+//  * document, start_node, end_node: int32,
+//  * orth, lemma: utf8,
+//  * tag, name, labels: dictionary-encoded utf8 with int32 indices
+//    equal to the IDs of the IdResolver and all its strings
+//    as the dictionary.
+struct RecordBatch {
+    struct ArrowSchema* schema;
+    struct ArrowArray* array;
+    Error error;
+};
 enum Charset {
     UTF8,
     ISO8859_2,
@@ -53,13 +230,279 @@ enum WhitespaceHandling {
     APPEND_WHITESPACES,
     KEEP_WHITESPACES
 };
+// ANALYSE_AND_LAZY_GENERATE loads only the analysis data of
+// the dictionary. The generation data is loaded on the first call
+// to generate or generateWithTagID, once for an instance and its
+// clones. ANALYSE_AND_GENERATE_IN_PARALLEL loads the analysis and
+// generation data of the dictionary into two instances of Morfeusz
+// on two threads at the same time; analysis and generation go
+// to the right one.
 enum Usage {
     BOTH_ANALYSE_AND_GENERATE,
     ANALYSE_ONLY,
-    GENERATE_ONLY
+    GENERATE_ONLY,
+    ANALYSE_AND_LAZY_GENERATE,
+    ANALYSE_AND_GENERATE_IN_PARALLEL
+};
+// Struct Config carries all the parameters of a new instance
+// so that it can be created and configured in a single call.
+// Empty aggl and praet leave the dictionary defaults in place.
+struct Config {
+    struct String dictName;
+    struct String aggl;
+    struct String praet;
+    enum Charset charset;
+    enum TokenNumbering tokenNumbering;
+    enum CaseHandling caseHandling;
+    enum WhitespaceHandling whitespaceHandling;
+    enum Usage usage;
+};
+// Enum ConfigField tells which field of struct Config was rejected.
+enum ConfigField {
+    CONFIG_OK,
+    CONFIG_DICT_NAME,
+    CONFIG_AGGL,
+    CONFIG_PRAET,
+    CONFIG_CHARSET,
+    CONFIG_TOKEN_NUMBERING,
+    CONFIG_CASE_HANDLING,
+    CONFIG_WHITESPACE_HANDLING,
+    CONFIG_USAGE
+};
+struct NewInstance {
+    Morf morf;
+    enum ConfigField field;
+    Error error;
+};
+// Struct Options carries the settings that analyseStringWithOptions
+// applies to a single call. Empty aggl and praet leave the settings
+// of the instance in place.
+struct Options {
+    struct String aggl;
+    struct String praet;
+    enum TokenNumbering tokenNumbering;
+    enum CaseHandling caseHandling;
+    enum WhitespaceHandling whitespaceHandling;
+};
+struct Analysis {
+    Res res;
+    Error error;
+};
+struct NewDictionary {
+    int id;
+    enum ConfigField field;
+    Error error;
+};
+// Struct Prefork describes the worker processes started by
+// preforkServe. They accept connections on the Unix socket listener
+// and answer every request, a 32-bit little-endian length followed
+// by that many bytes of text, with a 32-bit little-endian status
+// (0 for success, 1 for an error), a 32-bit little-endian length and
+// that many bytes of the analysis serialized in the chosen format
+// or of the error message.
+struct Prefork {
+    const int* pids;
+    int pidsLength;
+    int listener;
+    Error error;
+};
+// Enum WarmupLevel tells warmup how much to do:
+//  * WARMUP_BASIC: read every tag, name and labels string, analyse
+//    a built-in set of sentences and generate the forms of a built-in
+//    set of lemmas covering the common paradigms,
+//  * WARMUP_FULL: also analyse every form generated in the process.
+enum WarmupLevel {
+    WARMUP_BASIC,
+    WARMUP_FULL
+};
+// Struct Warmup reports what warmup did and how long it took.
+// Calls that the instance is not capable of, like generation with
+// ANALYSE_ONLY, are skipped and not counted. So are all analyses
+// and generations with a charset other than UTF8, as the built-in
+// sentences and lemmas are in UTF-8.
+struct Warmup {
+    int64_t nanoseconds;
+    int analyses;
+    int generations;
+    Error error;
+};
+// Struct MemoryStats reports the memory held by the shim. Instances
+// and results are charged with the growth of the heap measured
+// around the calls that create them (only while setResultAccounting
+// is on, for results), which includes whatever other threads allocate
+// at the same time. The growth is 0 where the C library does not
+// report heap usage (glibc older than 2.33 and non-glibc systems).
+// tokenInfos and tokenInfoBytes count the live TokenInfo structs with
+// strings that are not inline and those strings, and the bytes of
+// the live TokenInfoArray arrays; stringArrayBytes counts the live
+// StringArray arrays and their strings.
+struct MemoryStats {
+    int64_t instances;
+    int64_t instanceBytes;
+    int64_t results;
+    int64_t resultBytes;
+    int64_t tokenInfos;
+    int64_t tokenInfoBytes;
+    int64_t stringArrayBytes;
+    int64_t heapBytes;
+};
+// An analysis cache maps the texts analysed with the same dictionary
+// and settings to their interpretations. It is a hash table in a file
+// mapped into memory, which any number of processes can read at once.
+// The instances that use it append the interpretations of the texts
+// missing from the table to a log next to it, path + ".log", which
+// compactAnalysisCache merges into a new table. Analyses with
+// CONTINUOUS_NUMBERING and interpretations that do not fit in struct
+// PackedTokenInfo are not cached.
+struct NewCache {
+    Cache cache;
+    Error error;
+};
+struct AnalysisCacheStats {
+    int64_t entries;
+    int64_t hits;
+    int64_t misses;
+};
+// A sentence cache keeps in memory the analyses of the texts analysed
+// most often, within a memory budget in bytes. It admits a new text
+// only if it has been analysed more often than the texts it would
+// evict. Instances consult it after their form table and before their
+// analysis cache, except with CONTINUOUS_NUMBERING.
+struct SentenceCacheStats {
+    int64_t entries;
+    int64_t bytes;
+    int64_t hits;
+    int64_t misses;
+    int64_t rejected;
+};
+// A form table holds the analyses of a fixed set of texts, usually
+// the most frequent word forms, made in advance and looked up with
+// a perfect hash function in a file mapped into memory. Instances
+// consult it before their analysis cache.
+struct NewForms {
+    Forms forms;
+    Error error;
+};
+struct FormTableStats {
+    int64_t hits;
+    int64_t misses;
+};
+// A vocabulary holds the analyses of the distinct words of a corpus,
+// made once each and copied to every occurrence of the words.
+struct NewVocabulary {
+    Vocab vocabulary;
+    Error error;
 };
 Morf createInstance(const struct String dictName, enum Usage usage);
+const struct NewInstance createInstanceWithConfig(const struct Config* config);
 Res analyseString(const Morf m, const struct String text);
+const struct Analysis analyseStringWithOptions(
+    const Morf m, const struct String text, const struct Options* options);
+const struct Analysis analyseStringWithFallback(
+    const Morf m, Morf fallback, const struct String text);
+const struct Lemmas analyseLemmas(const Morf m, const struct String text);
+const struct Buffer serializeAnalysis(
+    const Morf m, const struct String text, enum Format format);
+// serializeAnalysisBatch serializes the analyses of count texts,
+// concatenated in texts, into one buffer and stores the size of every
+// analysis in sizes. Whenever it gives the same results, the texts
+// are analysed together in a single pass.
+const struct Buffer serializeAnalysisBatch(
+    const Morf m, const struct String texts, const int* lengths, int count,
+    enum Format format, int* sizes);
+const struct TokenInfoArray decodeCompact(
+    const Morf m, const struct String data);
+const struct RecordBatch analyseRecordBatch(
+    const Morf m, const struct String texts, const int* lengths, int count);
+// warmup brings the dictionary of m into memory and initializes
+// whatever Morfeusz builds lazily, so that the first requests are
+// not slower than the rest. Clones of m made afterwards share the
+// warm dictionary.
+const struct Warmup warmup(const Morf m, enum WarmupLevel level);
+// analysePacked analyses count texts, concatenated in texts, into
+// one struct PackedAnalysis. It fails when the dictionary has more
+// than 65536 tags, names or labels.
+const struct PackedAnalysis analysePacked(
+    const Morf m, const struct String texts, const int* lengths, int count);
+const struct InternedAnalysis analyseInterned(
+    const Morf m, const struct String text);
+// resolveInterned concatenates the interned strings with count ids
+// into one buffer and stores the length of every string in lengths.
+// It fails when a string with one of the ids has not been interned.
+const struct Buffer resolveInterned(
+    const uint32_t* ids, int count, int* lengths);
+// internedCount returns the number of interned strings. Their IDs
+// are 0 to internedCount() - 1.
+int64_t internedCount(void);
+// setInternedLimit bounds the number of interned strings, 16777216
+// by default and at most 4294967296. A lower limit does not forget
+// the strings already interned. Interning a new string beyond it fails.
+void setInternedLimit(int64_t limit);
+const struct InterpretationAnalysis analyseInterpretations(
+    const Morf m, const struct String text);
+// resolveInterpretations stores the interned lemma ID, tag ID, name ID
+// and labels ID of the interpretations with count ids in lemmaIDs,
+// tagIDs, nameIDs and labelsIDs. It fails on an unknown ID.
+const Error resolveInterpretations(
+    const int* ids, int count, uint32_t* lemmaIDs,
+    int* tagIDs, int* nameIDs, int* labelsIDs);
+int64_t interpretationsCount(void);
+// setInterpretationsLimit bounds the number of interpretation IDs,
+// 4194304 by default and at most INT_MAX. A lower limit does not
+// forget the IDs already given.
+void setInterpretationsLimit(int64_t limit);
+// saveInterpretations writes the table of interpretations to a file
+// at path together with the tagset ID of m. loadInterpretations fills
+// the empty table from such a file, so that the interpretations get
+// the same IDs as before. It fails when m has another tagset or the
+// table has been used. The lemmas may get new interned string IDs.
+const Error saveInterpretations(const Morf m, const struct String path);
+const Error loadInterpretations(const Morf m, const struct String path);
+// openAnalysisCache opens the analysis cache at path, which need not
+// exist yet, and its log.
+const struct NewCache openAnalysisCache(const struct String path);
+// setAnalysisCache makes m and its later clones consult c, or no
+// cache if c is NULL. c can be freed afterwards.
+void setAnalysisCache(Morf m, const Cache c);
+const struct AnalysisCacheStats analysisCacheStats(const Cache c);
+// compactAnalysisCache replaces the table of the analysis cache at path
+// with one that holds also the entries in its log, and empties the log.
+// It is meant to run while no process writes to the log.
+const Error compactAnalysisCache(const struct String path);
+Sentences newSentenceCache(int64_t budget);
+// setSentenceCache makes m and its later clones consult s, or no
+// sentence cache if s is NULL. s can be freed afterwards.
+void setSentenceCache(Morf m, const Sentences s);
+const struct SentenceCacheStats sentenceCacheStats(const Sentences s);
+// buildFormTable writes to path a form table with the analyses
+// of count texts, concatenated in forms, made by clones of m
+// on threads threads. The table records the dictionary ID and
+// the settings of m. It fails with CONTINUOUS_NUMBERING.
+const Error buildFormTable(
+    const Morf m, const struct String forms, const int* lengths, int count,
+    int threads, const struct String path);
+const struct NewForms openFormTable(const struct String path);
+// setFormTable makes m and its later clones consult f, or no form
+// table if f is NULL. With SKIP_WHITESPACES texts are looked up word
+// by word. It fails when f was built with a different
+// dictionary or settings. f can be freed afterwards.
+const Error setFormTable(Morf m, const Forms f);
+int formTableSize(const Forms f);
+const struct FormTableStats formTableStats(const Forms f);
+// buildVocabulary analyses count words, concatenated in words,
+// with clones of m on threads threads. It fails unless m skips
+// whitespace and numbers nodes separately.
+const struct NewVocabulary buildVocabulary(
+    const Morf m, const struct String words, const int* lengths, int count,
+    int threads);
+// serializeAnalysisWithVocabulary serializes the analysis of text
+// like serializeAnalysis, copying the analyses of its words from v
+// and analysing only the words missing there. It fails when v was
+// made with a different dictionary or settings.
+const struct Buffer serializeAnalysisWithVocabulary(
+    const Morf m, const Vocab v, const struct String text,
+    enum Format format);
+int vocabularySize(const Vocab v);
 int hasNext(Res r);
 const struct TokenInfo next(Res r);
 const struct String tagsetId(const Morf m);
@@ -100,14 +543,67 @@ void appendToDictionarySearchPaths(Morf m, const struct String path);
 int removeFromDictionarySearchPaths(Morf m, const struct String path);
 void clearDictionarySearchPaths(Morf m);
 Morf cloneMorf(const Morf m);
+Router createRouter(void);
+const struct NewDictionary routerAddDictionary(
+    Router r, const struct Config* config);
+int routerSize(const Router r);
+Morf routerInstance(const Router r, int dictId);
+const struct Analysis routerAnalyseString(
+    const Router r, int dictId, const struct String text);
+const struct TokenInfoArray routerGenerate(
+    const Router r, int dictId, const struct String lemma);
+const struct TokenInfoArray routerGenerateWithTagID(
+    const Router r, int dictId, int tagId, const struct String lemma);
+const struct Prefork preforkServe(
+    const Morf m, const struct String path, enum Format format, int workers);
+const struct MemoryStats memoryStats(void);
+// setResultAccounting turns the measurement of results on or off.
+// It is off by default, as it costs a call to mallinfo2 per result.
+void setResultAccounting(int enabled);
+// instanceMemory returns the heap growth measured when m was
+// created or cloned.
+int64_t instanceMemory(const Morf m);
+// resultMemory returns the heap growth measured when r was created,
+// or 0 if it was not measured.
+int64_t resultMemory(const Res r);
+// Struct Allocator holds the functions with which the shim allocates
+// the memory that it hands over to the caller, like the strings and
+// arrays in the structs above, and frees it in the free* functions.
+// allocate returns NULL when it runs out of memory. context is passed
+// to both functions. The objects that the caller only refers to, like
+// instances and results, live on the C++ heap, and so does the memory
+// allocated inside Morfeusz.
+struct Allocator {
+    void* (*allocate)(size_t size, void* context);
+    void (*deallocate)(void* p, void* context);
+    void* context;
+};
+// setAllocator makes the shim use the functions in *a, or operator new
+// and operator delete if a is NULL. It must not be called while
+// another thread uses the shim or any memory allocated with
+// the previous functions is still to be freed. The workers started by
+// preforkServe use operator new and operator delete regardless.
+void setAllocator(const struct Allocator* a);
 const struct String version(void);
 const struct String defaultDictName(void);
 const struct String copyright(void);
 void freeMorf(const Morf m);
 void freeRes(const Res r);
+void freeRouter(const Router r);
+void freeAnalysisCache(const Cache c);
+void freeSentenceCache(const Sentences s);
+void freeFormTable(const Forms f);
+void freeVocabulary(const Vocab v);
 void freeTokenInfo(const struct TokenInfo* t);
 void freeStringArray(const struct StringArray* arr);
 void freeTokenInfoArray(const struct TokenInfoArray* arr);
+void freeLemmas(const struct Lemmas* l);
+void freeBuffer(const struct Buffer* b);
+void freePackedAnalysis(const struct PackedAnalysis* a);
+void freeInternedAnalysis(const struct InternedAnalysis* a);
+void freeInterpretationAnalysis(const struct InterpretationAnalysis* a);
+void freeRecordBatch(const struct RecordBatch* b);
+void freePrefork(const struct Prefork* p);
 void freeCharArray(const char* p);
 
 #ifdef __cplusplus
@@ -0,0 +1,322 @@
+#ifndef MORFEUSZ_SHM_H
+#define MORFEUSZ_SHM_H
+
+// The shared-memory transport between morfeusz-daemon and clients
+// on the same host. A segment, created with memfd_create and passed
+// to the client over a Unix socket, holds a struct ShmHeader followed
+// by the data of two rings of ringSize bytes: requests from
+// the client and responses from the server. Each ring has a single
+// producer and a single consumer and carries records: a 32-bit length
+// and that many bytes of payload, padded to 8 bytes. A record that
+// does not fit before the end of the ring is preceded by SHM_WRAP
+// and placed at the beginning. head and tail count the bytes written
+// and consumed; a side that finds its ring empty or full sets
+// headWaiting or tailWaiting and sleeps on a futex on head or tail.
+//
+// A request holds a struct ShmRequest and the text. A response holds
+// a struct ShmResponse, tokensLength structs PackedTokenInfo and
+// stringsLength bytes of orths and lemmas, which the offsets
+// in PackedTokenInfo point into. The response to a failed request
+// has a nonzero status and the error message in place of the strings.
+//
+// Either side can write anywhere in the segment, so neither trusts
+// what the other one wrote: each keeps its own copy of ringSize and
+// checks head, tail and the length of a record before touching it.
+// A side that finds a ring corrupt closes the segment.
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "morfeusz-cgo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+enum {
+    SHM_MAGIC = 0x4d534852,
+    SHM_VERSION = 1,
+    SHM_MIN_RING_SIZE = 4096,
+    SHM_SPIN = 4096
+};
+#define SHM_WRAP 0xffffffffu
+// Returned by shmReserve and shmPeek when the ring is corrupt.
+#define SHM_CORRUPT ((char*)-1)
+
+struct ShmRing {
+    uint32_t head;
+    uint32_t headWaiting;
+    char pad0[56];
+    uint32_t tail;
+    uint32_t tailWaiting;
+    char pad1[56];
+};
+struct ShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ringSize;
+    uint32_t closed;
+    char pad[48];
+    struct ShmRing requests;
+    struct ShmRing responses;
+};
+struct ShmRequest {
+    uint32_t id;
+    uint32_t length;
+};
+struct ShmResponse {
+    uint32_t id;
+    uint32_t status;
+    uint32_t tokensLength;
+    uint32_t stringsLength;
+};
+struct ShmSegment {
+    struct ShmHeader* header;
+    char* requests;
+    char* responses;
+    // The size of the rings the segment was mapped with. The copy
+    // in the header can be changed by the other side.
+    uint32_t ringSize;
+    int fd;
+    Error error;
+};
+
+// createShmSegment creates a segment with rings of ringSize bytes,
+// a power of two not smaller than SHM_MIN_RING_SIZE.
+const struct ShmSegment createShmSegment(int ringSize);
+// attachShmSegment maps the segment referred to by fd.
+const struct ShmSegment attachShmSegment(int fd);
+// serveShm answers the requests in the segment with m until
+// the segment is closed.
+void serveShm(const Morf m, const struct ShmSegment* s);
+// closeShmSegment tells both sides that the segment is closed.
+void closeShmSegment(const struct ShmSegment* s);
+void freeShmSegment(const struct ShmSegment* s);
+
+static inline long shmFutex(
+    uint32_t* addr, int op, uint32_t value, const struct timespec* timeout) {
+  return syscall(SYS_futex, addr, op, value, timeout, NULL, 0);
+}
+
+// The largest payload of a record in a ring of size bytes.
+static inline uint32_t shmMaxPayload(uint32_t size) {
+  return size / 2 - 8;
+}
+
+static inline uint32_t shmRecordSize(uint32_t n) {
+  return (4 + n + 7) & ~7u;
+}
+
+// Returns the number of bytes to skip at the end of the ring before
+// a record with n bytes of payload, or UINT32_MAX if it does not fit.
+static inline uint32_t shmSkip(
+    uint32_t head, uint32_t tail, uint32_t size, uint32_t n) {
+  const uint32_t need = shmRecordSize(n);
+  const uint32_t left = size - (head & (size - 1));
+  const uint32_t skip = left < need ? left : 0;
+  return size - (head - tail) < skip + need ? UINT32_MAX : skip;
+}
+
+// Returns whether head and tail cannot have been written by
+// a well-behaved side: a ring holds at most size bytes and records
+// start at multiples of 8.
+static inline int shmCorrupt(uint32_t head, uint32_t tail, uint32_t size) {
+  return head - tail > size || ((head | tail) & 7) != 0;
+}
+
+// Returns where to write a record with n bytes of payload, NULL
+// if there is no room for it or SHM_CORRUPT. Producer only.
+static inline char* shmReserve(
+    struct ShmRing* r, char* data, uint32_t size, uint32_t n) {
+  const uint32_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+  const uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+  if (shmCorrupt(head, tail, size)) {
+    return SHM_CORRUPT;
+  }
+  const uint32_t skip = shmSkip(head, tail, size, n);
+  if (skip == UINT32_MAX) {
+    return NULL;
+  }
+  uint32_t pos = head & (size - 1);
+  if (skip != 0) {
+    *(uint32_t*)(data + pos) = SHM_WRAP;
+    pos = 0;
+  }
+  *(uint32_t*)(data + pos) = n;
+  return data + pos + 4;
+}
+
+// Publishes the record reserved with shmReserve. Producer only.
+static inline void shmCommit(struct ShmRing* r, uint32_t size, uint32_t n) {
+  const uint32_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+  const uint32_t left = size - (head & (size - 1));
+  const uint32_t need = shmRecordSize(n);
+  const uint32_t skip = left < need ? left : 0;
+  __atomic_store_n(&r->head, head + skip + need, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&r->headWaiting, __ATOMIC_SEQ_CST)) {
+    shmFutex(&r->head, FUTEX_WAKE, 1, NULL);
+  }
+}
+
+// Returns the payload of the oldest record and stores its length
+// in n, or returns NULL if the ring is empty or SHM_CORRUPT
+// if the record does not lie where shmReserve would have put it.
+// Consumer only.
+static inline const char* shmPeek(
+    struct ShmRing* r, const char* data, uint32_t size, uint32_t* n) {
+  const uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+  const uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+  if (shmCorrupt(head, tail, size)) {
+    return SHM_CORRUPT;
+  }
+  if (head == tail) {
+    return NULL;
+  }
+  uint32_t pos = tail & (size - 1);
+  const uint32_t left = size - pos;
+  uint32_t skip = 0;
+  if (*(const uint32_t*)(data + pos) == SHM_WRAP) {
+    skip = left;
+    pos = 0;
+  }
+  const uint32_t length = *(const uint32_t*)(data + pos);
+  if (length > shmMaxPayload(size)) {
+    return SHM_CORRUPT;
+  }
+  const uint32_t need = shmRecordSize(length);
+  if ((skip != 0) != (left < need) || skip + need > head - tail) {
+    return SHM_CORRUPT;
+  }
+  *n = length;
+  return data + pos + 4;
+}
+
+// Drops the oldest record, whose payload has n bytes. Consumer only.
+static inline void shmRelease(struct ShmRing* r, uint32_t size, uint32_t n) {
+  const uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+  const uint32_t left = size - (tail & (size - 1));
+  const uint32_t need = shmRecordSize(n);
+  const uint32_t skip = left < need ? left : 0;
+  __atomic_store_n(&r->tail, tail + skip + need, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&r->tailWaiting, __ATOMIC_SEQ_CST)) {
+    shmFutex(&r->tail, FUTEX_WAKE, 1, NULL);
+  }
+}
+
+// Waits until the ring is not empty or the timeout expires.
+// Consumer only.
+static inline void shmWaitForData(
+    struct ShmRing* r, const struct timespec* timeout) {
+  const uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+  for (int i = 0; i < SHM_SPIN; ++i) {
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != tail) {
+      return;
+    }
+  }
+  __atomic_store_n(&r->headWaiting, 1, __ATOMIC_SEQ_CST);
+  const uint32_t head = __atomic_load_n(&r->head, __ATOMIC_SEQ_CST);
+  if (head == tail) {
+    shmFutex(&r->head, FUTEX_WAIT, head, timeout);
+  }
+  __atomic_store_n(&r->headWaiting, 0, __ATOMIC_RELAXED);
+}
+
+// Waits until the ring has room for a record with n bytes of payload
+// or the timeout expires. Producer only.
+static inline void shmWaitForRoom(
+    struct ShmRing* r, uint32_t size, uint32_t n,
+    const struct timespec* timeout) {
+  const uint32_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+  for (int i = 0; i < SHM_SPIN; ++i) {
+    const uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (shmSkip(head, tail, size, n) != UINT32_MAX) {
+      return;
+    }
+  }
+  __atomic_store_n(&r->tailWaiting, 1, __ATOMIC_SEQ_CST);
+  const uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST);
+  if (shmSkip(head, tail, size, n) == UINT32_MAX) {
+    shmFutex(&r->tail, FUTEX_WAIT, tail, timeout);
+  }
+  __atomic_store_n(&r->tailWaiting, 0, __ATOMIC_RELAXED);
+}
+
+static inline int shmClosed(const struct ShmSegment* s) {
+  return __atomic_load_n(&s->header->closed, __ATOMIC_ACQUIRE);
+}
+
+// How long a blocked side sleeps before it checks whether
+// the segment has been closed.
+static const struct timespec shmPollInterval = { 0, 100 * 1000 * 1000 };
+
+// Sends a request. Returns 0 on success, -1 if the segment has been
+// closed or -2 if the text is too long.
+static inline int shmSend(
+    const struct ShmSegment* s, uint32_t id, const char* text,
+    uint32_t length) {
+  struct ShmRing* r = &s->header->requests;
+  const uint32_t size = s->ringSize;
+  const uint32_t n = sizeof(struct ShmRequest) + length;
+  if (length > shmMaxPayload(size) - sizeof(struct ShmRequest)) {
+    return -2;
+  }
+  char* p;
+  while ((p = shmReserve(r, s->requests, size, n)) == NULL) {
+    if (shmClosed(s)) {
+      return -1;
+    }
+    shmWaitForRoom(r, size, n, &shmPollInterval);
+  }
+  if (p == SHM_CORRUPT) {
+    closeShmSegment(s);
+    return -1;
+  }
+  struct ShmRequest* req = (struct ShmRequest*)p;
+  req->id = id;
+  req->length = length;
+  memcpy(p + sizeof(struct ShmRequest), text, length);
+  shmCommit(r, size, n);
+  return 0;
+}
+
+// Waits for a response and returns it, or returns NULL if the segment
+// has been closed. The response stays valid until shmDone.
+static inline const struct ShmResponse* shmReceive(
+    const struct ShmSegment* s) {
+  struct ShmRing* r = &s->header->responses;
+  const uint32_t size = s->ringSize;
+  const char* p;
+  uint32_t n;
+  while ((p = shmPeek(r, s->responses, size, &n)) == NULL) {
+    if (shmClosed(s)) {
+      return NULL;
+    }
+    shmWaitForData(r, &shmPollInterval);
+  }
+  if (p == SHM_CORRUPT) {
+    closeShmSegment(s);
+    return NULL;
+  }
+  return (const struct ShmResponse*)p;
+}
+
+// Drops the response returned by shmReceive.
+static inline void shmDone(const struct ShmSegment* s) {
+  struct ShmRing* r = &s->header->responses;
+  uint32_t n;
+  const char* p = shmPeek(r, s->responses, s->ringSize, &n);
+  if (p != NULL && p != SHM_CORRUPT) {
+    shmRelease(r, s->ringSize, n);
+  }
+}
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif  // __cplusplus
+
+#endif  // MORFEUSZ_SHM_H
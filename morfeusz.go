@@ -16,13 +16,65 @@ static struct String makeStructString(_GoString_ s) {
   struct String ret = { _GoStringPtr(s), _GoStringLen(s) };
   return ret;
 }
+
+static struct Config makeConfig(
+    _GoString_ dictName, _GoString_ aggl, _GoString_ praet,
+    enum Charset charset, enum TokenNumbering tokenNumbering,
+    enum CaseHandling caseHandling,
+    enum WhitespaceHandling whitespaceHandling, enum Usage usage) {
+  struct Config c = {
+    makeStructString(dictName), makeStructString(aggl),
+    makeStructString(praet), charset, tokenNumbering,
+    caseHandling, whitespaceHandling, usage,
+  };
+  return c;
+}
+
+static struct NewInstance createInstanceFromGo(
+    _GoString_ dictName, _GoString_ aggl, _GoString_ praet,
+    enum Charset charset, enum TokenNumbering tokenNumbering,
+    enum CaseHandling caseHandling,
+    enum WhitespaceHandling whitespaceHandling, enum Usage usage) {
+  struct Config c = makeConfig(
+      dictName, aggl, praet, charset, tokenNumbering,
+      caseHandling, whitespaceHandling, usage);
+  return createInstanceWithConfig(&c);
+}
+
+static struct NewDictionary routerAddDictionaryFromGo(
+    Router r, _GoString_ dictName, _GoString_ aggl, _GoString_ praet,
+    enum Charset charset, enum TokenNumbering tokenNumbering,
+    enum CaseHandling caseHandling,
+    enum WhitespaceHandling whitespaceHandling, enum Usage usage) {
+  struct Config c = makeConfig(
+      dictName, aggl, praet, charset, tokenNumbering,
+      caseHandling, whitespaceHandling, usage);
+  return routerAddDictionary(r, &c);
+}
+
+static struct Analysis analyseStringWithGoOptions(
+    Morf m, _GoString_ text, _GoString_ aggl, _GoString_ praet,
+    enum TokenNumbering tokenNumbering, enum CaseHandling caseHandling,
+    enum WhitespaceHandling whitespaceHandling) {
+  struct Options o = {
+    makeStructString(aggl), makeStructString(praet),
+    tokenNumbering, caseHandling, whitespaceHandling,
+  };
+  return analyseStringWithOptions(m, makeStructString(text), &o);
+}
 */
 import "C"
 
 import (
+	"bufio"
 	"errors"
 	"fmt"
+	"os"
 	"runtime"
+	"strconv"
+	"strings"
+	"syscall"
+	"time"
 	"unsafe"
 )
 
@@ -30,6 +82,8 @@ import (
 // analysis and/or generation.
 type Morfeusz struct {
 	morf C.Morf
+	// router keeps alive the Router that owns morf, if any.
+	router *Router
 }
 
 // Result is the type of a struct representing the result
@@ -38,12 +92,155 @@ type Result struct {
 	res C.Res
 }
 
+// Router is the type of a struct holding instances of Morfeusz
+// for several dictionaries, selected by small integer IDs.
+type Router struct {
+	router C.Router
+}
+
 // TokenInfo is the type of a struct representing the morphological
 // interpretation of a token in the result of morphological analysis.
 type TokenInfo struct {
 	info C.struct_TokenInfo
 }
 
+// RecordBatch is the type of a struct holding the result
+// of morphological analysis of several documents in the columnar
+// Arrow format, exported through the Arrow C data interface.
+type RecordBatch struct {
+	batch C.struct_RecordBatch
+}
+
+// PreforkServer is the type of a struct representing worker
+// processes forked by Prefork.
+type PreforkServer struct {
+	path     string
+	listener int
+	pids     []int
+}
+
+// WorkerMemory is the type of a struct describing the memory
+// of a worker process, in bytes. Shared memory is mapped by other
+// processes too, in particular the copy-on-write pages inherited from
+// the parent; PSS divides it evenly among the processes sharing it.
+type WorkerMemory struct {
+	PID     int
+	RSS     uint64
+	PSS     uint64
+	Shared  uint64
+	Private uint64
+}
+
+// MemoryStats is the type of a struct describing the memory held
+// by the C++ objects behind the values of this package, in bytes.
+// InstanceBytes and ResultBytes add up the growth of the heap measured
+// when the live instances and results were created, which includes
+// whatever other threads allocated at the same time. Results are
+// measured only after SetResultAccounting(true). TokenInfos counts
+// the live TokenInfo structs with an orth or lemma too long to be
+// stored inline, and TokenInfoBytes covers those strings; StringArrayBytes
+// covers string slices being copied out of C++. HeapBytes is the size
+// of the C heap. The byte counts that come from the heap are 0 unless
+// the C library is glibc 2.33 or newer.
+type MemoryStats struct {
+	Instances        int
+	InstanceBytes    int64
+	Results          int
+	ResultBytes      int64
+	TokenInfos       int
+	TokenInfoBytes   int64
+	StringArrayBytes int64
+	HeapBytes        int64
+}
+
+// AnalysisCache is the type of a struct representing an analysis
+// cache: a hash table in a file, mapped into memory and shared by all
+// the processes that use it, from texts analysed with the same
+// dictionary and settings to their interpretations. The instances
+// that use the cache log the texts missing from it, and
+// CompactAnalysisCache merges the log into the table.
+type AnalysisCache struct {
+	cache C.Cache
+}
+
+// AnalysisCacheStats is the type of a struct holding the number
+// of entries in the table of an AnalysisCache and the numbers of
+// analyses that found their texts there or not.
+type AnalysisCacheStats struct {
+	Entries int64
+	Hits    int64
+	Misses  int64
+}
+
+// SentenceCache is the type of a struct representing a cache that
+// keeps in memory the analyses of the texts analysed most often,
+// such as boilerplate sentences, within a memory budget. A text
+// missing from a full cache is only admitted if it has been analysed
+// more often than the least recently used texts it would evict.
+type SentenceCache struct {
+	cache C.Sentences
+}
+
+// SentenceCacheStats is the type of a struct holding the number
+// of texts in a SentenceCache and the bytes they take, the numbers
+// of analyses that found their texts there or not, and the number
+// of texts that were not admitted.
+type SentenceCacheStats struct {
+	Entries  int64
+	Bytes    int64
+	Hits     int64
+	Misses   int64
+	Rejected int64
+}
+
+// FormTable is the type of a struct representing a form table:
+// the analyses of a fixed set of texts, usually the most frequent
+// word forms, made in advance by BuildFormTable and looked up with
+// a perfect hash function in a file mapped into memory.
+type FormTable struct {
+	forms C.Forms
+}
+
+// FormTableStats is the type of a struct holding the numbers
+// of analyses that found their texts in a FormTable or not.
+type FormTableStats struct {
+	Hits   int64
+	Misses int64
+}
+
+// Vocabulary is the type of a struct holding the analyses
+// of the distinct words of a corpus, made once each by NewVocabulary
+// and copied to every occurrence of the words by
+// AnalyseStringAsWithVocabulary.
+type Vocabulary struct {
+	vocabulary C.Vocab
+}
+
+// Columns is the type of a struct holding a copy of the columns
+// of a RecordBatch. The orth of row i is Orth[OrthOffsets[i]:
+// OrthOffsets[i+1]], and likewise for the lemma. Tags, names and labels
+// are given by their IDs.
+type Columns struct {
+	Document     []int32
+	StartNode    []int32
+	EndNode      []int32
+	OrthOffsets  []int32
+	Orth         []byte
+	LemmaOffsets []int32
+	Lemma        []byte
+	TagID        []int32
+	NameID       []int32
+	LabelsID     []int32
+}
+
+// SegmentLemmas is the type of a struct holding the distinct lemmas
+// of a segment in the result of morphological analysis.
+type SegmentLemmas struct {
+	StartNode int
+	EndNode   int
+	Lemmas    []string
+}
+
 type (
 	// Charset determines the encoding that Morfeusz uses
 	// in its input and output.
@@ -59,6 +256,11 @@ type (
 	// Usage determines whether Morfeusz is capable of
 	// morphological analysis and/or generation.
 	Usage C.enum_Usage
+	// Format determines the serialization of the result
+	// of morphological analysis in AnalyseStringAs.
+	Format C.enum_Format
+	// WarmupLevel determines how much work Warmup does.
+	WarmupLevel C.enum_WarmupLevel
 )
 
 const (
@@ -119,8 +321,59 @@ const (
 	// GenerateOnly tells New to create an instance of Morfeusz
 	// capable only of morphological generation.
 	GenerateOnly = C.GENERATE_ONLY
+	// AnalyseAndLazyGenerate tells New to create an instance
+	// of Morfeusz that loads only the data for morphological analysis
+	// at first. The data for generation is loaded on the first call
+	// to Generate or GenerateWithTagID, once for the instance
+	// and its clones.
+	AnalyseAndLazyGenerate = C.ANALYSE_AND_LAZY_GENERATE
+	// AnalyseAndGenerateInParallel tells New to create an instance
+	// of Morfeusz capable both of morphological analysis and
+	// generation, like BothAnalyseAndGenerate, but loads the data
+	// for both on two threads at the same time.
+	AnalyseAndGenerateInParallel = C.ANALYSE_AND_GENERATE_IN_PARALLEL
+)
+
+const (
+	// TSV makes AnalyseStringAs write a line with the start node,
+	// end node, orth, lemma, tag, name and labels separated by tabs
+	// for every interpretation. Tabs, newlines, carriage returns
+	// and backslashes are escaped as \t, \n, \r and \\.
+	TSV Format = C.TSV_FORMAT
+	// JSONLines makes AnalyseStringAs write a line with a JSON object
+	// with the keys "start", "end", "orth", "lemma", "tag", "name"
+	// and "labels" for every interpretation.
+	JSONLines = C.JSON_LINES_FORMAT
+	// Binary makes AnalyseStringAs write the start and end node
+	// as 32-bit little-endian integers followed by the orth, lemma,
+	// tag, name and labels, each preceded by its length as a 32-bit
+	// little-endian integer, for every interpretation.
+	Binary = C.BINARY_FORMAT
+	// Compact makes AnalyseStringAs write varint-encoded node deltas,
+	// IDs of tags, names and labels, and references to a table of orths
+	// and lemmas built along the way. Use CompactReader or DecodeCompact
+	// to read it back. The layout is described in morfeusz-cgo.h.
+	Compact = C.COMPACT_FORMAT
+)
+
+const (
+	// WarmupBasic makes Warmup read all the tags, names and labels,
+	// analyse a few built-in sentences and generate the forms
+	// of a few built-in lemmas covering the common paradigms.
+	WarmupBasic WarmupLevel = C.WARMUP_BASIC
+	// WarmupFull makes Warmup also analyse all the generated forms.
+	WarmupFull = C.WARMUP_FULL
 )
 
+// WarmupStats is the type of a struct describing what Warmup did.
+// Analyses and Generations count the calls made; calls that
+// the instance is not capable of are skipped.
+type WarmupStats struct {
+	Duration    time.Duration
+	Analyses    int
+	Generations int
+}
+
 // Config informs New about the parameters
 // of the instance of Morfeusz to be created.
 type Config struct {
@@ -134,53 +387,84 @@ type Config struct {
 	Usage              Usage
 }
 
+// Options informs AnalyseStringWithOptions about the parameters
+// of a single analysis. Empty Aggl and Praet keep the current
+// settings of the instance of Morfeusz.
+type Options struct {
+	Aggl               string
+	Praet              string
+	TokenNumbering     TokenNumbering
+	CaseHandling       CaseHandling
+	WhitespaceHandling WhitespaceHandling
+}
+
+// ConfigError is the type of the errors returned by New.
+// Field is the name of the rejected field of Config.
+type ConfigError struct {
+	Field string
+	Err   error
+}
+
+func (e *ConfigError) Error() string {
+	return e.Err.Error()
+}
+
 var (
 	errInvalidCharset = errors.New("Invalid charset")
-	errInvalidUsage   = errors.New("Invalid usage option")
+
+	configFields = map[C.enum_ConfigField]string{
+		C.CONFIG_DICT_NAME:           "DictName",
+		C.CONFIG_AGGL:                "Aggl",
+		C.CONFIG_PRAET:               "Praet",
+		C.CONFIG_CHARSET:             "Charset",
+		C.CONFIG_TOKEN_NUMBERING:     "TokenNumbering",
+		C.CONFIG_CASE_HANDLING:       "CaseHandling",
+		C.CONFIG_WHITESPACE_HANDLING: "WhitespaceHandling",
+		C.CONFIG_USAGE:               "Usage",
+	}
 )
 
 // New returns a fresh instance of Morfeusz. New(nil), equivalent
 // to New(&Config{}), creates the instance with default parameters.
+// Every call loads the dictionary anew, so unlike clones, the instances
+// do not share any settings. The returned error, if any,
+// is a *ConfigError.
 func New(c *Config) (*Morfeusz, error) {
 	if c == nil {
 		c = &Config{}
 	}
-	// Workaround for the lack of usage checks.
-	if c.Usage < BothAnalyseAndGenerate || c.Usage > GenerateOnly {
-		return nil, errInvalidUsage
-	}
-	m := C.createInstance(
-		C.makeStructString(c.DictName), C.enum_Usage(c.Usage))
-	if m == nil {
-		return nil, fmt.Errorf(
-			"Failed to load dictionary \"%s\"", c.DictName)
-	}
-	// Make sure that the associated C++ object m
-	// will be freed when ret is garbage-collected.
-	ret := gcMorfeusz(m)
-	if c.Aggl != "" {
-		if err := ret.SetAggl(c.Aggl); err != nil {
-			return nil, err
-		}
-	}
-	if c.Praet != "" {
-		if err := ret.SetPraet(c.Praet); err != nil {
-			return nil, err
-		}
-	}
-	if err := ret.SetCharset(c.Charset); err != nil {
-		return nil, err
-	}
-	if err := ret.SetCaseHandling(c.CaseHandling); err != nil {
-		return nil, err
-	}
-	if err := ret.SetTokenNumbering(c.TokenNumbering); err != nil {
-		return nil, err
+	r := C.createInstanceFromGo(
+		c.DictName, c.Aggl, c.Praet, C.enum_Charset(c.Charset),
+		C.enum_TokenNumbering(c.TokenNumbering),
+		C.enum_CaseHandling(c.CaseHandling),
+		C.enum_WhitespaceHandling(c.WhitespaceHandling),
+		C.enum_Usage(c.Usage))
+	if r.morf == nil {
+		return nil, &ConfigError{configFields[r.field], newError(r.error)}
 	}
-	if err := ret.SetWhitespaceHandling(c.WhitespaceHandling); err != nil {
+	// Make sure that the associated C++ object
+	// will be freed when the returned *Morfeusz
+	// is garbage-collected.
+	return gcMorfeusz(r.morf), nil
+}
+
+// Warmup brings the dictionary of m into memory and initializes
+// whatever Morfeusz builds lazily, so that the first requests
+// are not much slower than the rest. Clones of m made afterwards
+// share the warm dictionary. A server should report that it is ready
+// only after Warmup returns. With a charset other than UTF8, Warmup
+// only reads the tags, names and labels, as its built-in sentences
+// and lemmas are in UTF-8.
+func (m Morfeusz) Warmup(level WarmupLevel) (*WarmupStats, error) {
+	w := C.warmup(m.morf, C.enum_WarmupLevel(level))
+	if err := newError(w.error); err != nil {
 		return nil, err
 	}
-	return ret, nil
+	return &WarmupStats{
+		Duration:    time.Duration(w.nanoseconds),
+		Analyses:    int(w.analyses),
+		Generations: int(w.generations),
+	}, nil
 }
 
 // Analyse returns the result of morphological analysis
@@ -205,6 +489,291 @@ func (m Morfeusz) AnalyseString(text string) *Result {
 	return gcResult(r)
 }
 
+// AnalyseStringWithOptions is like AnalyseString, but it analyses
+// the text as if the instance of Morfeusz were set up with options o.
+// The settings of the instance remain unchanged. Every set of options
+// loads the dictionary into a new instance the first time it is used,
+// and the instances are cached until one of the setters of m is called.
+func (m Morfeusz) AnalyseStringWithOptions(
+	text string, o *Options) (*Result, error) {
+	if o == nil {
+		o = &Options{}
+	}
+	a := C.analyseStringWithGoOptions(
+		m.morf, text, o.Aggl, o.Praet,
+		C.enum_TokenNumbering(o.TokenNumbering),
+		C.enum_CaseHandling(o.CaseHandling),
+		C.enum_WhitespaceHandling(o.WhitespaceHandling))
+	if a.res == nil {
+		return nil, newError(a.error)
+	}
+	return gcResult(a.res), nil
+}
+
+// AnalyseStringWithFallback is like AnalyseString, but the unknown
+// words (those for which IsIgn returns true) are analysed again, all
+// at once, by fallback. Its interpretations replace the unknown words
+// in the result, and the nodes that follow are renumbered to make room
+// for them. The IDs of tags, names and labels are translated to those
+// of m; words whose interpretations use tags, names or labels unknown
+// to m are left unknown. With ContinuousNumbering, the node numbers
+// of the next analysis by m do not account for the new nodes.
+// It fails when fallback uses another Charset than m.
+func (m Morfeusz) AnalyseStringWithFallback(
+	fallback *Morfeusz, text string) (*Result, error) {
+	a := C.analyseStringWithFallback(
+		m.morf, fallback.morf, C.makeStructString(text))
+	if a.res == nil {
+		return nil, newError(a.error)
+	}
+	return gcResult(a.res), nil
+}
+
+// AnalyseLemmas returns the distinct lemmas of every segment
+// of a string, in the order of the first interpretation of each
+// segment. It is much cheaper than AnalyseString when only
+// the lemmas are needed.
+func (m Morfeusz) AnalyseLemmas(text string) ([]SegmentLemmas, error) {
+	l := C.analyseLemmas(m.morf, C.makeStructString(text))
+	defer C.freeLemmas(&l)
+	if l.error.p != nil {
+		return nil, errors.New(goString(l.error))
+	}
+	offsets := (*[1 << 28]C.int)(
+		unsafe.Pointer(l.offsets))[: l.lemmasLength+1 : l.lemmasLength+1]
+	segments := (*[1 << 28]C.struct_SegmentLemmas)(
+		unsafe.Pointer(l.segments))[:l.segmentsLength:l.segmentsLength]
+	// All the lemmas are substrings of a single Go string.
+	heap := C.GoStringN(l.heap, offsets[l.lemmasLength])
+	lemmas := make([]string, l.lemmasLength)
+	for i := range lemmas {
+		lemmas[i] = heap[offsets[i]:offsets[i+1]]
+	}
+	ret := make([]SegmentLemmas, len(segments))
+	for i, s := range segments {
+		first := int(s.firstLemma)
+		last := first + int(s.lemmasLength)
+		ret[i] = SegmentLemmas{
+			int(s.startNode), int(s.endNode), lemmas[first:last:last]}
+	}
+	return ret, nil
+}
+
+// AnalyseStringAs returns the result of morphological analysis
+// of a string serialized in format f. The tags, names and labels
+// are already resolved, so no further calls to m are needed.
+func (m Morfeusz) AnalyseStringAs(text string, f Format) ([]byte, error) {
+	b := C.serializeAnalysis(
+		m.morf, C.makeStructString(text), C.enum_Format(f))
+	defer C.freeBuffer(&b)
+	if b.error.p != nil {
+		return nil, errors.New(goString(b.error))
+	}
+	return C.GoBytes(unsafe.Pointer(b.data.p), b.data.n), nil
+}
+
+// AnalyseStringsAs returns the results of morphological analysis
+// of texts serialized like AnalyseStringAs serializes them. When m
+// skips whitespace and numbers nodes separately, the texts are
+// analysed in a single pass, which is cheaper for many short texts.
+func (m Morfeusz) AnalyseStringsAs(texts []string, f Format) ([][]byte, error) {
+	if len(texts) == 0 {
+		return nil, nil
+	}
+	lengths := make([]C.int, len(texts))
+	for i, t := range texts {
+		lengths[i] = C.int(len(t))
+	}
+	sizes := make([]C.int, len(texts))
+	b := C.serializeAnalysisBatch(
+		m.morf, C.makeStructString(strings.Join(texts, "")),
+		&lengths[0], C.int(len(texts)), C.enum_Format(f), &sizes[0])
+	defer C.freeBuffer(&b)
+	if b.error.p != nil {
+		return nil, errors.New(goString(b.error))
+	}
+	data := C.GoBytes(unsafe.Pointer(b.data.p), b.data.n)
+	ret := make([][]byte, len(texts))
+	for i, n := range sizes {
+		ret[i] = data[:n:n]
+		data = data[n:]
+	}
+	return ret, nil
+}
+
+// DecodeCompact returns the interpretations serialized by
+// AnalyseStringAs in the Compact format. It fails unless the data
+// comes from the dictionary of m.
+func (m Morfeusz) DecodeCompact(data []byte) ([]*TokenInfo, error) {
+	return fromTokenInfoArray(C.decodeCompact(m.morf, makeBytesString(data)))
+}
+
+// AnalyseRecordBatch returns the result of morphological analysis
+// of texts as a RecordBatch with a row for every interpretation.
+// Its columns are document (the index in texts), start_node,
+// end_node, orth, lemma, and tag, name and labels, which are
+// dictionary-encoded with the IDs of m as indices.
+func (m Morfeusz) AnalyseRecordBatch(texts []string) (*RecordBatch, error) {
+	lengths := make([]C.int, len(texts)+1)
+	for i, t := range texts {
+		lengths[i] = C.int(len(t))
+	}
+	b := C.analyseRecordBatch(
+		m.morf, C.makeStructString(strings.Join(texts, "")),
+		&lengths[0], C.int(len(texts)))
+	if b.array == nil {
+		defer C.freeRecordBatch(&b)
+		return nil, errors.New(goString(b.error))
+	}
+	// Make sure that the associated Arrow structs will be released
+	// when the returned *RecordBatch is garbage-collected.
+	ret := &RecordBatch{b}
+	runtime.SetFinalizer(ret, freeRecordBatch)
+	return ret, nil
+}
+
+// AnalyseStringsPacked returns the result of morphological analysis
+// of texts packed into 32-byte PackedTokenInfo structs, whose Document
+// is the index in texts. Scanning them is much cheaper than scanning
+// TokenInfo structs. It fails when the dictionary of m has more than
+// 65536 tags, names or labels.
+func (m Morfeusz) AnalyseStringsPacked(texts []string) (*PackedResult, error) {
+	lengths := make([]C.int, len(texts)+1)
+	for i, t := range texts {
+		lengths[i] = C.int(len(t))
+	}
+	a := C.analysePacked(
+		m.morf, C.makeStructString(strings.Join(texts, "")),
+		&lengths[0], C.int(len(texts)))
+	defer C.freePackedAnalysis(&a)
+	if a.error.p != nil {
+		return nil, errors.New(goString(a.error))
+	}
+	tokens := unsafe.Slice(
+		(*PackedTokenInfo)(unsafe.Pointer(a.tokens)), a.tokensLength)
+	return &PackedResult{
+		Tokens:  append([]PackedTokenInfo(nil), tokens...),
+		Strings: C.GoBytes(unsafe.Pointer(a.strings), a.stringsLength),
+	}, nil
+}
+
+// AnalyseStringInterned returns the result of morphological analysis
+// of text with orths and lemmas replaced by the IDs of interned
+// strings. ResolveInterned turns the IDs back into strings.
+func (m Morfeusz) AnalyseStringInterned(text string) ([]InternedTokenInfo, error) {
+	a := C.analyseInterned(m.morf, C.makeStructString(text))
+	defer C.freeInternedAnalysis(&a)
+	if a.error.p != nil {
+		return nil, errors.New(goString(a.error))
+	}
+	tokens := unsafe.Slice(
+		(*InternedTokenInfo)(unsafe.Pointer(a.tokens)), a.length)
+	return append([]InternedTokenInfo(nil), tokens...), nil
+}
+
+// ResolveInterned returns the interned strings with ids. It fails
+// when one of ids has not been returned by AnalyseStringInterned.
+func ResolveInterned(ids []uint32) ([]string, error) {
+	if len(ids) == 0 {
+		return nil, nil
+	}
+	lengths := make([]C.int, len(ids))
+	b := C.resolveInterned(
+		(*C.uint32_t)(unsafe.Pointer(&ids[0])), C.int(len(ids)), &lengths[0])
+	defer C.freeBuffer(&b)
+	if b.error.p != nil {
+		return nil, errors.New(goString(b.error))
+	}
+	// The strings share the memory of data.
+	data := goString(b.data)
+	ret := make([]string, len(ids))
+	for i, n := range lengths {
+		ret[i] = data[:n]
+		data = data[n:]
+	}
+	return ret, nil
+}
+
+// InternedCount returns the number of interned strings.
+// Their IDs are 0 to InternedCount() - 1.
+func InternedCount() int {
+	return int(C.internedCount())
+}
+
+// SetInternedLimit bounds the number of interned strings, 16777216
+// by default. Analyses that would intern more strings fail.
+func SetInternedLimit(limit int) {
+	C.setInternedLimit(C.int64_t(limit))
+}
+
+// AnalyseStringInterpretations returns the result of morphological
+// analysis of text with orths replaced by the IDs of interned strings
+// and lemmas, tags, names and labels by interpretation IDs.
+// ResolveInterpretations turns the latter back into their components.
+func (m Morfeusz) AnalyseStringInterpretations(text string) ([]InterpretationTokenInfo, error) {
+	a := C.analyseInterpretations(m.morf, C.makeStructString(text))
+	defer C.freeInterpretationAnalysis(&a)
+	if a.error.p != nil {
+		return nil, errors.New(goString(a.error))
+	}
+	tokens := unsafe.Slice(
+		(*InterpretationTokenInfo)(unsafe.Pointer(a.tokens)), a.length)
+	return append([]InterpretationTokenInfo(nil), tokens...), nil
+}
+
+// ResolveInterpretations returns the interpretations with ids.
+// It fails when one of ids is unknown.
+func ResolveInterpretations(ids []int32) ([]Interpretation, error) {
+	if len(ids) == 0 {
+		return nil, nil
+	}
+	n := len(ids)
+	lemmaIDs := make([]C.uint32_t, n)
+	tagIDs := make([]C.int, n)
+	nameIDs := make([]C.int, n)
+	labelsIDs := make([]C.int, n)
+	err := newError(C.resolveInterpretations(
+		(*C.int)(unsafe.Pointer(&ids[0])), C.int(n),
+		&lemmaIDs[0], &tagIDs[0], &nameIDs[0], &labelsIDs[0]))
+	if err != nil {
+		return nil, err
+	}
+	ret := make([]Interpretation, n)
+	for i := range ret {
+		ret[i] = Interpretation{
+			uint32(lemmaIDs[i]), int(tagIDs[i]),
+			int(nameIDs[i]), int(labelsIDs[i]),
+		}
+	}
+	return ret, nil
+}
+
+// InterpretationsCount returns the number of interpretation IDs
+// given so far.
+func InterpretationsCount() int {
+	return int(C.interpretationsCount())
+}
+
+// SetInterpretationsLimit bounds the number of interpretation IDs,
+// 4194304 by default.
+func SetInterpretationsLimit(limit int) {
+	C.setInterpretationsLimit(C.int64_t(limit))
+}
+
+// SaveInterpretations writes the table of interpretation IDs
+// to a file, to be loaded by LoadInterpretations.
+func (m Morfeusz) SaveInterpretations(path string) error {
+	return newError(C.saveInterpretations(m.morf, C.makeStructString(path)))
+}
+
+// LoadInterpretations loads the table of interpretation IDs saved
+// by SaveInterpretations with the same tagset, so that they keep
+// their IDs across restarts. It has to be called before any
+// interpretation IDs are given.
+func (m Morfeusz) LoadInterpretations(path string) error {
+	return newError(C.loadInterpretations(m.morf, C.makeStructString(path)))
+}
+
 // Next returns true when there is more information
 // available in the result of the analysis. It does
 // not modify the internals of the result.
@@ -238,12 +807,28 @@ func (t *TokenInfo) EndNode() int {
 
 // Orth returns the spelling of a token.
 func (t *TokenInfo) Orth() string {
-	return goString(t.info.orth)
+	return t.string(t.info.orth, 0)
 }
 
 // Lemma returns the lemma of a token.
 func (t *TokenInfo) Lemma() string {
-	return goString(t.info.lemma)
+	offset := 0
+	if t.info.orth.p == nil {
+		offset = int(t.info.orth.n)
+	}
+	return t.string(t.info.lemma, offset)
+}
+
+// string returns s, which is stored inline at offset if its p is nil,
+// as described in morfeusz-cgo.h.
+func (t *TokenInfo) string(s C.struct_String, offset int) string {
+	if s.p != nil {
+		return goString(s)
+	}
+	if s.n == 0 {
+		return ""
+	}
+	return C.GoStringN(&t.info.inlined[offset], s.n)
 }
 
 // IsIgn returns true only when a token is an unknown word.
@@ -495,6 +1080,473 @@ func (m Morfeusz) Clone() *Morfeusz {
 	return gcMorfeusz(C.cloneMorf(m.morf))
 }
 
+// OpenAnalysisCache opens the analysis cache at path, which need not
+// exist yet. The texts missing from it are logged to path + ".log".
+func OpenAnalysisCache(path string) (*AnalysisCache, error) {
+	c := C.openAnalysisCache(C.makeStructString(path))
+	if err := newError(c.error); err != nil {
+		return nil, err
+	}
+	ret := &AnalysisCache{c.cache}
+	// Make sure that the associated C++ object will be freed
+	// when ret is garbage-collected. The instances of Morfeusz
+	// that use it keep it open.
+	runtime.SetFinalizer(ret, freeAnalysisCache)
+	return ret, nil
+}
+
+// Stats returns the statistics of c.
+func (c *AnalysisCache) Stats() AnalysisCacheStats {
+	s := C.analysisCacheStats(c.cache)
+	runtime.KeepAlive(c)
+	return AnalysisCacheStats{
+		Entries: int64(s.entries),
+		Hits:    int64(s.hits),
+		Misses:  int64(s.misses),
+	}
+}
+
+// SetAnalysisCache makes m and its later clones look up the texts
+// they analyse in c, or in no cache if c is nil. Analyses with
+// ContinuousNumbering bypass the cache.
+func (m Morfeusz) SetAnalysisCache(c *AnalysisCache) {
+	if c == nil {
+		C.setAnalysisCache(m.morf, nil)
+		return
+	}
+	C.setAnalysisCache(m.morf, c.cache)
+	runtime.KeepAlive(c)
+}
+
+// CompactAnalysisCache replaces the table of the analysis cache
+// at path with one that also holds the entries logged by the
+// instances that used it, and empties the log. Processes that have
+// the cache open keep using the old table, and what they log while
+// it runs may be lost, so it is best run offline.
+func CompactAnalysisCache(path string) error {
+	return newError(C.compactAnalysisCache(C.makeStructString(path)))
+}
+
+// NewSentenceCache returns an empty SentenceCache that takes
+// about budget bytes of memory at most.
+func NewSentenceCache(budget int64) *SentenceCache {
+	ret := &SentenceCache{C.newSentenceCache(C.int64_t(budget))}
+	// Make sure that the associated C++ object will be freed
+	// when ret is garbage-collected. The instances of Morfeusz
+	// that use it keep it alive.
+	runtime.SetFinalizer(ret, freeSentenceCache)
+	return ret
+}
+
+// Stats returns the statistics of c.
+func (c *SentenceCache) Stats() SentenceCacheStats {
+	s := C.sentenceCacheStats(c.cache)
+	runtime.KeepAlive(c)
+	return SentenceCacheStats{
+		Entries:  int64(s.entries),
+		Bytes:    int64(s.bytes),
+		Hits:     int64(s.hits),
+		Misses:   int64(s.misses),
+		Rejected: int64(s.rejected),
+	}
+}
+
+// SetSentenceCache makes m and its later clones look up the texts
+// they analyse in c, after the form table and before the analysis
+// cache, or in no sentence cache if c is nil. Analyses with
+// ContinuousNumbering bypass the cache.
+func (m Morfeusz) SetSentenceCache(c *SentenceCache) {
+	if c == nil {
+		C.setSentenceCache(m.morf, nil)
+		return
+	}
+	C.setSentenceCache(m.morf, c.cache)
+	runtime.KeepAlive(c)
+}
+
+// BuildFormTable writes to path a form table with the analyses
+// of forms made by clones of m on threads goroutines. The table
+// can only be used by instances with the dictionary and settings of m.
+// It fails with ContinuousNumbering.
+func (m Morfeusz) BuildFormTable(path string, forms []string, threads int) error {
+	lengths := make([]C.int, len(forms)+1)
+	for i, f := range forms {
+		lengths[i] = C.int(len(f))
+	}
+	return newError(C.buildFormTable(
+		m.morf, C.makeStructString(strings.Join(forms, "")),
+		&lengths[0], C.int(len(forms)), C.int(threads),
+		C.makeStructString(path)))
+}
+
+// OpenFormTable maps the form table at path into memory.
+func OpenFormTable(path string) (*FormTable, error) {
+	f := C.openFormTable(C.makeStructString(path))
+	if err := newError(f.error); err != nil {
+		return nil, err
+	}
+	ret := &FormTable{f.forms}
+	// Make sure that the associated C++ object will be freed
+	// when ret is garbage-collected. The instances of Morfeusz
+	// that use it keep it open.
+	runtime.SetFinalizer(ret, freeFormTable)
+	return ret, nil
+}
+
+// Len returns the number of forms in t.
+func (t *FormTable) Len() int {
+	n := int(C.formTableSize(t.forms))
+	runtime.KeepAlive(t)
+	return n
+}
+
+// Stats returns the statistics of t.
+func (t *FormTable) Stats() FormTableStats {
+	s := C.formTableStats(t.forms)
+	runtime.KeepAlive(t)
+	return FormTableStats{
+		Hits:   int64(s.hits),
+		Misses: int64(s.misses),
+	}
+}
+
+// SetFormTable makes m and its later clones look up the texts
+// they analyse in t, before the analysis cache, or in no form table
+// if t is nil. With SkipWhitespaces a text is looked up word by word,
+// where the words are delimited by ASCII whitespace, and found only
+// if all its words are. It fails when t was built with another
+// dictionary or other settings. Analyses with ContinuousNumbering
+// or options that differ from those of t bypass it.
+func (m Morfeusz) SetFormTable(t *FormTable) error {
+	if t == nil {
+		return newError(C.setFormTable(m.morf, nil))
+	}
+	err := newError(C.setFormTable(m.morf, t.forms))
+	runtime.KeepAlive(t)
+	return err
+}
+
+// NewVocabulary returns the analyses of words made by clones of m
+// on threads goroutines. A text is then analysed with the vocabulary
+// word by word, where the words are delimited by ASCII whitespace,
+// so m has to skip whitespace and number nodes separately.
+func (m Morfeusz) NewVocabulary(words []string, threads int) (*Vocabulary, error) {
+	lengths := make([]C.int, len(words)+1)
+	for i, w := range words {
+		lengths[i] = C.int(len(w))
+	}
+	v := C.buildVocabulary(
+		m.morf, C.makeStructString(strings.Join(words, "")),
+		&lengths[0], C.int(len(words)), C.int(threads))
+	if err := newError(v.error); err != nil {
+		return nil, err
+	}
+	ret := &Vocabulary{v.vocabulary}
+	// Make sure that the associated C++ object will be freed
+	// when ret is garbage-collected.
+	runtime.SetFinalizer(ret, freeVocabulary)
+	return ret, nil
+}
+
+// Len returns the number of distinct words in v.
+func (v *Vocabulary) Len() int {
+	n := int(C.vocabularySize(v.vocabulary))
+	runtime.KeepAlive(v)
+	return n
+}
+
+// AnalyseStringAsWithVocabulary is like AnalyseStringAs, but copies
+// the analyses of the words of text from v and analyses only the words
+// missing there. The result is the same as that of AnalyseStringAs.
+// It fails when v was made with another dictionary or other settings.
+func (m Morfeusz) AnalyseStringAsWithVocabulary(
+	v *Vocabulary, text string, f Format) ([]byte, error) {
+	b := C.serializeAnalysisWithVocabulary(
+		m.morf, v.vocabulary, C.makeStructString(text), C.enum_Format(f))
+	runtime.KeepAlive(v)
+	defer C.freeBuffer(&b)
+	if b.error.p != nil {
+		return nil, errors.New(goString(b.error))
+	}
+	return C.GoBytes(unsafe.Pointer(b.data.p), b.data.n), nil
+}
+
+// NewRouter returns an empty Router.
+func NewRouter() *Router {
+	ret := &Router{C.createRouter()}
+	// Make sure that the associated C++ object and the instances
+	// of Morfeusz it holds will be freed when ret is garbage-collected.
+	runtime.SetFinalizer(ret, freeRouter)
+	return ret
+}
+
+// AddDictionary creates an instance of Morfeusz like New(c) does
+// and adds it to the router. It returns the ID that selects the new
+// instance. Dictionaries are looked up in the dictionary search paths,
+// which are shared by all instances. Every call loads its dictionary
+// anew, even one that the router already holds, since instances that
+// shared a loaded dictionary would share their settings too.
+// AddDictionary must not be called concurrently with other methods
+// of the router.
+func (r *Router) AddDictionary(c *Config) (int, error) {
+	if c == nil {
+		c = &Config{}
+	}
+	d := C.routerAddDictionaryFromGo(
+		r.router, c.DictName, c.Aggl, c.Praet, C.enum_Charset(c.Charset),
+		C.enum_TokenNumbering(c.TokenNumbering),
+		C.enum_CaseHandling(c.CaseHandling),
+		C.enum_WhitespaceHandling(c.WhitespaceHandling),
+		C.enum_Usage(c.Usage))
+	if d.id < 0 {
+		return -1, &ConfigError{configFields[d.field], newError(d.error)}
+	}
+	return int(d.id), nil
+}
+
+// Len returns the number of dictionaries in the router.
+func (r *Router) Len() int {
+	return int(C.routerSize(r.router))
+}
+
+// Morfeusz returns the instance of Morfeusz selected by dictID,
+// or nil when the ID is invalid. Tags, names and labels of tokens
+// returned by the router for dictID must be looked up with it,
+// as their IDs are specific to a dictionary.
+func (r *Router) Morfeusz(dictID int) *Morfeusz {
+	m := C.routerInstance(r.router, C.int(dictID))
+	if m == nil {
+		return nil
+	}
+	return &Morfeusz{m, r}
+}
+
+// AnalyseString returns the result of morphological analysis
+// of a string with the dictionary selected by dictID.
+func (r *Router) AnalyseString(dictID int, text string) (*Result, error) {
+	a := C.routerAnalyseString(
+		r.router, C.int(dictID), C.makeStructString(text))
+	if a.res == nil {
+		return nil, newError(a.error)
+	}
+	return gcResult(a.res), nil
+}
+
+// Generate returns a list of all inflected forms for a given lemma
+// in the dictionary selected by dictID.
+func (r *Router) Generate(dictID int, lemma string) ([]*TokenInfo, error) {
+	return fromTokenInfoArray(C.routerGenerate(
+		r.router, C.int(dictID), C.makeStructString(lemma)))
+}
+
+// GenerateWithTagID returns a list of inflected forms for a given lemma
+// that have a specific inflectional tag in the dictionary selected
+// by dictID.
+func (r *Router) GenerateWithTagID(
+	dictID, tagID int, lemma string) ([]*TokenInfo, error) {
+	return fromTokenInfoArray(C.routerGenerateWithTagID(
+		r.router, C.int(dictID), C.int(tagID), C.makeStructString(lemma)))
+}
+
+// Len returns the number of rows of the batch.
+func (b *RecordBatch) Len() int {
+	return int(b.batch.array.length)
+}
+
+// CData returns pointers to the ArrowSchema and ArrowArray structs
+// of the batch, to be imported by an implementation of Arrow, e.g.
+// with cdata.ImportCRecordBatch from the Arrow Go module. The importer
+// takes the structs over, after which Columns returns nil. The batch
+// must be kept alive until the import is done.
+func (b *RecordBatch) CData() (schema, array unsafe.Pointer) {
+	return unsafe.Pointer(b.batch.schema), unsafe.Pointer(b.batch.array)
+}
+
+// Columns returns a copy of the columns of the batch,
+// or nil if the batch has been imported through CData.
+func (b *RecordBatch) Columns() *Columns {
+	a := b.batch.array
+	if a.release == nil {
+		return nil
+	}
+	children := (*[1 << 28]*C.struct_ArrowArray)(
+		unsafe.Pointer(a.children))[:a.n_children:a.n_children]
+	orth := utf8Buffers(children[3])
+	lemma := utf8Buffers(children[4])
+	return &Columns{
+		Document:     int32Buffer(children[0], 1, a.length),
+		StartNode:    int32Buffer(children[1], 1, a.length),
+		EndNode:      int32Buffer(children[2], 1, a.length),
+		OrthOffsets:  orth.offsets,
+		Orth:         orth.data,
+		LemmaOffsets: lemma.offsets,
+		Lemma:        lemma.data,
+		TagID:        int32Buffer(children[5], 1, a.length),
+		NameID:       int32Buffer(children[6], 1, a.length),
+		LabelsID:     int32Buffer(children[7], 1, a.length),
+	}
+}
+
+// Prefork starts worker processes that answer analysis requests
+// on a Unix socket created at path. The workers are forked from
+// the current process after m has been warmed up, so they share
+// the loaded dictionary copy-on-write instead of loading it again.
+//
+// A request is the length of a text as a 32-bit little-endian integer
+// followed by the text. The response is a 32-bit little-endian status,
+// 0 for success or 1 for an error, the length of the payload as
+// a 32-bit little-endian integer and the payload: the analysis
+// serialized in the format f, or the error message. A worker serves
+// one connection at a time.
+//
+// The workers run only C++ code and keep the settings m had
+// at the time of the call. They close every file descriptor they
+// inherit except the socket. Nothing may use m concurrently with Prefork.
+// Other instances may be used meanwhile: the locks of the package are
+// taken around the fork, so the workers do not inherit them held.
+// The workers are stopped by Close. When idle, they also exit within
+// about a second after the process that started them does.
+func (m Morfeusz) Prefork(
+	path string, workers int, f Format) (*PreforkServer, error) {
+	p := C.preforkServe(
+		m.morf, C.makeStructString(path), C.enum_Format(f), C.int(workers))
+	defer C.freePrefork(&p)
+	if p.error.p != nil {
+		return nil, errors.New(goString(p.error))
+	}
+	pids := (*[1 << 28]C.int)(
+		unsafe.Pointer(p.pids))[:p.pidsLength:p.pidsLength]
+	ret := &PreforkServer{path: path, listener: int(p.listener)}
+	for _, pid := range pids {
+		ret.pids = append(ret.pids, int(pid))
+	}
+	return ret, nil
+}
+
+// PIDs returns the process IDs of the workers.
+func (s *PreforkServer) PIDs() []int {
+	return append([]int(nil), s.pids...)
+}
+
+// Memory returns the memory usage of every worker, as reported
+// in /proc/<pid>/smaps_rollup (Linux 4.14 or newer).
+func (s *PreforkServer) Memory() ([]WorkerMemory, error) {
+	var ret []WorkerMemory
+	for _, pid := range s.pids {
+		w, err := workerMemory(pid)
+		if err != nil {
+			return nil, err
+		}
+		ret = append(ret, w)
+	}
+	return ret, nil
+}
+
+// Close stops the workers, waits for them to exit and removes
+// the socket.
+func (s *PreforkServer) Close() error {
+	for _, pid := range s.pids {
+		syscall.Kill(pid, syscall.SIGTERM)
+	}
+	var err error
+	for _, pid := range s.pids {
+		var ws syscall.WaitStatus
+		if _, e := syscall.Wait4(pid, &ws, 0, nil); e != nil && err == nil {
+			err = e
+		}
+	}
+	s.pids = nil
+	if e := syscall.Close(s.listener); e != nil && err == nil {
+		err = e
+	}
+	if e := os.Remove(s.path); e != nil && err == nil {
+		err = e
+	}
+	return err
+}
+
+func workerMemory(pid int) (WorkerMemory, error) {
+	ret := WorkerMemory{PID: pid}
+	f, err := os.Open(fmt.Sprintf("/proc/%d/smaps_rollup", pid))
+	if err != nil {
+		return ret, err
+	}
+	defer f.Close()
+	fields := map[string]*uint64{
+		"Rss:":           &ret.RSS,
+		"Pss:":           &ret.PSS,
+		"Shared_Clean:":  &ret.Shared,
+		"Shared_Dirty:":  &ret.Shared,
+		"Private_Clean:": &ret.Private,
+		"Private_Dirty:": &ret.Private,
+	}
+	sc := bufio.NewScanner(f)
+	for sc.Scan() {
+		// Lines look like "Rss:                1234 kB".
+		fs := strings.Fields(sc.Text())
+		if len(fs) != 3 || fields[fs[0]] == nil {
+			continue
+		}
+		kb, err := strconv.ParseUint(fs[1], 10, 64)
+		if err != nil {
+			return ret, err
+		}
+		*fields[fs[0]] += kb << 10
+	}
+	return ret, sc.Err()
+}
+
+// ReadMemoryStats returns the current memory statistics.
+func ReadMemoryStats() *MemoryStats {
+	s := C.memoryStats()
+	return &MemoryStats{
+		Instances:        int(s.instances),
+		InstanceBytes:    int64(s.instanceBytes),
+		Results:          int(s.results),
+		ResultBytes:      int64(s.resultBytes),
+		TokenInfos:       int(s.tokenInfos),
+		TokenInfoBytes:   int64(s.tokenInfoBytes),
+		StringArrayBytes: int64(s.stringArrayBytes),
+		HeapBytes:        int64(s.heapBytes),
+	}
+}
+
+// SetResultAccounting turns the measurement of the memory used by
+// every new Result on or off. It is off by default, because it makes
+// every analysis more expensive.
+func SetResultAccounting(on bool) {
+	if on {
+		C.setResultAccounting(1)
+	} else {
+		C.setResultAccounting(0)
+	}
+}
+
+// MemoryUsage returns the growth of the heap measured when m
+// was created or cloned. A clone shares the dictionary with
+// its original, so it usually takes much less than the original.
+func (m Morfeusz) MemoryUsage() int64 {
+	return int64(C.instanceMemory(m.morf))
+}
+
+// MemoryUsage returns the growth of the heap measured when r
+// was created, or 0 if SetResultAccounting was off at the time.
+func (r Result) MemoryUsage() int64 {
+	return int64(C.resultMemory(r.res))
+}
+
+// SetCAllocator makes the C++ code allocate the memory it hands over
+// to Go with the functions in *a, a struct Allocator from
+// morfeusz-cgo.h filled in by C code, e.g. to plug in a pool
+// allocator. nil restores the default. It must be called before
+// the first use of the package, or when no other goroutine uses it
+// and every value returned by it has been garbage-collected.
+// The workers started by Prefork do not call the functions in *a,
+// which may not survive fork(): they go back to the default.
+func SetCAllocator(a unsafe.Pointer) {
+	C.setAllocator((*C.struct_Allocator)(a))
+}
+
 // Version returns the version of the underlying Morfeusz 2 library.
 func Version() string {
 	return goStringFree(C.version())
@@ -511,7 +1563,7 @@ func Copyright() string {
 }
 
 func gcMorfeusz(m C.Morf) *Morfeusz {
-	ret := &Morfeusz{m}
+	ret := &Morfeusz{morf: m}
 	runtime.SetFinalizer(ret, freeMorfeusz)
 	return ret
 }
@@ -524,7 +1576,10 @@ func gcResult(r C.Res) *Result {
 
 func gcTokenInfo(t C.struct_TokenInfo) *TokenInfo {
 	ret := &TokenInfo{t}
-	runtime.SetFinalizer(ret, freeTokenInfo)
+	// Inline strings need not be freed.
+	if t.orth.p != nil || t.lemma.p != nil {
+		runtime.SetFinalizer(ret, freeTokenInfo)
+	}
 	return ret
 }
 
@@ -532,6 +1587,30 @@ func freeMorfeusz(m *Morfeusz) {
 	C.freeMorf(m.morf)
 }
 
+func freeRouter(r *Router) {
+	C.freeRouter(r.router)
+}
+
+func freeAnalysisCache(c *AnalysisCache) {
+	C.freeAnalysisCache(c.cache)
+}
+
+func freeSentenceCache(c *SentenceCache) {
+	C.freeSentenceCache(c.cache)
+}
+
+func freeFormTable(t *FormTable) {
+	C.freeFormTable(t.forms)
+}
+
+func freeVocabulary(v *Vocabulary) {
+	C.freeVocabulary(v.vocabulary)
+}
+
+func freeRecordBatch(b *RecordBatch) {
+	C.freeRecordBatch(&b.batch)
+}
+
 func freeResult(r *Result) {
 	C.freeRes(r.res)
 }
@@ -540,6 +1619,33 @@ func freeTokenInfo(t *TokenInfo) {
 	C.freeTokenInfo(&t.info)
 }
 
+func arrowBuffer(a *C.struct_ArrowArray, i int) unsafe.Pointer {
+	buffers := (*[1 << 28]unsafe.Pointer)(
+		unsafe.Pointer(a.buffers))[:a.n_buffers:a.n_buffers]
+	return buffers[i]
+}
+
+func int32Buffer(a *C.struct_ArrowArray, i int, n C.int64_t) []int32 {
+	if n == 0 {
+		return nil
+	}
+	src := (*[1 << 28]int32)(arrowBuffer(a, i))[:n:n]
+	return append([]int32(nil), src...)
+}
+
+type utf8Column struct {
+	offsets []int32
+	data    []byte
+}
+
+func utf8Buffers(a *C.struct_ArrowArray) utf8Column {
+	offsets := int32Buffer(a, 1, a.length+1)
+	return utf8Column{
+		offsets,
+		C.GoBytes(arrowBuffer(a, 2), C.int(offsets[a.length])),
+	}
+}
+
 func fromStringArray(arr C.struct_StringArray) []string {
 	sliceView := (*[1 << 28]C.struct_String)(
 		unsafe.Pointer(arr.strings))[:arr.length:arr.length]
@@ -572,6 +1678,14 @@ func newError(s C.struct_String) error {
 	return errors.New(goStringFree(s))
 }
 
+func makeBytesString(b []byte) C.struct_String {
+	if len(b) == 0 {
+		return C.struct_String{}
+	}
+	return C.struct_String{
+		p: (*C.char)(unsafe.Pointer(&b[0])), n: C.int(len(b))}
+}
+
 func goStringFree(s C.struct_String) string {
 	ret := goString(s)
 	C.freeCharArray(s.p)
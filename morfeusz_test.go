@@ -1,8 +1,19 @@
 package morfeusz_test
 
 import (
+	"encoding/binary"
+	"encoding/json"
 	"fmt"
+	"io"
+	"net"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"runtime"
+	"strings"
 	"testing"
+	"time"
+	"unsafe"
 
 	"github.com/go-morfeusz/morfeusz"
 )
@@ -52,18 +63,51 @@ func TestNew(t *testing.T) {
 		{morfeusz.Config{TokenNumbering: 2}, "TokenNumbering"},
 		{morfeusz.Config{CaseHandling: 3}, "CaseHandling"},
 		{morfeusz.Config{WhitespaceHandling: 3}, "WhitespaceHandling"},
-		{morfeusz.Config{Usage: 3}, "Usage"},
+		{morfeusz.Config{Usage: 5}, "Usage"},
 	}
 	for _, tt := range tests {
 		t.Run(tt.give, func(t *testing.T) {
 			_, err := morfeusz.New(&tt.conf)
 			assertError(t, err)
+			if ce, ok := err.(*morfeusz.ConfigError); ok {
+				assertEqualString(t, ce.Field, tt.give)
+			} else {
+				t.Errorf("got %T; want *morfeusz.ConfigError", err)
+			}
 		})
 	}
 	t.Run("DefaultConfig", func(t *testing.T) {
 		_, err := morfeusz.New(&morfeusz.Config{})
 		assertNoError(t, err)
 	})
+	t.Run("SameConfig", func(t *testing.T) {
+		conf := morfeusz.Config{
+			Praet:              "composite",
+			CaseHandling:       morfeusz.IgnoreCase,
+			WhitespaceHandling: morfeusz.KeepWhitespaces,
+		}
+		m1, err := morfeusz.New(&conf)
+		assertNoError(t, err)
+		m2, err := morfeusz.New(&conf)
+		assertNoError(t, err)
+		assertEqualString(t, m2.Praet(), "composite")
+		assertEqualInt(t, int(m2.CaseHandling()), morfeusz.IgnoreCase)
+		assertEqualInt(t, int(m2.WhitespaceHandling()),
+			morfeusz.KeepWhitespaces)
+		want := analyseToTokenInfoSlice(t, m1, "Ala ma kota.")
+		got := analyseToTokenInfoSlice(t, m2, "Ala ma kota.")
+		assertEqualTokenInfoSlices(t, got, want)
+		// The instances do not share their settings.
+		assertNoError(t, m1.SetWhitespaceHandling(morfeusz.SkipWhitespaces))
+		assertEqualInt(t, int(m2.WhitespaceHandling()),
+			morfeusz.KeepWhitespaces)
+		m3, err := morfeusz.New(&conf)
+		assertNoError(t, err)
+		assertEqualInt(t, int(m1.WhitespaceHandling()),
+			int(morfeusz.SkipWhitespaces))
+		assertEqualInt(t, int(m3.WhitespaceHandling()),
+			morfeusz.KeepWhitespaces)
+	})
 }
 
 func TestMorfeuszMethods(t *testing.T) {
@@ -226,6 +270,453 @@ func TestAnalyse(t *testing.T) {
 	assertEqualTokenInfoSlices(t, got, want)
 }
 
+func TestAnalyseStringWithOptions(t *testing.T) {
+	m, _ := morfeusz.New(nil)
+	o := morfeusz.Options{
+		Praet:              "composite",
+		CaseHandling:       morfeusz.IgnoreCase,
+		WhitespaceHandling: morfeusz.KeepWhitespaces,
+	}
+	c, _ := morfeusz.New(&morfeusz.Config{
+		Praet:              o.Praet,
+		CaseHandling:       o.CaseHandling,
+		WhitespaceHandling: o.WhitespaceHandling,
+	})
+	text := "ALA robiłaś kota"
+	want := analyseToTokenInfoSlice(t, c, text)
+	// The instance itself keeps its settings and results.
+	d, _ := morfeusz.New(nil)
+	plain := analyseToTokenInfoSlice(t, d, text)
+	for i := 0; i < 2; i++ {
+		r, err := m.AnalyseStringWithOptions(text, &o)
+		assertNoError(t, err)
+		assertEqualTokenInfoSlices(t, resultToTokenInfoSlice(r, m), want)
+		assertEqualTokenInfoSlices(t, analyseToTokenInfoSlice(t, m, text), plain)
+	}
+	assertEqualString(t, m.Praet(), "split")
+	assertEqualInt(t, int(m.CaseHandling()),
+		int(morfeusz.ConditionallyCaseSensitive))
+	assertEqualInt(t, int(m.WhitespaceHandling()),
+		int(morfeusz.SkipWhitespaces))
+
+	invalidTests := []struct {
+		o    morfeusz.Options
+		give string
+	}{
+		{morfeusz.Options{Aggl: "xyz"}, "Aggl"},
+		{morfeusz.Options{CaseHandling: 3}, "CaseHandling"},
+		{morfeusz.Options{WhitespaceHandling: 3}, "WhitespaceHandling"},
+	}
+	for _, tt := range invalidTests {
+		t.Run(tt.give, func(t *testing.T) {
+			_, err := m.AnalyseStringWithOptions(text, &tt.o)
+			assertError(t, err)
+		})
+	}
+}
+
+func TestAnalyseStringWithFallback(t *testing.T) {
+	m, _ := morfeusz.New(&morfeusz.Config{
+		CaseHandling: morfeusz.StrictlyCaseSensitive,
+	})
+	f, _ := morfeusz.New(&morfeusz.Config{
+		CaseHandling: morfeusz.IgnoreCase,
+	})
+	text := "bez kOTA xyz"
+	r, err := m.AnalyseStringWithFallback(f, text)
+	assertNoError(t, err)
+	got := resultToTokenInfoSlice(r, m)
+
+	// Every word of the text is a single segment, so the interpretations
+	// of the primary and the fallback instance can be matched by node.
+	primary := analyseToTokenInfoSlice(t, m, text)
+	fallback := analyseToTokenInfoSlice(t, f, text)
+	var want []tokenInfo
+	for _, p := range primary {
+		if !p.isIgn {
+			want = append(want, p)
+			continue
+		}
+		var found []tokenInfo
+		for _, q := range fallback {
+			if q.start == p.start && !q.isIgn {
+				found = append(found, q)
+			}
+		}
+		if found == nil {
+			found = []tokenInfo{p}
+		}
+		want = append(want, found...)
+	}
+	assertEqualTokenInfoSlices(t, got, want)
+
+	other, _ := morfeusz.New(&morfeusz.Config{Charset: morfeusz.ISO8859_2})
+	_, err = m.AnalyseStringWithFallback(other, text)
+	assertError(t, err)
+}
+
+func TestAnalyseLemmas(t *testing.T) {
+	m, _ := morfeusz.New(nil)
+	text := "Ala ma kota."
+	got, err := m.AnalyseLemmas(text)
+	assertNoError(t, err)
+	var want []morfeusz.SegmentLemmas
+	for _, ti := range analyseToTokenInfoSlice(t, m, text) {
+		n := len(want)
+		if n == 0 || want[n-1].StartNode != ti.start ||
+			want[n-1].EndNode != ti.end {
+			want = append(want, morfeusz.SegmentLemmas{
+				StartNode: ti.start, EndNode: ti.end})
+			n++
+		}
+		seen := false
+		for _, l := range want[n-1].Lemmas {
+			seen = seen || l == ti.lemma
+		}
+		if !seen {
+			want[n-1].Lemmas = append(want[n-1].Lemmas, ti.lemma)
+		}
+	}
+	assertEqualInt(t, len(got), len(want))
+	for i, g := range got {
+		assertEqualInt(t, g.StartNode, want[i].StartNode)
+		assertEqualInt(t, g.EndNode, want[i].EndNode)
+		assertEqualStringSlices(t, g.Lemmas, want[i].Lemmas)
+	}
+}
+
+func TestAnalyseStringAs(t *testing.T) {
+	m, _ := morfeusz.New(&morfeusz.Config{
+		WhitespaceHandling: morfeusz.KeepWhitespaces,
+	})
+	text := "Ala ma\tkota."
+	want := analyseToTokenInfoSlice(t, m, text)
+
+	t.Run("TSV", func(t *testing.T) {
+		b, err := m.AnalyseStringAs(text, morfeusz.TSV)
+		assertNoError(t, err)
+		var lines []string
+		esc := strings.NewReplacer("\\", "\\\\", "\t", "\\t")
+		for _, w := range want {
+			lines = append(lines, fmt.Sprintf(
+				"%d\t%d\t%s\t%s\t%s\t%s\t%s\n",
+				w.start, w.end, esc.Replace(w.orth), esc.Replace(w.lemma),
+				w.tag, w.name, w.labels))
+		}
+		assertEqualString(t, string(b), strings.Join(lines, ""))
+	})
+
+	t.Run("JSONLines", func(t *testing.T) {
+		b, err := m.AnalyseStringAs(text, morfeusz.JSONLines)
+		assertNoError(t, err)
+		d := json.NewDecoder(strings.NewReader(string(b)))
+		var got []tokenInfo
+		for d.More() {
+			var r struct {
+				Start, End                     int
+				Orth, Lemma, Tag, Name, Labels string
+			}
+			assertNoError(t, d.Decode(&r))
+			got = append(got, tokenInfo{
+				r.Start, r.End, r.Orth, r.Lemma, r.Tag == "ign",
+				r.Tag == "sp", r.Tag, r.Name, r.Labels})
+		}
+		assertEqualTokenInfoSlices(t, got, want)
+	})
+
+	t.Run("Binary", func(t *testing.T) {
+		b, err := m.AnalyseStringAs(text, morfeusz.Binary)
+		assertNoError(t, err)
+		var got []tokenInfo
+		for len(b) > 0 {
+			var ti tokenInfo
+			ti.start = int(binary.LittleEndian.Uint32(b))
+			ti.end = int(binary.LittleEndian.Uint32(b[4:]))
+			b = b[8:]
+			for _, s := range []*string{
+				&ti.orth, &ti.lemma, &ti.tag, &ti.name, &ti.labels} {
+				n := binary.LittleEndian.Uint32(b)
+				*s = string(b[4 : 4+n])
+				b = b[4+n:]
+			}
+			ti.isIgn = ti.tag == "ign"
+			ti.isWhitespace = ti.tag == "sp"
+			got = append(got, ti)
+		}
+		assertEqualTokenInfoSlices(t, got, want)
+	})
+
+	_, err := m.AnalyseStringAs(text, 4)
+	assertError(t, err)
+}
+
+func TestAnalyseStringsAs(t *testing.T) {
+	texts := []string{"Ala ma kota.", "", "Dom\tma\n", "kot"}
+	for _, wh := range []morfeusz.WhitespaceHandling{
+		morfeusz.SkipWhitespaces, morfeusz.KeepWhitespaces} {
+		m, _ := morfeusz.New(&morfeusz.Config{WhitespaceHandling: wh})
+		for _, f := range []morfeusz.Format{
+			morfeusz.TSV, morfeusz.Binary, morfeusz.Compact} {
+			got, err := m.AnalyseStringsAs(texts, f)
+			assertNoError(t, err)
+			assertEqualInt(t, len(got), len(texts))
+			for i, text := range texts {
+				want, err := m.AnalyseStringAs(text, f)
+				assertNoError(t, err)
+				assertEqualString(t, string(got[i]), string(want))
+			}
+		}
+	}
+	m, _ := morfeusz.New(nil)
+	_, err := m.AnalyseStringsAs(texts, 4)
+	assertError(t, err)
+}
+
+func TestCompact(t *testing.T) {
+	m, _ := morfeusz.New(nil)
+	text := "Ala ma kota, a kot ma Alę."
+	want := analyseToTokenInfoSlice(t, m, text)
+	b, err := m.AnalyseStringAs(text, morfeusz.Compact)
+	assertNoError(t, err)
+
+	r := morfeusz.NewCompactReader(b)
+	assertEqualString(t, string(r.DictID()), m.DictID())
+	var got []tokenInfo
+	for r.Next() {
+		got = append(got, tokenInfo{
+			r.StartNode(), r.EndNode(),
+			string(r.Orth()), string(r.Lemma()),
+			r.IsIgn(), r.IsWhitespace(),
+			m.Tag(r.TagID()), m.Name(r.NameID()),
+			m.LabelsAsString(r.LabelsID()),
+		})
+	}
+	assertNoError(t, r.Err())
+	assertEqualTokenInfoSlices(t, got, want)
+
+	allocs := testing.AllocsPerRun(10, func() {
+		r.Reset(b)
+		for r.Next() {
+		}
+	})
+	if allocs != 0 {
+		t.Errorf("got %v allocations; want 0", allocs)
+	}
+
+	ts, err := m.DecodeCompact(b)
+	assertNoError(t, err)
+	assertEqualTokenInfoSlices(t, makeTokenInfoSlice(ts, m), want)
+
+	r.Reset(b[:len(b)-1])
+	for r.Next() {
+	}
+	assertError(t, r.Err())
+	_, err = m.DecodeCompact(b[:len(b)-1])
+	assertError(t, err)
+}
+
+func TestAnalyseRecordBatch(t *testing.T) {
+	m, _ := morfeusz.New(nil)
+	texts := []string{"Ala ma kota.", "", "bez xyz"}
+	b, err := m.AnalyseRecordBatch(texts)
+	assertNoError(t, err)
+	c := b.Columns()
+	var want []tokenInfo
+	var wantDocs []int
+	for i, text := range texts {
+		for _, ti := range analyseToTokenInfoSlice(t, m, text) {
+			want = append(want, ti)
+			wantDocs = append(wantDocs, i)
+		}
+	}
+	assertEqualInt(t, b.Len(), len(want))
+	var got []tokenInfo
+	for i := 0; i < b.Len(); i++ {
+		assertEqualInt(t, int(c.Document[i]), wantDocs[i])
+		got = append(got, tokenInfo{
+			int(c.StartNode[i]), int(c.EndNode[i]),
+			string(c.Orth[c.OrthOffsets[i]:c.OrthOffsets[i+1]]),
+			string(c.Lemma[c.LemmaOffsets[i]:c.LemmaOffsets[i+1]]),
+			c.TagID[i] == 0, c.TagID[i] == 1,
+			m.Tag(int(c.TagID[i])), m.Name(int(c.NameID[i])),
+			m.LabelsAsString(int(c.LabelsID[i])),
+		})
+	}
+	assertEqualTokenInfoSlices(t, got, want)
+
+	schema, array := b.CData()
+	if schema == nil || array == nil {
+		t.Error("got CData() == nil; want CData() != nil")
+	}
+}
+
+func TestAnalyseStringsPacked(t *testing.T) {
+	if size := unsafe.Sizeof(morfeusz.PackedTokenInfo{}); size != 32 {
+		t.Errorf("got Sizeof(PackedTokenInfo{}) = %d; want 32", size)
+	}
+	m, _ := morfeusz.New(nil)
+	texts := []string{"Ala ma kota.", "", "Kot ma Alę."}
+	r, err := m.AnalyseStringsPacked(texts)
+	assertNoError(t, err)
+	got := make([][]tokenInfo, len(texts))
+	for i := range r.Tokens {
+		tok := &r.Tokens[i]
+		got[tok.Document] = append(got[tok.Document], tokenInfo{
+			int(tok.StartNode), int(tok.EndNode),
+			string(r.Orth(i)), string(r.Lemma(i)),
+			tok.IsIgn(), tok.IsWhitespace(),
+			m.Tag(int(tok.TagID)), m.Name(int(tok.NameID)),
+			m.LabelsAsString(int(tok.LabelsID)),
+		})
+	}
+	for i, text := range texts {
+		assertEqualTokenInfoSlices(t, got[i], analyseToTokenInfoSlice(t, m, text))
+	}
+}
+
+func TestAnalyseStringInterned(t *testing.T) {
+	m, _ := morfeusz.New(nil)
+	text := "Ala ma kota, a kot ma Alę."
+	tokens, err := m.AnalyseStringInterned(text)
+	assertNoError(t, err)
+	ids := make([]uint32, 0, 2*len(tokens))
+	for _, tok := range tokens {
+		ids = append(ids, tok.OrthID, tok.LemmaID)
+	}
+	strs, err := morfeusz.ResolveInterned(ids)
+	assertNoError(t, err)
+	got := make([]tokenInfo, len(tokens))
+	byString := make(map[string]uint32)
+	for i, tok := range tokens {
+		got[i] = tokenInfo{
+			int(tok.StartNode), int(tok.EndNode), strs[2*i], strs[2*i+1],
+			tok.IsIgn(), tok.IsWhitespace(),
+			m.Tag(int(tok.TagID)), m.Name(int(tok.NameID)),
+			m.LabelsAsString(int(tok.LabelsID)),
+		}
+		for j, s := range strs[2*i : 2*i+2] {
+			if id, ok := byString[s]; ok && id != ids[2*i+j] {
+				t.Errorf("got IDs %d and %d for %q", id, ids[2*i+j], s)
+			}
+			byString[s] = ids[2*i+j]
+		}
+	}
+	assertEqualTokenInfoSlices(t, got, analyseToTokenInfoSlice(t, m, text))
+	_, err = morfeusz.ResolveInterned([]uint32{uint32(morfeusz.InternedCount())})
+	assertError(t, err)
+}
+
+func TestAnalyseStringInterpretations(t *testing.T) {
+	m, _ := morfeusz.New(nil)
+	text := "Ala ma kota, a kot ma Alę."
+	tokens, err := m.AnalyseStringInterpretations(text)
+	assertNoError(t, err)
+	ids := make([]int32, len(tokens))
+	orthIDs := make([]uint32, len(tokens))
+	for i, tok := range tokens {
+		ids[i] = tok.InterpretationID
+		orthIDs[i] = tok.OrthID
+	}
+	interps, err := morfeusz.ResolveInterpretations(ids)
+	assertNoError(t, err)
+	orths, err := morfeusz.ResolveInterned(orthIDs)
+	assertNoError(t, err)
+	got := make([]tokenInfo, len(tokens))
+	for i, tok := range tokens {
+		in := interps[i]
+		lemma, err := morfeusz.ResolveInterned([]uint32{in.LemmaID})
+		assertNoError(t, err)
+		got[i] = tokenInfo{
+			int(tok.StartNode), int(tok.EndNode), orths[i], lemma[0],
+			in.TagID == 0, in.TagID == 1, m.Tag(in.TagID), m.Name(in.NameID),
+			m.LabelsAsString(in.LabelsID),
+		}
+	}
+	assertEqualTokenInfoSlices(t, got, analyseToTokenInfoSlice(t, m, text))
+	again, err := m.AnalyseStringInterpretations(text)
+	assertNoError(t, err)
+	for i := range again {
+		assertEqualInt(t, int(again[i].InterpretationID), int(ids[i]))
+	}
+	_, err = morfeusz.ResolveInterpretations([]int32{-1})
+	assertError(t, err)
+
+	path := filepath.Join(t.TempDir(), "interpretations")
+	assertNoError(t, m.SaveInterpretations(path))
+	// The table is in use, so it cannot be replaced.
+	assertError(t, m.LoadInterpretations(path))
+
+	// A new process loads the table and gives the same IDs.
+	cmd := exec.Command(os.Args[0], "-test.run=^TestLoadInterpretations$")
+	cmd.Env = append(os.Environ(),
+		"MORFEUSZ_TEST_INTERPRETATIONS="+path,
+		"MORFEUSZ_TEST_TEXT="+text,
+		fmt.Sprint("MORFEUSZ_TEST_IDS=", ids))
+	if out, err := cmd.CombinedOutput(); err != nil {
+		t.Errorf("got err == %q from the new process:\n%s", err, out)
+	}
+}
+
+// TestLoadInterpretations is run by TestAnalyseStringInterpretations
+// in a new process, whose table of interpretations is empty.
+func TestLoadInterpretations(t *testing.T) {
+	path := os.Getenv("MORFEUSZ_TEST_INTERPRETATIONS")
+	if path == "" {
+		t.Skip("run by TestAnalyseStringInterpretations")
+	}
+	m, _ := morfeusz.New(nil)
+	n := morfeusz.InterpretationsCount()
+	assertEqualInt(t, n, 0)
+	assertNoError(t, m.LoadInterpretations(path))
+	n = morfeusz.InterpretationsCount()
+	assertNotEqualInt(t, n, 0)
+	tokens, err := m.AnalyseStringInterpretations(
+		os.Getenv("MORFEUSZ_TEST_TEXT"))
+	assertNoError(t, err)
+	ids := make([]int32, len(tokens))
+	for i, tok := range tokens {
+		ids[i] = tok.InterpretationID
+	}
+	assertEqualString(t, fmt.Sprint(ids), os.Getenv("MORFEUSZ_TEST_IDS"))
+	assertEqualInt(t, morfeusz.InterpretationsCount(), n)
+}
+
+// BenchmarkScan compares reading the orths, lemmas and nodes
+// of interpretations stored as TokenInfo and PackedTokenInfo.
+func BenchmarkScan(b *testing.B) {
+	m, _ := morfeusz.New(nil)
+	text := strings.Repeat(
+		"Wczoraj poszliśmy z dziećmi do kina na nowy film. ", 100)
+	var tokens []*morfeusz.TokenInfo
+	r := m.AnalyseString(text)
+	for r.Next() {
+		tokens = append(tokens, r.TokenInfo())
+	}
+	packed, err := m.AnalyseStringsPacked([]string{text})
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	b.Run("TokenInfo", func(b *testing.B) {
+		for i := 0; i < b.N; i++ {
+			n := 0
+			for _, t := range tokens {
+				n += len(t.Orth()) + len(t.Lemma()) + t.EndNode() - t.StartNode()
+			}
+		}
+	})
+	b.Run("PackedTokenInfo", func(b *testing.B) {
+		for i := 0; i < b.N; i++ {
+			n := 0
+			for j := range packed.Tokens {
+				t := &packed.Tokens[j]
+				n += len(packed.Orth(j)) + len(packed.Lemma(j)) +
+					int(t.EndNode-t.StartNode)
+			}
+		}
+	})
+}
+
 func TestGenerate(t *testing.T) {
 	m, _ := morfeusz.New(nil)
 	np := "nazwa_pospolita"
@@ -329,6 +820,97 @@ func TestUsage(t *testing.T) {
 	if mg.AnalyseString("dom") != nil {
 		t.Error("got Analyse() != nil; want Analyse() == nil")
 	}
+
+	m, _ := morfeusz.New(nil)
+	ml, err := morfeusz.New(
+		&morfeusz.Config{Usage: morfeusz.AnalyseAndLazyGenerate})
+	assertNoError(t, err)
+	assertEqualTokenInfoSlices(t,
+		analyseToTokenInfoSlice(t, ml, "Ala ma kota."),
+		analyseToTokenInfoSlice(t, m, "Ala ma kota."))
+	for _, mm := range []*morfeusz.Morfeusz{ml, ml.Clone()} {
+		assertEqualTokenInfoSlices(t,
+			generateToTokenInfoSlice(t, mm, "dom"),
+			generateToTokenInfoSlice(t, m, "dom"))
+	}
+	// Another lazy instance does not share its generator settings.
+	mc, err := morfeusz.New(&morfeusz.Config{
+		Usage: morfeusz.AnalyseAndLazyGenerate, Charset: morfeusz.CP1250})
+	assertNoError(t, err)
+	assertNonEmpty(t, len(generateToTokenInfoSlice(t, mc, "dom")))
+	assertEqualTokenInfoSlices(t,
+		generateToTokenInfoSlice(t, ml, "być"),
+		generateToTokenInfoSlice(t, m, "być"))
+
+	mp, err := morfeusz.New(
+		&morfeusz.Config{Usage: morfeusz.AnalyseAndGenerateInParallel})
+	assertNoError(t, err)
+	assertEqualTokenInfoSlices(t,
+		analyseToTokenInfoSlice(t, mp, "Ala ma kota."),
+		analyseToTokenInfoSlice(t, m, "Ala ma kota."))
+	assertEqualTokenInfoSlices(t,
+		generateToTokenInfoSlice(t, mp.Clone(), "dom"),
+		generateToTokenInfoSlice(t, m, "dom"))
+}
+
+func TestWarmup(t *testing.T) {
+	m, _ := morfeusz.New(nil)
+	basic, err := m.Warmup(morfeusz.WarmupBasic)
+	assertNoError(t, err)
+	assertNotEqualInt(t, basic.Analyses, 0)
+	assertNotEqualInt(t, basic.Generations, 0)
+	full, err := m.Warmup(morfeusz.WarmupFull)
+	assertNoError(t, err)
+	assertEqualInt(t, full.Analyses, basic.Analyses+basic.Generations)
+	assertEqualInt(t, full.Generations, basic.Generations)
+	if full.Duration <= 0 {
+		t.Errorf("got Duration = %v; want Duration > 0", full.Duration)
+	}
+	_, err = m.Warmup(42)
+	assertError(t, err)
+
+	ma, _ := morfeusz.New(&morfeusz.Config{Usage: morfeusz.AnalyseOnly})
+	w, err := ma.Warmup(morfeusz.WarmupFull)
+	assertNoError(t, err)
+	assertNotEqualInt(t, w.Analyses, 0)
+	assertEqualInt(t, w.Generations, 0)
+
+	iso, _ := morfeusz.New(&morfeusz.Config{Charset: morfeusz.ISO8859_2})
+	w, err = iso.Warmup(morfeusz.WarmupFull)
+	assertNoError(t, err)
+	assertEqualInt(t, w.Analyses, 0)
+	assertEqualInt(t, w.Generations, 0)
+}
+
+func TestMemoryStats(t *testing.T) {
+	m, _ := morfeusz.New(nil)
+	before := morfeusz.ReadMemoryStats()
+	c := m.Clone()
+	if c.MemoryUsage() < 0 {
+		t.Errorf("got MemoryUsage() = %d; want >= 0", c.MemoryUsage())
+	}
+	morfeusz.SetResultAccounting(true)
+	r := c.AnalyseString("Ala ma kota.")
+	morfeusz.SetResultAccounting(false)
+	// The orth and lemma of the ign token are too long to be inline.
+	long := strings.Repeat("x", 40)
+	ti := c.AnalyseString(long).TokenInfo()
+	assertEqualString(t, ti.Orth(), long)
+	after := morfeusz.ReadMemoryStats()
+	// Finalizers of other tests may free instances in the meantime.
+	if after.Instances < 2 {
+		t.Errorf("got %d Instances; want at least 2", after.Instances)
+	}
+	assertEqualInt(t, after.Results, before.Results+1)
+	assertEqualInt(t, int(after.ResultBytes-before.ResultBytes),
+		int(r.MemoryUsage()))
+	if after.TokenInfos < 1 || after.TokenInfoBytes < 2*int64(len(long)) {
+		t.Errorf("got %d TokenInfos with %d bytes; want at least 1 with %d",
+			after.TokenInfos, after.TokenInfoBytes, 2*len(long))
+	}
+	runtime.KeepAlive(m)
+	runtime.KeepAlive(r)
+	runtime.KeepAlive(ti)
 }
 
 func TestDictionarySearchPaths(t *testing.T) {
@@ -359,6 +941,210 @@ func TestDictionarySearchPaths(t *testing.T) {
 	assertEmpty(t, len(m.DictionarySearchPaths()))
 }
 
+func TestAnalysisCache(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "cache")
+	text := "Ala ma kota."
+	m, _ := morfeusz.New(nil)
+	want := analyseToTokenInfoSlice(t, m, text)
+
+	c, err := morfeusz.OpenAnalysisCache(path)
+	assertNoError(t, err)
+	m.SetAnalysisCache(c)
+	assertEqualTokenInfoSlices(t, analyseToTokenInfoSlice(t, m, text), want)
+	if s := c.Stats(); s != (morfeusz.AnalysisCacheStats{Misses: 1}) {
+		t.Errorf("got Stats() = %+v before compaction", s)
+	}
+
+	assertNoError(t, morfeusz.CompactAnalysisCache(path))
+	c, err = morfeusz.OpenAnalysisCache(path)
+	assertNoError(t, err)
+	m.SetAnalysisCache(c)
+	assertEqualTokenInfoSlices(t, analyseToTokenInfoSlice(t, m, text), want)
+	assertEqualTokenInfoSlices(
+		t, analyseToTokenInfoSlice(t, m.Clone(), text), want)
+	if s := c.Stats(); s != (morfeusz.AnalysisCacheStats{Entries: 1, Hits: 2}) {
+		t.Errorf("got Stats() = %+v after compaction", s)
+	}
+
+	m.SetAnalysisCache(nil)
+	assertEqualTokenInfoSlices(t, analyseToTokenInfoSlice(t, m, text), want)
+	assertEqualInt(t, int(c.Stats().Hits), 2)
+}
+
+func TestSentenceCache(t *testing.T) {
+	text := "Ala ma kota."
+	m, _ := morfeusz.New(nil)
+	want := analyseToTokenInfoSlice(t, m, text)
+
+	c := morfeusz.NewSentenceCache(1 << 20)
+	m.SetSentenceCache(c)
+	assertEqualTokenInfoSlices(t, analyseToTokenInfoSlice(t, m, text), want)
+	assertEqualTokenInfoSlices(
+		t, analyseToTokenInfoSlice(t, m.Clone(), text), want)
+	s := c.Stats()
+	if s.Entries != 1 || s.Bytes <= 0 || s.Hits != 1 || s.Misses != 1 ||
+		s.Rejected != 0 {
+		t.Errorf("got Stats() = %+v", s)
+	}
+
+	empty := morfeusz.NewSentenceCache(0)
+	m.SetSentenceCache(empty)
+	assertEqualTokenInfoSlices(t, analyseToTokenInfoSlice(t, m, text), want)
+	assertEqualTokenInfoSlices(t, analyseToTokenInfoSlice(t, m, text), want)
+	if s := empty.Stats(); s != (morfeusz.SentenceCacheStats{Misses: 2}) {
+		t.Errorf("got Stats() = %+v with no budget", s)
+	}
+
+	// A small cache keeps the texts analysed often while a stream
+	// of texts analysed once, which would flush an LRU cache, passes.
+	small := morfeusz.NewSentenceCache(1 << 16)
+	m.SetSentenceCache(small)
+	analyseHot := func() int64 {
+		before := small.Stats().Hits
+		for i := 0; i < 32; i++ {
+			analyseToTokenInfoSlice(t, m, fmt.Sprintf("Ala ma %d kotów.", i))
+		}
+		return small.Stats().Hits - before
+	}
+	for i := 0; i < 3; i++ {
+		analyseHot()
+	}
+	var hits int64
+	for round := 0; round < 50; round++ {
+		for i := 0; i < 100; i++ {
+			analyseToTokenInfoSlice(
+				t, m, fmt.Sprintf("Pies %d szczeka.", round*100+i))
+		}
+		if h := analyseHot(); round >= 40 {
+			hits += h
+		}
+	}
+	if hits < 3*320/4 {
+		t.Errorf("got %d hits of 320 for the frequent texts", hits)
+	}
+	if s := small.Stats(); s.Rejected == 0 {
+		t.Errorf("got Stats() = %+v with a small budget", s)
+	}
+	m.SetSentenceCache(nil)
+}
+
+func TestFormTable(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "forms")
+	forms := []string{"Ala", "ma", "kota", "kot", "ma"}
+	m, _ := morfeusz.New(nil)
+	assertNoError(t, m.BuildFormTable(path, forms, 2))
+	table, err := morfeusz.OpenFormTable(path)
+	assertNoError(t, err)
+	assertEqualInt(t, table.Len(), 4)
+
+	c := m.Clone()
+	assertNoError(t, c.SetFormTable(table))
+	// Texts are looked up word by word; the last two lack a word.
+	texts := append(forms, "Ala ma kota", " ma\tkot ", "psa", "Ala ma psa")
+	for _, text := range texts {
+		assertEqualTokenInfoSlices(t, analyseToTokenInfoSlice(t, c, text),
+			analyseToTokenInfoSlice(t, m, text))
+	}
+	if s := table.Stats(); s != (morfeusz.FormTableStats{Hits: 7, Misses: 2}) {
+		t.Errorf("got Stats() = %+v", s)
+	}
+	// Settings changed through a clone make c bypass the table too.
+	cc := c.Clone()
+	assertNoError(t, cc.SetCaseHandling(morfeusz.IgnoreCase))
+	assertEqualTokenInfoSlices(t, analyseToTokenInfoSlice(t, c, "Ala"),
+		analyseToTokenInfoSlice(t, cc, "Ala"))
+	if s := table.Stats(); s != (morfeusz.FormTableStats{Hits: 7, Misses: 4}) {
+		t.Errorf("got Stats() = %+v after SetCaseHandling", s)
+	}
+	assertNoError(t, c.SetFormTable(nil))
+
+	assertNoError(t, m.SetCaseHandling(morfeusz.ConditionallyCaseSensitive))
+	assertNoError(t, m.SetTokenNumbering(morfeusz.ContinuousNumbering))
+	assertError(t, m.BuildFormTable(path, forms, 2))
+	assertEqualInt(t, int(m.TokenNumbering()),
+		int(morfeusz.ContinuousNumbering))
+
+	other, _ := morfeusz.New(&morfeusz.Config{CaseHandling: morfeusz.IgnoreCase})
+	assertError(t, other.SetFormTable(table))
+}
+
+func TestVocabulary(t *testing.T) {
+	m, _ := morfeusz.New(nil)
+	v, err := m.NewVocabulary([]string{"Ala", "ma", "kota", "ma"}, 2)
+	assertNoError(t, err)
+	assertEqualInt(t, v.Len(), 3)
+	for _, text := range []string{"", "Ala ma kota", " ma\tpsa,  Ala\n"} {
+		want, err := m.AnalyseStringAs(text, morfeusz.TSV)
+		assertNoError(t, err)
+		got, err := m.Clone().AnalyseStringAsWithVocabulary(v, text, morfeusz.TSV)
+		assertNoError(t, err)
+		assertEqualString(t, string(got), string(want))
+	}
+
+	other, _ := morfeusz.New(&morfeusz.Config{CaseHandling: morfeusz.IgnoreCase})
+	_, err = other.AnalyseStringAsWithVocabulary(v, "Ala", morfeusz.TSV)
+	assertError(t, err)
+	keep, _ := morfeusz.New(
+		&morfeusz.Config{WhitespaceHandling: morfeusz.KeepWhitespaces})
+	_, err = keep.NewVocabulary([]string{"Ala"}, 1)
+	assertError(t, err)
+}
+
+func TestPrefork(t *testing.T) {
+	m, _ := morfeusz.New(nil)
+	dir := t.TempDir()
+	l, err := net.Listen("unix", filepath.Join(dir, "other.sock"))
+	assertNoError(t, err)
+	defer l.Close()
+	peer, err := net.Dial("unix", filepath.Join(dir, "other.sock"))
+	assertNoError(t, err)
+	defer peer.Close()
+	other, err := l.Accept()
+	assertNoError(t, err)
+
+	path := filepath.Join(dir, "morfeusz.sock")
+	s, err := m.Prefork(path, 2, morfeusz.TSV)
+	assertNoError(t, err)
+	defer s.Close()
+	assertEqualInt(t, len(s.PIDs()), 2)
+
+	// The workers must not keep the connection open.
+	other.Close()
+	peer.SetReadDeadline(time.Now().Add(5 * time.Second))
+	_, err = peer.Read(make([]byte, 1))
+	if err != io.EOF {
+		t.Errorf("got %v; want io.EOF", err)
+	}
+
+	c, err := net.Dial("unix", path)
+	assertNoError(t, err)
+	defer c.Close()
+	for _, text := range []string{"Ala ma kota.", "", "Pies."} {
+		want, err := m.AnalyseStringAs(text, morfeusz.TSV)
+		assertNoError(t, err)
+		req := binary.LittleEndian.AppendUint32(nil, uint32(len(text)))
+		_, err = c.Write(append(req, text...))
+		assertNoError(t, err)
+		header := make([]byte, 8)
+		_, err = io.ReadFull(c, header)
+		assertNoError(t, err)
+		assertEqualInt(t, int(binary.LittleEndian.Uint32(header)), 0)
+		got := make([]byte, binary.LittleEndian.Uint32(header[4:]))
+		_, err = io.ReadFull(c, got)
+		assertNoError(t, err)
+		assertEqualString(t, string(got), string(want))
+	}
+
+	mem, err := s.Memory()
+	assertNoError(t, err)
+	assertEqualInt(t, len(mem), 2)
+	for _, w := range mem {
+		if w.RSS == 0 || w.Shared+w.Private != w.RSS {
+			t.Errorf("got Memory() = %+v", w)
+		}
+	}
+}
+
 func TestClone(t *testing.T) {
 	m, _ := morfeusz.New(nil)
 	c := m.Clone()
@@ -378,6 +1164,45 @@ func TestClone(t *testing.T) {
 	assertEqualTokenInfoSlices(t, tGot, tWant)
 }
 
+func TestRouter(t *testing.T) {
+	r := morfeusz.NewRouter()
+	confs := []morfeusz.Config{
+		{},
+		{WhitespaceHandling: morfeusz.KeepWhitespaces},
+	}
+	for i, c := range confs {
+		id, err := r.AddDictionary(&c)
+		assertNoError(t, err)
+		assertEqualInt(t, id, i)
+	}
+	_, err := r.AddDictionary(&morfeusz.Config{DictName: "xyz"})
+	assertError(t, err)
+	assertEqualInt(t, r.Len(), len(confs))
+
+	for i, c := range confs {
+		m, _ := morfeusz.New(&c)
+		d := r.Morfeusz(i)
+		res, err := r.AnalyseString(i, "bez xyz")
+		assertNoError(t, err)
+		assertEqualTokenInfoSlices(t,
+			resultToTokenInfoSlice(res, d),
+			analyseToTokenInfoSlice(t, m, "bez xyz"))
+		ts, err := r.Generate(i, "dom")
+		assertNoError(t, err)
+		assertEqualTokenInfoSlices(t,
+			makeTokenInfoSlice(ts, d),
+			generateToTokenInfoSlice(t, m, "dom"))
+	}
+
+	if r.Morfeusz(len(confs)) != nil {
+		t.Error("got Morfeusz() != nil; want Morfeusz() == nil")
+	}
+	_, err = r.AnalyseString(-1, "dom")
+	assertError(t, err)
+	_, err = r.Generate(len(confs), "dom")
+	assertError(t, err)
+}
+
 func expandTokenInfo(
 	t *morfeusz.TokenInfo, m *morfeusz.Morfeusz) tokenInfo {
 	// Check against double freeing of the underlying C.struct_String.
@@ -394,10 +1219,7 @@ func expandTokenInfo(
 func analyseToTokenInfoSlice(
 	t *testing.T, m *morfeusz.Morfeusz, text string) []tokenInfo {
 	r := m.AnalyseString(text)
-	var ret []tokenInfo
-	for r.Next() {
-		ret = append(ret, expandTokenInfo(r.TokenInfo(), m))
-	}
+	ret := resultToTokenInfoSlice(r, m)
 	// Check that nil is returned when there is no more information.
 	if r.TokenInfo() != nil {
 		t.Error("got TokenInfo() != nil; want TokenInfo() == nil")
@@ -405,6 +1227,15 @@ func analyseToTokenInfoSlice(
 	return ret
 }
 
+func resultToTokenInfoSlice(
+	r *morfeusz.Result, m *morfeusz.Morfeusz) []tokenInfo {
+	var ret []tokenInfo
+	for r.Next() {
+		ret = append(ret, expandTokenInfo(r.TokenInfo(), m))
+	}
+	return ret
+}
+
 func generateToTokenInfoSlice(
 	t *testing.T, m *morfeusz.Morfeusz, lemma string) []tokenInfo {
 	ts, err := m.Generate(lemma)
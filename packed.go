@@ -0,0 +1,49 @@
+package morfeusz
+
+// PackedTokenInfo is the type of a struct holding the morphological
+// interpretation of a token in 32 bytes, laid out like struct
+// PackedTokenInfo of the C API. Its orth and lemma are stored
+// in the string area of the PackedResult that holds it.
+type PackedTokenInfo struct {
+	OrthOffset  uint32
+	LemmaOffset uint32
+	StartNode   int32
+	EndNode     int32
+	OrthLength  uint16
+	LemmaLength uint16
+	TagID       uint16
+	NameID      uint16
+	LabelsID    uint16
+	_           uint16
+	Document    uint32
+}
+
+// IsIgn returns true only when a token is an unknown word.
+func (t *PackedTokenInfo) IsIgn() bool {
+	return t.TagID == 0
+}
+
+// IsWhitespace returns true when a token represents whitespace.
+func (t *PackedTokenInfo) IsWhitespace() bool {
+	return t.TagID == 1
+}
+
+// PackedResult is the type of a struct holding interpretations
+// packed into PackedTokenInfo structs and the string area
+// they refer to.
+type PackedResult struct {
+	Tokens  []PackedTokenInfo
+	Strings []byte
+}
+
+// Orth returns the spelling of token i.
+func (r *PackedResult) Orth(i int) []byte {
+	t := &r.Tokens[i]
+	return r.Strings[t.OrthOffset : t.OrthOffset+uint32(t.OrthLength)]
+}
+
+// Lemma returns the lemma of token i.
+func (r *PackedResult) Lemma(i int) []byte {
+	t := &r.Tokens[i]
+	return r.Strings[t.LemmaOffset : t.LemmaOffset+uint32(t.LemmaLength)]
+}
@@ -0,0 +1,126 @@
+//go:build linux
+
+package morfeusz
+
+/*
+#include "morfeusz-shm.h"
+
+static int shmSendFromGo(
+    const struct ShmSegment* s, uint32_t id, _GoString_ text) {
+  return shmSend(s, id, _GoStringPtr(text), _GoStringLen(text));
+}
+*/
+import "C"
+
+import (
+	"errors"
+	"runtime"
+	"unsafe"
+)
+
+var (
+	errShmClosed  = errors.New("Shared memory segment closed")
+	errShmTooLong = errors.New("Text too long for the ring")
+)
+
+// ShmSegment is the type of a struct representing a shared memory
+// segment through which a client on the same host sends texts
+// to a server and receives the results of their analysis,
+// as described in morfeusz-shm.h. The server creates the segment
+// and passes its file descriptor to the client, e.g. with
+// syscall.UnixRights, and the client attaches to it.
+//
+// Send and Receive are meant for the client and ServeShm for
+// the server. Send must not be called concurrently with itself
+// and Receive must not be called concurrently with itself, but one
+// goroutine may send while another one receives.
+type ShmSegment struct {
+	seg C.struct_ShmSegment
+}
+
+// NewShmSegment creates a segment whose rings for requests and
+// responses have ringSize bytes each. The size must be a power of two
+// not smaller than 4096. Responses larger than half of it fail.
+func NewShmSegment(ringSize int) (*ShmSegment, error) {
+	return gcShmSegment(C.createShmSegment(C.int(ringSize)))
+}
+
+// AttachShmSegment maps the segment referred to by fd,
+// which the returned segment takes over.
+func AttachShmSegment(fd int) (*ShmSegment, error) {
+	return gcShmSegment(C.attachShmSegment(C.int(fd)))
+}
+
+// FD returns the file descriptor of the segment.
+func (s *ShmSegment) FD() int {
+	return int(s.seg.fd)
+}
+
+// Close tells both sides that the segment is closed: ServeShm returns,
+// and Send and Receive fail.
+func (s *ShmSegment) Close() {
+	C.closeShmSegment(&s.seg)
+}
+
+// ServeShm answers the requests coming through the segment
+// with the results of morphological analysis of their texts until
+// the segment is closed. Responses come in the order of requests.
+func (m Morfeusz) ServeShm(s *ShmSegment) {
+	C.serveShm(m.morf, &s.seg)
+	runtime.KeepAlive(s)
+}
+
+// Send sends text for analysis with an ID that will identify
+// the response. It blocks while the ring of requests is full.
+func (s *ShmSegment) Send(id uint32, text string) error {
+	ret := C.shmSendFromGo(&s.seg, C.uint32_t(id), text)
+	runtime.KeepAlive(s)
+	switch ret {
+	case -1:
+		return errShmClosed
+	case -2:
+		return errShmTooLong
+	}
+	return nil
+}
+
+// Receive waits for the next response and returns its ID and a copy
+// of the results of analysis. The nodes are numbered from 0 for every
+// text, and Document is 0. When the analysis fails, it returns
+// the ID and the error.
+func (s *ShmSegment) Receive() (uint32, *PackedResult, error) {
+	defer runtime.KeepAlive(s)
+	resp := C.shmReceive(&s.seg)
+	if resp == nil {
+		return 0, nil, errShmClosed
+	}
+	defer C.shmDone(&s.seg)
+	p := unsafe.Add(unsafe.Pointer(resp), unsafe.Sizeof(*resp))
+	tokens := unsafe.Slice((*PackedTokenInfo)(p), resp.tokensLength)
+	p = unsafe.Add(p, len(tokens)*int(unsafe.Sizeof(PackedTokenInfo{})))
+	strings := C.GoBytes(p, C.int(resp.stringsLength))
+	if resp.status != 0 {
+		return uint32(resp.id), nil, errors.New(string(strings))
+	}
+	ret := &PackedResult{
+		Tokens:  append([]PackedTokenInfo(nil), tokens...),
+		Strings: strings,
+	}
+	return uint32(resp.id), ret, nil
+}
+
+func gcShmSegment(seg C.struct_ShmSegment) (*ShmSegment, error) {
+	if seg.header == nil {
+		defer C.freeShmSegment(&seg)
+		return nil, errors.New(goString(seg.error))
+	}
+	ret := &ShmSegment{seg}
+	// Make sure that the segment will be unmapped and its file
+	// descriptor closed when ret is garbage-collected.
+	runtime.SetFinalizer(ret, freeShmSegment)
+	return ret, nil
+}
+
+func freeShmSegment(s *ShmSegment) {
+	C.freeShmSegment(&s.seg)
+}
@@ -0,0 +1,70 @@
+//go:build linux
+
+package morfeusz_test
+
+import (
+	"fmt"
+	"strings"
+	"syscall"
+	"testing"
+
+	"github.com/go-morfeusz/morfeusz"
+)
+
+func TestShm(t *testing.T) {
+	m, _ := morfeusz.New(nil)
+	server, err := morfeusz.NewShmSegment(4096)
+	assertNoError(t, err)
+	// The test analyses with m meanwhile, so the server uses a clone.
+	c := m.Clone()
+	done := make(chan struct{})
+	go func() {
+		c.ServeShm(server)
+		close(done)
+	}()
+	fd, err := syscall.Dup(server.FD())
+	assertNoError(t, err)
+	client, err := morfeusz.AttachShmSegment(fd)
+	assertNoError(t, err)
+	// Send enough requests to wrap around the rings many times.
+	const n = 1000
+	texts := make([]string, n)
+	for i := range texts {
+		texts[i] = fmt.Sprintf("Ala ma %d kotów.", i)
+	}
+	go func() {
+		for i, text := range texts {
+			assertNoError(t, client.Send(uint32(i), text))
+		}
+	}()
+	for i, text := range texts {
+		id, r, err := client.Receive()
+		assertNoError(t, err)
+		assertEqualInt(t, int(id), i)
+		var got []tokenInfo
+		for j := range r.Tokens {
+			tok := &r.Tokens[j]
+			got = append(got, tokenInfo{
+				int(tok.StartNode), int(tok.EndNode),
+				string(r.Orth(j)), string(r.Lemma(j)),
+				tok.IsIgn(), tok.IsWhitespace(),
+				m.Tag(int(tok.TagID)), m.Name(int(tok.NameID)),
+				m.LabelsAsString(int(tok.LabelsID)),
+			})
+		}
+		assertEqualTokenInfoSlices(t, got, analyseToTokenInfoSlice(t, m, text))
+	}
+
+	err = client.Send(n, strings.Repeat("x", 4096))
+	assertError(t, err)
+	// The text fits in the ring but its analysis does not.
+	assertNoError(t, client.Send(n, strings.Repeat("kot ", 400)))
+	id, _, err := client.Receive()
+	assertEqualInt(t, int(id), n)
+	assertError(t, err)
+
+	server.Close()
+	<-done
+	_, _, err = client.Receive()
+	assertError(t, err)
+}